@@ -0,0 +1,346 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+#include "clipp.hpp"
+
+// GCC doesn't understand that free is fine for memory from the replaced operator new
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+// Every allocation is counted, so we can report allocations per parse
+std::atomic<size_t> allocations { 0 };
+
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (auto ptr = std::malloc(size > 0 ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+struct ManyFlagsArgs : public clipp::ArgsBase {
+    bool flags[200] = {};
+    std::optional<std::string> output;
+    std::string input;
+
+    void args()
+    {
+        for (size_t i = 0; i < std::size(flags); ++i) {
+            flag(flags[i], "flag" + std::to_string(i)).help("A flag with some help text");
+        }
+        flag(output, "output", 'o').help("Where to write the output");
+        positional(input, "input").help("The input file");
+    }
+};
+
+struct PositionalsArgs : public clipp::ArgsBase {
+    bool verbose = false;
+    std::optional<std::string> output;
+    std::vector<std::string> inputs;
+
+    void args()
+    {
+        flag(verbose, "verbose", 'v');
+        flag(output, "output", 'o');
+        positional(inputs, "inputs");
+    }
+};
+
+struct ViewPositionalsArgs : public clipp::ArgsBase {
+    bool verbose = false;
+    std::optional<std::string_view> output;
+    std::vector<std::string_view> inputs;
+
+    void args()
+    {
+        flag(verbose, "verbose", 'v');
+        flag(output, "output", 'o');
+        positional(inputs, "inputs");
+    }
+};
+
+struct ShortStackArgs : public clipp::ArgsBase {
+    size_t counts[26] = {};
+    std::string input;
+
+    void args()
+    {
+        for (size_t i = 0; i < std::size(counts); ++i) {
+            // Upper case, so -h is still help
+            const auto c = static_cast<char>('A' + i);
+            flag(counts[i], std::string(1, c), c);
+        }
+        positional(input, "input");
+    }
+};
+
+struct VecFlagArgs : public clipp::ArgsBase {
+    std::vector<int64_t> points;
+
+    void args()
+    {
+        flag(points, "point", 'p').num(3).collect();
+    }
+};
+
+struct DelimitedArgs : public clipp::ArgsBase {
+    std::vector<int64_t> ids;
+
+    void args()
+    {
+        flag(ids, "ids").delimiter(',');
+    }
+};
+
+std::vector<std::string> choiceNames()
+{
+    std::vector<std::string> choices;
+    for (size_t i = 0; i < 200; ++i) {
+        choices.push_back("choice" + std::to_string(i));
+    }
+    return choices;
+}
+
+struct ChoicesArgs : public clipp::ArgsBase {
+    std::optional<std::string> mode;
+    std::vector<std::string> values;
+
+    void args()
+    {
+        static const auto choices = choiceNames();
+        flag(mode, "mode", 'm').choices(choices);
+        positional(values, "values").choices(choices);
+    }
+};
+
+// Like examples/subcommands.cpp
+struct ParentArgs : public clipp::ArgsBase {
+    std::optional<std::string> device;
+    std::string command;
+
+    void args()
+    {
+        flag(device, "device", 'd').help("Which device to start the system on");
+        positional(command, "command").choices({ "start", "stop" }).halt();
+    }
+};
+
+struct StartArgs : public clipp::ArgsBase {
+    std::optional<std::string> power;
+    std::string system;
+
+    void args()
+    {
+        flag(power, "power", 'p').help("With how much power to start the system");
+        positional(system, "system").help("The system to start");
+    }
+};
+
+struct NativeParentArgs : public clipp::ArgsBase {
+    std::optional<std::string> device;
+    std::optional<StartArgs> start;
+
+    void args()
+    {
+        flag(device, "device", 'd').help("Which device to start the system on");
+        subcommand(start, "start");
+    }
+};
+
+// Half of the settings are taken from the environment and half from a config file
+struct SettingsArgs : public clipp::ArgsBase {
+    std::optional<int64_t> settings[300];
+
+    void args()
+    {
+        for (size_t i = 0; i < std::size(settings); ++i) {
+            const auto name = "setting" + std::to_string(i);
+            auto& f = flag(settings[i], name);
+            if (i % 2 == 0) {
+                f.env("BENCH_SETTING" + std::to_string(i));
+            }
+        }
+    }
+};
+
+struct NullOutput : clipp::OutputBase {
+    void out(std::string_view) override { }
+    void err(std::string_view) override { }
+};
+
+clipp::Parser getParser()
+{
+    auto parser = clipp::Parser("bench");
+    parser.output(std::make_shared<NullOutput>());
+    parser.exit([](int status) {
+        std::cerr << "Parsing failed with status " << status << std::endl;
+        std::exit(1);
+    });
+    return parser;
+}
+
+// Runs the parse function until at least minDuration has passed and prints the average
+template <typename Func>
+void run(std::string_view name, size_t numTokens, Func&& parseOnce)
+{
+    using Clock = std::chrono::steady_clock;
+    constexpr auto minDuration = std::chrono::milliseconds(300);
+
+    parseOnce(); // warmup (this also builds the cached schema)
+
+    size_t iterations = 0;
+    const auto allocsBefore = allocations.load();
+    const auto start = Clock::now();
+    auto now = start;
+    while (now - start < minDuration) {
+        parseOnce();
+        iterations++;
+        now = Clock::now();
+    }
+    const auto allocs = allocations.load() - allocsBefore;
+
+    const auto ns = std::chrono::duration<double, std::nano>(now - start).count() / iterations;
+    std::printf("%-24s %8zu tokens %12.1f ns/parse %10.2f ns/token %10.1f allocs/parse\n",
+        std::string(name).c_str(), numTokens, ns, ns / std::max<size_t>(numTokens, 1),
+        static_cast<double>(allocs) / iterations);
+}
+
+template <typename Args>
+void runArgs(std::string_view name, const std::vector<std::string>& argv)
+{
+    auto parser = getParser();
+    run(name, argv.size(), [&]() {
+        const auto args = parser.parse<Args>(argv);
+        if (!args) {
+            std::cerr << name << ": parsing failed" << std::endl;
+            std::exit(1);
+        }
+    });
+}
+
+int main()
+{
+    runArgs<ManyFlagsArgs>(
+        "many flags", { "--flag199", "--flag0", "-o", "out.txt", "--flag100", "input.txt" });
+
+    std::vector<std::string> positionals { "-v", "--output", "out.txt" };
+    for (size_t i = 0; i < 100'000; ++i) {
+        positionals.push_back("input" + std::to_string(i) + ".txt");
+    }
+    runArgs<PositionalsArgs>("100k positionals", positionals);
+    runArgs<ViewPositionalsArgs>("100k positionals (views)", positionals);
+    {
+        auto parser = getParser();
+        ViewPositionalsArgs args;
+        run("100k positionals (into)", positionals.size(), [&]() {
+            if (!parser.parseInto(args, positionals)) {
+                std::cerr << "into: parsing failed" << std::endl;
+                std::exit(1);
+            }
+        });
+    }
+
+    std::vector<std::string> stacks;
+    for (size_t i = 0; i < 100; ++i) {
+        stacks.push_back("-ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+    }
+    stacks.push_back("input");
+    runArgs<ShortStackArgs>("short option stacks", stacks);
+
+    std::vector<std::string> points;
+    for (size_t i = 0; i < 1000; ++i) {
+        points.insert(points.end(),
+            { "--point", std::to_string(i), std::to_string(-int64_t(i)), std::to_string(i * 7) });
+    }
+    runArgs<VecFlagArgs>("vector flag num/collect", points);
+
+    std::string ids = "--ids=0";
+    for (size_t i = 1; i < 100'000; ++i) {
+        ids.append("," + std::to_string(i * 7919));
+    }
+    runArgs<DelimitedArgs>("100k delimited ids", { ids });
+
+    std::vector<std::string> choices { "--mode", "choice199" };
+    for (size_t i = 0; i < 1000; ++i) {
+        choices.push_back("choice" + std::to_string(199 - i % 200));
+    }
+    runArgs<ChoicesArgs>("choices", choices);
+
+    {
+        const std::vector<std::string> argv { "-d", "gpu", "start", "--power", "9000", "reactor" };
+        auto parser = getParser();
+        auto subParser = getParser();
+        run("subcommands", argv.size(), [&]() {
+            const auto args = parser.parse<ParentArgs>(argv);
+            const auto subArgs = subParser.parse<StartArgs>(args->remaining());
+            if (!subArgs || subArgs->system != "reactor") {
+                std::cerr << "subcommands: parsing failed" << std::endl;
+                std::exit(1);
+            }
+        });
+    }
+
+    runArgs<NativeParentArgs>(
+        "subcommands (native)", { "-d", "gpu", "start", "--power", "9000", "reactor" });
+
+    {
+        std::string lines;
+        for (size_t i = 0; i < 10'000; ++i) {
+            lines.append("-d gpu" + std::to_string(i % 8) + " start --power " + std::to_string(i)
+                + " 'reactor " + std::to_string(i) + "'\n");
+        }
+        const auto compiled = getParser().compile<NativeParentArgs>();
+        run("10k lines", 10'000 * 6, [&]() {
+            size_t failed = 0;
+            compiled.parseLines(lines, [&](size_t, auto&& res) { failed += !res; });
+            if (failed) {
+                std::cerr << "lines: parsing failed" << std::endl;
+                std::exit(1);
+            }
+        });
+    }
+
+    {
+        std::string config;
+        for (size_t i = 0; i < std::size(SettingsArgs {}.settings); ++i) {
+            if (i % 2 == 0) {
+                ::setenv(("BENCH_SETTING" + std::to_string(i)).c_str(), "42", 1);
+            } else {
+                config.append("setting" + std::to_string(i) + " = " + std::to_string(i) + "\n");
+            }
+        }
+        auto f = std::fopen("bench_config.ini", "wb");
+        std::fwrite(config.data(), 1, config.size(), f);
+        std::fclose(f);
+
+        auto parser = getParser();
+        parser.configFile("bench_config.ini", true);
+        run("300 env/config settings", 0, [&]() {
+            const auto args = parser.parse<SettingsArgs>(std::vector<std::string> {});
+            if (!args || args->settings[0] != 42 || args->settings[299] != 299) {
+                std::cerr << "settings: parsing failed" << std::endl;
+                std::exit(1);
+            }
+        });
+        std::remove("bench_config.ini");
+    }
+
+    return 0;
+}
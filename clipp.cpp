@@ -0,0 +1,7 @@
+// The compiled part of clipp for CLIPP_SEPARATE_COMPILATION, see meson.build. Anything that changes
+// the classes (e.g. CLIPP_INSTRUMENT) has to be defined the same here and where clipp.hpp is used.
+#ifndef CLIPP_SEPARATE_COMPILATION
+#define CLIPP_SEPARATE_COMPILATION
+#endif
+#define CLIPP_SOURCE
+#include "clipp.hpp"
@@ -1,21 +1,86 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
 #include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <functional>
 #include <limits>
 #include <memory>
+#include <mutex>
+#include <new>
 #include <optional>
-#include <sstream>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
 #include <vector>
 
+#ifdef CLIPP_DEBUG
+#include <sstream>
+#endif
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CLIPP_HAS_MMAP
+#endif
+
+// With CLIPP_SEPARATE_COMPILATION defined, the parts of the parser that don't depend on the Args
+// type are only declared here and compiled once in clipp.cpp, which then has to be linked in.
+#ifdef CLIPP_SEPARATE_COMPILATION
+#define CLIPP_DECL
+#else
+#define CLIPP_DECL inline
+#endif
+
+// Response files are split with SIMD instructions where available. Define CLIPP_NO_SIMD to always
+// use the scalar code.
+#if !defined(CLIPP_NO_SIMD) && (!defined(CLIPP_SEPARATE_COMPILATION) || defined(CLIPP_SOURCE))
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CLIPP_SIMD_AVX2
+#define CLIPP_SIMD_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CLIPP_SIMD_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define CLIPP_SIMD_NEON
+#endif
+#if defined(_MSC_VER) && (defined(CLIPP_SIMD_SSE2) || defined(CLIPP_SIMD_NEON))
+#include <intrin.h>
+#endif
+#endif
+
+#if __has_include(<unistd.h>)
+// Not every unistd.h declares it
+extern char** environ;
+#define CLIPP_HAS_ENVIRON
+#endif
+
 namespace clipp {
-template <typename T>
+// Specialize this for your types, see reference.md. The second parameter is for enable_if.
+template <typename T, typename = void>
 struct Value;
 
+class ArgsBase;
+class Parser;
+
+namespace detail {
+    class ArgBase;
+}
+
 template <>
 struct Value<std::string> {
     static constexpr std::string_view typeName = "";
@@ -26,33 +91,236 @@ struct Value<std::string> {
     }
 };
 
+// The view points into the arguments that were parsed (or a response file owned by the ArgsBase),
+// so it is only valid as long as those are. argv from main lives for the whole process.
 template <>
-struct Value<int64_t> {
-    static constexpr std::string_view typeName = "integer";
+struct Value<std::string_view> {
+    static constexpr std::string_view typeName = "";
+
+    static std::optional<std::string_view> parse(std::string_view str)
+    {
+        return str;
+    }
+};
 
-    static std::optional<int64_t> parse(std::string_view str)
+namespace detail {
+    template <typename T>
+    std::optional<T> parseNumber(std::string_view str)
     {
-        int64_t val;
+        T val;
         const auto res = std::from_chars(str.data(), str.data() + str.size(), val);
         if (res.ec != std::errc() || res.ptr < str.data() + str.size()) {
             return std::nullopt;
         }
         return val;
     }
+
+    // Characters are not numbers
+    template <typename T>
+    constexpr bool isInteger = std::is_integral_v<T> && !std::is_same_v<T, bool>
+        && !std::is_same_v<T, char> && !std::is_same_v<T, wchar_t>
+        && !std::is_same_v<T, char16_t> && !std::is_same_v<T, char32_t>;
+
+    // Parses a number at the beginning of str (as a double only if it has a fractional part) and
+    // removes it from str
+    inline std::optional<double> parseLeadingNumber(std::string_view& str, bool& integral,
+        uint64_t& integer)
+    {
+        const auto end = str.data() + str.size();
+        const auto res = std::from_chars(str.data(), end, integer);
+        integral = res.ec == std::errc() && (res.ptr == end || *res.ptr != '.');
+        if (integral) {
+            str.remove_prefix(static_cast<size_t>(res.ptr - str.data()));
+            return static_cast<double>(integer);
+        }
+        double val;
+        const auto dres = std::from_chars(str.data(), end, val, std::chars_format::fixed);
+        if (dres.ec != std::errc() || !(val >= 0)) {
+            return std::nullopt;
+        }
+        str.remove_prefix(static_cast<size_t>(dres.ptr - str.data()));
+        return val;
+    }
+
+    inline bool equalsIgnoreCase(std::string_view a, std::string_view b)
+    {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < a.size(); ++i) {
+            const auto lower = [](char ch) { return ch >= 'A' && ch <= 'Z' ? ch + 'a' - 'A' : ch; };
+            if (lower(a[i]) != lower(b[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+// All integer types, with range checks
+template <typename T>
+struct Value<T, std::enable_if_t<detail::isInteger<T>>> {
+    static constexpr std::string_view typeName
+        = std::is_signed_v<T> ? "integer" : "non-negative integer";
+
+    static std::optional<T> parse(std::string_view str)
+    {
+        return detail::parseNumber<T>(str);
+    }
 };
 
-template <>
-struct Value<double> {
+template <typename T>
+struct Value<T, std::enable_if_t<std::is_floating_point_v<T>>> {
     static constexpr std::string_view typeName = "real number";
 
-    static std::optional<double> parse(std::string_view str)
+    static std::optional<T> parse(std::string_view str)
     {
-        double val;
-        const auto res = std::from_chars(str.data(), str.data() + str.size(), val);
-        if (res.ec != std::errc() || res.ptr < str.data() + str.size()) {
+        return detail::parseNumber<T>(str);
+    }
+};
+
+// A number of bytes. In a value it may have a suffix (case-insensitive): "B", "K", "M", "G", "T",
+// "P" or "E" are powers of 1024 ("KiB", "MiB" etc. too) and "KB", "MB" etc. powers of 1000.
+// The number may have a fractional part (e.g. "1.5G"), as long as the result is whole bytes.
+struct ByteSize {
+    uint64_t bytes = 0;
+
+    constexpr bool operator==(const ByteSize& other) const
+    {
+        return bytes == other.bytes;
+    }
+
+    constexpr bool operator!=(const ByteSize& other) const
+    {
+        return bytes != other.bytes;
+    }
+};
+
+template <>
+struct Value<ByteSize> {
+    static constexpr std::string_view typeName = "size";
+
+    static std::optional<ByteSize> parse(std::string_view str)
+    {
+        bool integral = false;
+        uint64_t integer = 0;
+        const auto num = detail::parseLeadingNumber(str, integral, integer);
+        if (!num) {
             return std::nullopt;
         }
-        return val;
+
+        uint64_t factor = 1;
+        if (!str.empty() && !detail::equalsIgnoreCase(str, "b")) {
+            static constexpr std::string_view units = "kmgtpe";
+            const auto lower = str[0] >= 'A' && str[0] <= 'Z' ? str[0] + 'a' - 'A' : str[0];
+            const auto unit = units.find(static_cast<char>(lower));
+            const auto rest = str.substr(1);
+            if (unit == std::string_view::npos) {
+                return std::nullopt;
+            }
+            uint64_t base = 0;
+            if (rest.empty() || detail::equalsIgnoreCase(rest, "ib")) {
+                base = 1024;
+            } else if (detail::equalsIgnoreCase(rest, "b")) {
+                base = 1000;
+            } else {
+                return std::nullopt;
+            }
+            for (size_t i = 0; i <= unit; ++i) {
+                factor *= base;
+            }
+        }
+
+        if (integral) {
+            if (integer > std::numeric_limits<uint64_t>::max() / factor) {
+                return std::nullopt;
+            }
+            return ByteSize { integer * factor };
+        }
+        // 2^64 is exact as a double, so anything below it fits
+        const auto bytes = *num * static_cast<double>(factor);
+        if (!(bytes < 18446744073709551616.0) || bytes != static_cast<double>(
+                static_cast<uint64_t>(bytes))) {
+            return std::nullopt;
+        }
+        return ByteSize { static_cast<uint64_t>(bytes) };
+    }
+};
+
+// A sequence of numbers with units, like "250ms" or "1h30m". The units are "ns", "us", "ms", "s",
+// "m" or "min", "h" and "d". The numbers may have a fractional part, but for durations with an
+// integral representation the result must be a whole number of ticks (so "1500ms" is not valid
+// for std::chrono::seconds, but "1.5s" is valid for std::chrono::milliseconds).
+template <typename Rep, typename Period>
+struct Value<std::chrono::duration<Rep, Period>> {
+    using Duration = std::chrono::duration<Rep, Period>;
+    static constexpr std::string_view typeName = "duration";
+
+    static std::optional<Duration> parse(std::string_view str)
+    {
+        const bool negative = std::is_signed_v<Rep> && !str.empty() && str[0] == '-';
+        if (negative) {
+            str.remove_prefix(1);
+        }
+        if (str.empty()) {
+            return std::nullopt;
+        }
+
+        // Everything is added up in ticks of the result
+        using Ticks = std::chrono::duration<long double, Period>;
+        Ticks total { 0 };
+        while (!str.empty()) {
+            bool integral = false;
+            uint64_t integer = 0;
+            const auto num = detail::parseLeadingNumber(str, integral, integer);
+            if (!num) {
+                return std::nullopt;
+            }
+            size_t unitSize = 0;
+            while (unitSize < str.size() && (str[unitSize] < '0' || str[unitSize] > '9')
+                && str[unitSize] != '.') {
+                unitSize++;
+            }
+            const auto unit = str.substr(0, unitSize);
+            str.remove_prefix(unitSize);
+
+            const long double value = integral ? static_cast<long double>(integer) : *num;
+            using namespace std::chrono;
+            if (unit == "ns") {
+                total += duration<long double, std::nano>(value);
+            } else if (unit == "us") {
+                total += duration<long double, std::micro>(value);
+            } else if (unit == "ms") {
+                total += duration<long double, std::milli>(value);
+            } else if (unit == "s") {
+                total += duration<long double>(value);
+            } else if (unit == "m" || unit == "min") {
+                total += duration<long double, std::ratio<60>>(value);
+            } else if (unit == "h") {
+                total += duration<long double, std::ratio<3600>>(value);
+            } else if (unit == "d") {
+                total += duration<long double, std::ratio<86400>>(value);
+            } else {
+                return std::nullopt;
+            }
+        }
+
+        auto ticks = total.count();
+        if (negative) {
+            ticks = -ticks;
+        }
+        if constexpr (std::is_integral_v<Rep>) {
+            // Sums of fractions like "0.1s" are not exact, so a tiny error is fine
+            const auto rounded = std::round(ticks);
+            if (std::abs(ticks - rounded) > 1e-9L * std::max(1.0L, std::abs(ticks))
+                || rounded < static_cast<long double>(std::numeric_limits<Rep>::min())
+                || rounded > static_cast<long double>(std::numeric_limits<Rep>::max())) {
+                return std::nullopt;
+            }
+            return Duration(static_cast<Rep>(rounded));
+        } else {
+            return Duration(static_cast<Rep>(ticks));
+        }
     }
 };
 
@@ -74,1083 +342,5759 @@ struct StdOutErr : public OutputBase {
     }
 };
 
-namespace detail {
-    template <typename... Args>
-    std::string concat(Args&&... args)
+// A non-owning view of an argument list. It can be created from the common representations of
+// argument lists without copying any of the arguments, so they need to outlive the view.
+class ArgvView {
+public:
+    ArgvView(const std::vector<std::string>& argv)
+        : ArgvView(argv.data(), argv.size())
     {
-        std::stringstream ss;
-        (ss << ... << args);
-        return ss.str();
     }
 
-    template <typename... Args>
-    void debug([[maybe_unused]] Args&&... args)
+    ArgvView(const std::vector<std::string_view>& argv)
+        : ArgvView(argv.data(), argv.size())
     {
-#ifdef CLIPP_DEBUG
-        std::puts(concat(std::forward<Args>(args)...).c_str());
-#endif
     }
 
-    // For all intents and purposes this value is infinity
-    constexpr size_t infinity = std::numeric_limits<size_t>::max();
-
-    class ArgBase {
-    public:
-        ArgBase(std::string name, std::string_view typeName)
-            : name_(std::move(name))
-            , typeName_(std::move(typeName))
-        {
-        }
+    ArgvView(const std::string* argv, size_t size)
+        : data_(argv)
+        , size_(size)
+        , kind_(Kind::String)
+    {
+    }
 
-        virtual ~ArgBase()
-        {
-        }
+    ArgvView(const std::string_view* argv, size_t size)
+        : data_(argv)
+        , size_(size)
+        , kind_(Kind::StringView)
+    {
+    }
 
-        const std::string& name() const
-        {
-            return name_;
-        }
+    ArgvView(const char* const* argv, size_t size)
+        : data_(argv)
+        , size_(size)
+        , kind_(Kind::CString)
+    {
+    }
 
-        const std::string& help() const
-        {
-            return help_;
-        }
+    size_t size() const
+    {
+        return size_;
+    }
 
-        std::string_view typeName() const
-        {
-            return typeName_;
-        }
+    bool empty() const
+    {
+        return size_ == 0;
+    }
 
-        const std::vector<std::string>& choices() const
-        {
-            return choices_;
+    // The arguments starting at offset
+    ArgvView subview(size_t offset) const
+    {
+        assert(offset <= size_);
+        auto view = *this;
+        switch (kind_) {
+        case Kind::String:
+            view.data_ = static_cast<const std::string*>(data_) + offset;
+            break;
+        case Kind::StringView:
+            view.data_ = static_cast<const std::string_view*>(data_) + offset;
+            break;
+        case Kind::CString:
+            view.data_ = static_cast<const char* const*>(data_) + offset;
+            break;
         }
+        view.size_ = size_ - offset;
+        return view;
+    }
 
-        bool halt() const
-        {
-            return halt_;
+    std::string_view operator[](size_t idx) const
+    {
+        assert(idx < size_);
+        switch (kind_) {
+        case Kind::String:
+            return static_cast<const std::string*>(data_)[idx];
+        case Kind::StringView:
+            return static_cast<const std::string_view*>(data_)[idx];
+        case Kind::CString:
+            return static_cast<const char* const*>(data_)[idx];
         }
+        return {};
+    }
 
-        virtual bool parse(std::string_view) = 0;
+private:
+    enum class Kind { String, StringView, CString };
 
-    protected:
-        std::string name_;
-        std::string_view typeName_;
-        std::string help_;
-        std::vector<std::string> choices_;
-        bool halt_ = false;
-    };
+    const void* data_;
+    size_t size_;
+    Kind kind_;
+};
 
-    class FlagBase : public ArgBase {
-    public:
-        FlagBase(std::string name, std::string_view typeName, char shortOpt)
-            : ArgBase(std::move(name), typeName)
-            , shortOpt_(shortOpt)
-        {
-        }
+// A vector with a fixed capacity and inline storage, which can be used instead of std::vector
+// as the target of flags and positionals, if parsing must not allocate. Values beyond the
+// capacity are an error (Error::Code::TooManyValues). T must be default constructible and
+// clear() keeps the elements alive, so std::string elements keep their buffers too.
+template <typename T, size_t N>
+class InplaceVector {
+public:
+    using value_type = T;
 
-        char shortOpt() const
-        {
-            return shortOpt_;
-        }
+    InplaceVector() = default;
 
-        size_t num() const
-        {
-            return num_;
+    InplaceVector(std::initializer_list<T> values)
+    {
+        assert(values.size() <= N);
+        for (const auto& value : values) {
+            push_back(value);
         }
+    }
 
-        bool collect() const
-        {
-            return collect_;
-        }
+    void push_back(T value)
+    {
+        assert(size_ < N);
+        data_[size_++] = std::move(value);
+    }
 
-        const std::vector<std::string>& valueNames() const
-        {
-            return valueNames_;
-        }
+    // The capacity is always N, this only exists, so it can be used like std::vector
+    void reserve(size_t) { }
 
-        virtual void reset()
-        {
-        }
+    void clear()
+    {
+        size_ = 0;
+    }
 
-    protected:
-        char shortOpt_;
-        size_t num_ = 0;
-        bool collect_ = false;
-        std::vector<std::string> valueNames_;
-    };
+    size_t size() const
+    {
+        return size_;
+    }
 
-    class PositionalBase : public ArgBase {
-    public:
-        PositionalBase(std::string name, std::string_view typeName)
-            : ArgBase(std::move(name), typeName)
-        {
-        }
+    bool empty() const
+    {
+        return size_ == 0;
+    }
 
-        bool optional() const
-        {
-            return optional_;
-        }
+    static constexpr size_t max_size()
+    {
+        return N;
+    }
 
-        bool many() const
-        {
-            return many_;
-        }
+    static constexpr size_t capacity()
+    {
+        return N;
+    }
 
-        size_t size() const
-        {
-            return size_;
-        }
+    T& operator[](size_t idx)
+    {
+        assert(idx < size_);
+        return data_[idx];
+    }
 
-    protected:
-        bool optional_ = false;
-        bool many_ = false;
-        size_t size_ = 0;
-    };
+    const T& operator[](size_t idx) const
+    {
+        assert(idx < size_);
+        return data_[idx];
+    }
 
-    template <typename Derived>
-    struct FlagBuilderMixin : public FlagBase {
-        FlagBuilderMixin(std::string name, std::string_view typeName, char shortOpt)
-            : FlagBase(std::move(name), typeName, shortOpt)
-        {
-        }
+    T* data()
+    {
+        return data_.data();
+    }
 
-        // Take a list of strings, because with custom types, we might not be able to
-        // give a nice error message or conversion might be lossy somehow.
-        Derived& choices(std::vector<std::string> c)
-        {
-            choices_ = std::move(c);
-            return derived();
-        }
+    const T* data() const
+    {
+        return data_.data();
+    }
 
-        Derived& help(std::string help)
-        {
-            help_ = std::move(help);
-            return derived();
-        }
+    T* begin()
+    {
+        return data_.data();
+    }
 
-        Derived& halt(bool halt = true)
-        {
-            halt_ = halt;
-            return derived();
-        }
+    const T* begin() const
+    {
+        return data_.data();
+    }
 
-        template <typename... Names>
-        Derived& valueNames(Names&&... names)
-        {
-            assert(num_ != 0);
-            assert(sizeof...(Names) == 1 || sizeof...(Names) == num_);
-            valueNames_ = std::vector<std::string> { static_cast<std::string>(
-                std::forward<Names>(names))... };
-            return derived();
+    T* end()
+    {
+        return data_.data() + size_;
+    }
+
+    const T* end() const
+    {
+        return data_.data() + size_;
+    }
+
+    bool operator==(const InplaceVector& other) const
+    {
+        return std::equal(begin(), end(), other.begin(), other.end());
+    }
+
+    bool operator!=(const InplaceVector& other) const
+    {
+        return !(*this == other);
+    }
+
+private:
+    std::array<T, N> data_ {};
+    size_t size_ = 0;
+};
+
+// What parsing spends its time on, as reported to an ObserverBase if CLIPP_INSTRUMENT is defined
+enum class Phase : uint8_t {
+    Schema, // Calling args() and building the lookup tables, only once per Args type
+    Tokenize, // Expanding response files and classifying the arguments
+    Match, // Assigning the arguments to flags and positionals and converting the values
+    Layers, // Reading the config file and taking flags from it and the environment
+    Convert, // Converting the values at the end (see Parser::deferConversion)
+    Validate, // Checking for missing arguments
+    Format, // Formatting help, usage and error messages
+};
+
+#ifdef CLIPP_INSTRUMENT
+// Gets told about every phase of parsing and every Value<T>::parse call (see Parser::observer).
+// The phases of a subcommand happen during the Match phase of its parent. With
+// conversionThreads > 1 or a CompiledParser, conversion() may be called from many threads.
+class ObserverBase {
+public:
+    struct Conversion {
+        const detail::ArgBase* arg;
+        std::string_view value;
+        // Value<T>::typeName and an address that is unique for every T
+        std::string_view typeName;
+        const void* type;
+        std::chrono::nanoseconds duration;
+        bool success;
+    };
+
+    virtual ~ObserverBase() = default;
+
+    // This is a good place to sample an allocation counter
+    virtual void begin(Phase) { }
+    virtual void end(Phase, std::chrono::nanoseconds) { }
+    virtual void conversion(const Conversion&) { }
+};
+
+// An observer that adds everything up. Pass a function returning the number of allocations so
+// far (e.g. a counter incremented by a replaced operator new) to count them for every phase.
+// Only conversions may run on multiple threads, not whole parses (e.g. CompiledParser::parseLines).
+class ParseStats : public ObserverBase {
+public:
+    struct PhaseStats {
+        size_t count = 0;
+        std::chrono::nanoseconds duration { 0 };
+        size_t allocations = 0;
+    };
+
+    struct TypeStats {
+        std::string_view typeName;
+        size_t calls = 0;
+        size_t failures = 0;
+        std::chrono::nanoseconds duration { 0 };
+    };
+
+    explicit ParseStats(size_t (*allocationCount)() = nullptr)
+        : allocationCount_(allocationCount)
+    {
+    }
+
+    // Nested phases of subcommands are only counted once, as part of the outermost one
+    void begin(Phase phase) override
+    {
+        auto& state = phases_[static_cast<size_t>(phase)];
+        if (state.depth++ == 0 && allocationCount_) {
+            state.allocationsBefore = allocationCount_();
         }
+    }
 
-    private:
-        Derived& derived()
-        {
-            return *static_cast<Derived*>(this);
+    void end(Phase phase, std::chrono::nanoseconds duration) override
+    {
+        auto& state = phases_[static_cast<size_t>(phase)];
+        if (--state.depth > 0) {
+            return;
+        }
+        state.stats.count++;
+        state.stats.duration += duration;
+        if (allocationCount_) {
+            state.stats.allocations += allocationCount_() - state.allocationsBefore;
+        }
+    }
+
+    void conversion(const Conversion& conv) override
+    {
+        std::lock_guard lock(mutex_);
+        auto& stats = types_[conv.type];
+        stats.typeName = conv.typeName;
+        stats.calls++;
+        stats.failures += conv.success ? 0 : 1;
+        stats.duration += conv.duration;
+    }
+
+    const PhaseStats& phase(Phase phase) const
+    {
+        return phases_[static_cast<size_t>(phase)].stats;
+    }
+
+    // One entry for every type that was converted, the most expensive first
+    std::vector<TypeStats> types() const
+    {
+        std::lock_guard lock(mutex_);
+        std::vector<TypeStats> ret;
+        for (const auto& [type, stats] : types_) {
+            ret.push_back(stats);
+        }
+        std::sort(ret.begin(), ret.end(),
+            [](const TypeStats& a, const TypeStats& b) { return a.duration > b.duration; });
+        return ret;
+    }
+
+    // A line for every phase and every type, e.g. "tokenize: 3x 2100ns 0 allocations"
+    std::string summary() const
+    {
+        static constexpr std::string_view names[] = { "schema", "tokenize", "match", "layers",
+            "convert", "validate", "format" };
+        std::string ret;
+        for (size_t i = 0; i < std::size(phases_); ++i) {
+            const auto& stats = phases_[i].stats;
+            ret.append(names[i]);
+            ret.append(": " + std::to_string(stats.count) + "x "
+                + std::to_string(stats.duration.count()) + "ns");
+            if (allocationCount_) {
+                ret.append(" " + std::to_string(stats.allocations) + " allocations");
+            }
+            ret.append("\n");
         }
+        for (const auto& stats : types()) {
+            ret.append("'");
+            ret.append(stats.typeName);
+            ret.append("': " + std::to_string(stats.calls) + " calls "
+                + std::to_string(stats.failures) + " failed "
+                + std::to_string(stats.duration.count()) + "ns\n");
+        }
+        return ret;
+    }
+
+private:
+    struct PhaseState {
+        PhaseStats stats;
+        size_t depth = 0;
+        size_t allocationsBefore = 0;
     };
 
-    template <typename Derived>
-    struct PositionalBuilderMixin : public PositionalBase {
-        PositionalBuilderMixin(std::string name, std::string_view typeName)
-            : PositionalBase(std::move(name), typeName)
+    size_t (*allocationCount_)();
+    PhaseState phases_[static_cast<size_t>(Phase::Format) + 1];
+    mutable std::mutex mutex_;
+    std::unordered_map<const void*, TypeStats> types_;
+};
+#endif
+
+namespace detail {
+    // Every type gets its own address, which is used to look up cached schemas without RTTI
+    template <typename T>
+    inline constexpr char typeKey = 0;
+
+    template <typename T, typename = void>
+    struct HasValidate : std::false_type { };
+
+    template <typename T>
+    struct HasValidate<T, std::void_t<decltype(Value<T>::validate(std::string_view()))>>
+        : std::true_type { };
+
+#ifdef CLIPP_DEBUG
+    template <typename... Args>
+    std::string concat(Args&&... args)
+    {
+        std::stringstream ss;
+        (ss << ... << args);
+        return ss.str();
+    }
+#endif
+
+    template <typename... Args>
+    void debug([[maybe_unused]] Args&&... args)
+    {
+#ifdef CLIPP_DEBUG
+        std::puts(concat(std::forward<Args>(args)...).c_str());
+#endif
+    }
+
+#ifdef CLIPP_INSTRUMENT
+    // The observer of the parse running on this thread, so conversions can report to it
+    inline thread_local ObserverBase* currentObserver = nullptr;
+#endif
+
+    // Makes an observer the current one until the end of the scope.
+    // Without CLIPP_INSTRUMENT this does nothing.
+    class ObserverScope {
+    public:
+#ifdef CLIPP_INSTRUMENT
+        explicit ObserverScope(ObserverBase* observer)
+            : previous_(currentObserver)
         {
+            currentObserver = observer;
         }
 
-        Derived& optional(bool optional = true)
+        ~ObserverScope()
         {
-            optional_ = optional;
-            return derived();
+            currentObserver = previous_;
         }
+#else
+        ObserverScope() = default;
+#endif
+
+        ObserverScope(const ObserverScope&) = delete;
+        ObserverScope& operator=(const ObserverScope&) = delete;
 
-        Derived& choices(std::vector<std::string> c)
+#ifdef CLIPP_INSTRUMENT
+    private:
+        ObserverBase* previous_;
+#endif
+    };
+
+    // Reports the duration of a phase to the current observer when it ends or goes out of scope.
+    // Without CLIPP_INSTRUMENT this does nothing.
+    class PhaseScope {
+    public:
+        explicit PhaseScope([[maybe_unused]] Phase phase)
+#ifdef CLIPP_INSTRUMENT
+            : observer_(currentObserver)
+            , phase_(phase)
         {
-            choices_ = std::move(c);
-            return derived();
+            if (observer_) {
+                observer_->begin(phase_);
+                start_ = std::chrono::steady_clock::now();
+            }
         }
-
-        Derived& help(std::string help)
+#else
         {
-            help_ = std::move(help);
-            return derived();
         }
+#endif
 
-        Derived& halt(bool halt = true)
+        PhaseScope(const PhaseScope&) = delete;
+        PhaseScope& operator=(const PhaseScope&) = delete;
+
+        ~PhaseScope()
         {
-            halt_ = halt;
-            return derived();
+            end();
         }
 
-    private:
-        Derived& derived()
+        void end()
         {
-            return *static_cast<Derived*>(this);
+#ifdef CLIPP_INSTRUMENT
+            if (observer_) {
+                observer_->end(phase_, std::chrono::steady_clock::now() - start_);
+                observer_ = nullptr;
+            }
+#endif
         }
+
+#ifdef CLIPP_INSTRUMENT
+    private:
+        ObserverBase* observer_;
+        Phase phase_;
+        std::chrono::steady_clock::time_point start_ {};
+#endif
     };
 
-    template <typename T>
-    class Flag;
+    // For all intents and purposes this value is infinity
+    constexpr size_t infinity = std::numeric_limits<size_t>::max();
 
-    // A simple flag like. "--foo" => v = true
-    template <>
-    class Flag<bool> : public FlagBuilderMixin<Flag<bool>> {
+    template <typename T>
+    class Span {
     public:
-        Flag(bool& value, std::string name, char shortOpt)
-            : FlagBuilderMixin(std::move(name), "", shortOpt)
-            , value_(value)
+        Span() = default;
+
+        Span(const T* data, size_t size)
+            : data_(data)
+            , size_(size)
         {
-            value_ = false;
         }
 
-        bool parse([[maybe_unused]] std::string_view str) override
+        const T* begin() const
         {
-            assert(str.empty());
-            value_ = true;
-            return true;
+            return data_;
         }
 
-    private:
-        bool& value_;
-    };
+        const T* end() const
+        {
+            return data_ + size_;
+        }
 
-    // Counts flags. "-vvvv" => v = 4
-    template <>
-    class Flag<size_t> : public FlagBuilderMixin<Flag<size_t>> {
-    public:
-        Flag(size_t& value, std::string name, char shortOpt)
-            : FlagBuilderMixin(std::move(name), "", shortOpt)
-            , value_(value)
+        size_t size() const
         {
-            value_ = 0;
+            return size_;
         }
 
-        bool parse([[maybe_unused]] std::string_view str) override
+        bool empty() const
         {
-            assert(str.empty());
-            value_++;
-            return true;
+            return size_ == 0;
+        }
+
+        const T& operator[](size_t idx) const
+        {
+            assert(idx < size_);
+            return data_[idx];
+        }
+
+        const T* data() const
+        {
+            return data_;
         }
 
     private:
-        size_t& value_;
+        const T* data_ = nullptr;
+        size_t size_ = 0;
     };
 
-    // An optional flag. "--foo cool" => v = cool
-    template <typename T>
-    class Flag<std::optional<T>> : public FlagBuilderMixin<Flag<std::optional<T>>> {
+    // A monotonic allocator for the descriptors of a schema and all their strings. This way a
+    // schema consists of a few large blocks instead of hundreds of small allocations.
+    // Nothing is freed until the arena is destroyed.
+    class Arena {
     public:
-        Flag(std::optional<T>& value, std::string name, char shortOpt)
-            : FlagBuilderMixin<Flag<std::optional<T>>>(
-                std::move(name), Value<T>::typeName, shortOpt)
-            , value_(value)
+        Arena() = default;
+
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        ~Arena()
         {
-            this->num_ = 1;
+            // Objects are destroyed in reverse order of creation
+            for (auto dtor = destructors_; dtor; dtor = dtor->next) {
+                dtor->destroy(dtor->object);
+            }
+            while (blocks_) {
+                const auto next = blocks_->next;
+                ::operator delete(blocks_);
+                blocks_ = next;
+            }
         }
 
-        bool parse(std::string_view str) override
+        void* allocate(size_t size, size_t align)
         {
-            const auto res = Value<T>::parse(str);
-            if (!res) {
-                return false;
+            auto ptr = alignUp(cursor_, align);
+            if (!blocks_ || ptr + size > end_) {
+                addBlock(size + align);
+                ptr = alignUp(cursor_, align);
             }
-            value_ = res.value();
-            return true;
+            cursor_ = ptr + size;
+            return reinterpret_cast<void*>(ptr);
         }
 
-    private:
-        std::optional<T>& value_;
-    };
-
-    template <typename T>
-    class Flag<std::vector<T>> : public FlagBuilderMixin<Flag<std::vector<T>>> {
-    public:
-        Flag(std::vector<T>& values, std::string name, char shortOpt)
-            : FlagBuilderMixin<Flag<std::vector<T>>>(std::move(name), Value<T>::typeName, shortOpt)
-            , values_(values)
+        template <typename T, typename... Args>
+        T* create(Args&&... args)
         {
-            this->num_ = 1;
-            this->collect_ = true;
+            auto obj = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+            addDestructor(obj);
+            return obj;
         }
 
-        auto& num(size_t num)
+        // Copies the objects into a contiguous array, which is destroyed with the arena
+        template <typename T, typename Container>
+        Span<T> copyObjects(const Container& objs)
         {
-            this->num_ = num;
-            this->collect_ = false;
-            return *this;
+            if (std::size(objs) == 0) {
+                return {};
+            }
+            auto data = static_cast<T*>(allocate(sizeof(T) * std::size(objs), alignof(T)));
+            size_t i = 0;
+            for (const auto& obj : objs) {
+                addDestructor(new (data + i++) T(obj));
+            }
+            return Span<T>(data, std::size(objs));
         }
 
-        auto& collect(bool collect = true)
+        std::string_view copy(std::string_view str)
         {
-            this->collect_ = collect;
-            return *this;
+            if (str.empty()) {
+                return {};
+            }
+            auto data = static_cast<char*>(allocate(str.size(), 1));
+            std::memcpy(data, str.data(), str.size());
+            return std::string_view(data, str.size());
         }
 
-        void reset() override
+        // Like copy, but followed by a '\0', so it can be passed to C functions
+        std::string_view copyTerminated(std::string_view str)
         {
-            debug("reset");
-            values_.clear();
+            if (str.empty()) {
+                return {};
+            }
+            auto data = static_cast<char*>(allocate(str.size() + 1, 1));
+            std::memcpy(data, str.data(), str.size());
+            data[str.size()] = '\0';
+            return std::string_view(data, str.size());
         }
 
-        bool parse(std::string_view str) override
+        template <typename Container>
+        Span<std::string_view> copyStrings(const Container& strs)
         {
-            debug("parse ", str);
-            const auto res = Value<T>::parse(str);
-            if (!res) {
-                return false;
+            if (std::size(strs) == 0) {
+                return {};
             }
-            values_.push_back(res.value());
-            debug("size after: ", values_.size());
-            return true;
+            auto data = static_cast<std::string_view*>(
+                allocate(sizeof(std::string_view) * std::size(strs), alignof(std::string_view)));
+            size_t i = 0;
+            for (const auto& str : strs) {
+                new (data + i++) std::string_view(copy(str));
+            }
+            return Span<std::string_view>(data, std::size(strs));
         }
 
     private:
-        std::vector<T>& values_;
-    };
+        struct Block {
+            Block* next;
+        };
 
-    template <typename T>
-    class Positional : public PositionalBuilderMixin<Positional<T>> {
-    public:
-        Positional(T& value, std::string name)
-            : PositionalBuilderMixin<Positional<T>>(std::move(name), Value<T>::typeName)
-            , value_(value)
+        struct Destructor {
+            void (*destroy)(void*);
+            void* object;
+            Destructor* next;
+        };
+
+        template <typename T>
+        void addDestructor(T* obj)
         {
+            if constexpr (!std::is_trivially_destructible_v<T>) {
+                auto dtor = new (allocate(sizeof(Destructor), alignof(Destructor)))
+                    Destructor { [](void* p) { static_cast<T*>(p)->~T(); }, obj, destructors_ };
+                destructors_ = dtor;
+            }
         }
 
-        bool parse(std::string_view str) override
+        static std::uintptr_t alignUp(std::uintptr_t ptr, size_t align)
         {
-            const auto res = Value<T>::parse(str);
-            if (!res) {
-                return false;
-            }
-            value_ = res.value();
-            this->size_++;
-            return true;
+            return (ptr + align - 1) & ~static_cast<std::uintptr_t>(align - 1);
         }
 
-    private:
-        T& value_;
+        void addBlock(size_t minSize)
+        {
+            blockSize_ = std::max(blockSize_ * 2, minSize + sizeof(Block));
+            auto block = static_cast<Block*>(::operator new(blockSize_));
+            block->next = blocks_;
+            blocks_ = block;
+            cursor_ = reinterpret_cast<std::uintptr_t>(block) + sizeof(Block);
+            end_ = reinterpret_cast<std::uintptr_t>(block) + blockSize_;
+        }
+
+        Block* blocks_ = nullptr;
+        Destructor* destructors_ = nullptr;
+        std::uintptr_t cursor_ = 0;
+        std::uintptr_t end_ = 0;
+        // The first block is 4KiB, which is enough for most schemas
+        size_t blockSize_ = 2048;
     };
 
-    template <typename T>
-    class Positional<std::optional<T>>
-        : public PositionalBuilderMixin<Positional<std::optional<T>>> {
+    // An open addressing hash table for the choices of an argument, so a value can be matched
+    // with a single lookup instead of comparing it to every choice.
+    class ChoiceIndex {
     public:
-        Positional(std::optional<T>& value, std::string name)
-            : PositionalBuilderMixin<Positional<std::optional<T>>>(
-                std::move(name), Value<T>::typeName)
-            , value_(value)
+        static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+        ChoiceIndex() = default;
+
+        ChoiceIndex(Arena& arena, Span<std::string_view> choices)
+            : choices_(choices)
         {
-            this->optional();
+            size_t numSlots = 16;
+            while (numSlots < choices.size() * 2) {
+                numSlots *= 2;
+            }
+            // Slots contain the index of the choice + 1, so 0 is empty
+            slots_ = static_cast<uint32_t*>(
+                arena.allocate(sizeof(uint32_t) * numSlots, alignof(uint32_t)));
+            std::memset(slots_, 0, sizeof(uint32_t) * numSlots);
+            mask_ = numSlots - 1;
+
+            for (size_t c = 0; c < choices.size(); ++c) {
+                for (size_t i = hash(choices[c]);; ++i) {
+                    auto& slot = slots_[i & mask_];
+                    if (slot == 0) {
+                        slot = static_cast<uint32_t>(c + 1);
+                        break;
+                    }
+                    // Duplicates resolve to the first one
+                    if (choices_[slot - 1] == choices[c]) {
+                        break;
+                    }
+                }
+            }
         }
 
-        bool parse(std::string_view str) override
+        // Returns the index of the choice or npos
+        size_t find(std::string_view str) const
         {
-            const auto res = Value<T>::parse(str);
-            if (!res) {
-                return false;
+            if (!slots_) {
+                return npos;
+            }
+            for (size_t i = hash(str);; ++i) {
+                const auto slot = slots_[i & mask_];
+                if (slot == 0) {
+                    return npos;
+                }
+                if (choices_[slot - 1] == str) {
+                    return slot - 1;
+                }
             }
-            value_ = res.value();
-            this->size_++;
-            return true;
         }
 
     private:
-        std::optional<T>& value_;
+        static size_t hash(std::string_view str)
+        {
+            return std::hash<std::string_view> {}(str);
+        }
+
+        Span<std::string_view> choices_;
+        uint32_t* slots_ = nullptr;
+        size_t mask_ = 0;
     };
 
+    // The descriptors of the arguments don't keep references to the variables they write to,
+    // but their offset relative to the ArgsBase they were registered on. This way a schema can
+    // be shared between multiple instances of the same Args struct (and they can be moved).
+    // Variables that are not part of the Args struct (e.g. globals) are bound by pointer.
     template <typename T>
-    class Positional<std::vector<T>> : public PositionalBuilderMixin<Positional<std::vector<T>>> {
+    class Binding {
     public:
-        Positional(std::vector<T>& values, std::string name)
-            : PositionalBuilderMixin<Positional<std::vector<T>>>(
-                std::move(name), Value<T>::typeName)
-            , values_(values)
+        Binding(T& value, const ArgsBase& args, bool member)
         {
-            this->many_ = true;
+            if (member) {
+                offset_ = reinterpret_cast<const char*>(&value)
+                    - reinterpret_cast<const char*>(&args);
+            } else {
+                pointer_ = &value;
+            }
         }
 
-        bool parse(std::string_view str) override
+        T& get(ArgsBase& args) const
         {
-            const auto res = Value<T>::parse(str);
-            if (!res) {
-                return false;
+            if (pointer_) {
+                return *pointer_;
             }
-            values_.push_back(res.value());
-            this->size_++;
-            return true;
+            return *reinterpret_cast<T*>(reinterpret_cast<char*>(&args) + offset_);
         }
 
     private:
-        std::vector<T>& values_;
+        T* pointer_ = nullptr;
+        std::ptrdiff_t offset_ = 0;
     };
 
-    inline char toUpperCase(char ch)
+    constexpr size_t parallelChunkSize = 16;
+
+    // The number of threads parallelForWorkers actually uses
+    inline size_t numWorkers(size_t count, size_t numThreads)
     {
-        if (ch >= 'a' && ch <= 'z') {
-            assert('a' > 'A');
-            return ch - ('a' - 'A');
-        }
-        return ch;
+        return std::max<size_t>(
+            1, std::min(numThreads, (count + parallelChunkSize - 1) / parallelChunkSize));
     }
 
-    inline std::string toUpperCase(std::string_view str)
+    // Calls func(worker, begin, end) for consecutive ranges of all indices < count from up to
+    // numThreads threads (including this one). The ranges are small and handed out one after
+    // another, so slow ones don't hold up the other threads. worker is the index of the calling
+    // thread (< numWorkers(count, numThreads)), so every thread can reuse its own state.
+    template <typename Func>
+    void parallelForWorkers(size_t count, size_t numThreads, Func&& func)
     {
-        std::string upper;
-        for (const auto ch : str) {
-            upper.push_back(toUpperCase(ch));
+        std::atomic<size_t> next { 0 };
+        auto work = [&](size_t worker) {
+            for (size_t begin = next.fetch_add(parallelChunkSize); begin < count;
+                 begin = next.fetch_add(parallelChunkSize)) {
+                func(worker, begin, std::min(begin + parallelChunkSize, count));
+            }
+        };
+
+        std::vector<std::thread> threads;
+        numThreads = numWorkers(count, numThreads);
+        for (size_t t = 1; t < numThreads; ++t) {
+            threads.emplace_back(work, t);
+        }
+        work(0);
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    // Calls func(begin, end) like parallelForWorkers
+    template <typename Func>
+    void parallelForChunks(size_t count, size_t numThreads, Func&& func)
+    {
+        parallelForWorkers(count, numThreads,
+            [&func](size_t, size_t begin, size_t end) { func(begin, end); });
+    }
+
+    // Calls func(i) for every i < count like parallelForChunks
+    template <typename Func>
+    void parallelFor(size_t count, size_t numThreads, Func&& func)
+    {
+        parallelForChunks(count, numThreads, [&func](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                func(i);
+            }
+        });
+    }
+
+    // All strings of the descriptors live in the arena of the schema they belong to
+    class ArgBase {
+    public:
+        ArgBase(Arena& arena, std::string_view name, std::string_view typeName)
+            : arena_(&arena)
+            , name_(arena.copy(name))
+            , typeName_(typeName)
+        {
+        }
+
+        virtual ~ArgBase()
+        {
+        }
+
+        std::string_view name() const
+        {
+            return name_;
+        }
+
+        std::string_view help() const
+        {
+            return help_;
+        }
+
+        std::string_view typeName() const
+        {
+            return typeName_;
+        }
+
+        Span<std::string_view> choices() const
+        {
+            return choices_;
+        }
+
+        // Returns the index of the choice or ChoiceIndex::npos
+        size_t findChoice(std::string_view str) const
+        {
+            return choiceIndex_.find(str);
+        }
+
+        bool halt() const
+        {
+            return halt_;
+        }
+
+        // If not 0, every value is a list of elements separated by this
+        char delimiter() const
+        {
+            return delimiter_;
+        }
+
+        // All of these are const, so a schema can be used by multiple parses at the same time.
+        // The variables that are written to are always the ones belonging to args.
+        // If choices were given, choice is the index of the one that matched (or npos).
+        virtual bool parse(ArgsBase& args, std::string_view str, size_t choice) const = 0;
+
+        // Sets the variable to the value it should have, if the argument is not given.
+        virtual void init([[maybe_unused]] ArgsBase& args) const
+        {
+        }
+
+        // Remembers the current value of the variable, which is the default one while the schema
+        // is built, so resetToDefault can restore it later.
+        virtual void saveDefault([[maybe_unused]] ArgsBase& args)
+        {
+        }
+
+        // Sets the variable to the value it had when the schema was built (for Parser::parseInto)
+        virtual void resetToDefault(ArgsBase& args) const
+        {
+            init(args);
+        }
+
+        // Like calling parse for every value in order, but arguments that collect their values
+        // convert them using up to numThreads threads. Returns the index of the first value that
+        // could not be converted (the ones before it are assigned) or npos.
+        virtual size_t parseMany(ArgsBase& args, Span<std::string_view> values,
+            Span<size_t> choices, [[maybe_unused]] size_t numThreads) const
+        {
+            for (size_t i = 0; i < values.size(); ++i) {
+                if (!parse(args, values[i], choices[i])) {
+                    return i;
+                }
+            }
+            return npos;
+        }
+
+        using Validate = bool (*)(std::string_view);
+
+        // Value<T>::validate of the value type or nullptr, see Parser::validationThreads
+        Validate validate() const
+        {
+            return validate_;
+        }
+
+        // Called before the elements of a delimited list are parsed, with their number
+        virtual void reserve([[maybe_unused]] ArgsBase& args, [[maybe_unused]] size_t num) const
+        {
+        }
+
+        // Whether an argument that collects values has no room for more (see InplaceVector)
+        virtual bool full([[maybe_unused]] ArgsBase& args) const
+        {
+            return false;
+        }
+
+        // The most values an argument can hold
+        virtual size_t maxSize() const
+        {
+            return npos;
+        }
+
+        static constexpr auto npos = std::numeric_limits<size_t>::max();
+
+    protected:
+        template <typename T>
+        void setValidate()
+        {
+            if constexpr (HasValidate<T>::value) {
+                validate_ = &Value<T>::validate;
+            }
+        }
+
+        void setChoices(Span<std::string_view> choices)
+        {
+            choices_ = choices;
+            choiceIndex_ = ChoiceIndex(*arena_, choices);
+            choiceValues_ = nullptr;
+        }
+
+        template <typename T>
+        void setChoices(std::initializer_list<std::pair<std::string_view, T>> choices)
+        {
+            std::vector<std::string_view> names;
+            std::vector<T> values;
+            for (const auto& [name, value] : choices) {
+                names.push_back(name);
+                values.push_back(value);
+            }
+            setChoices(arena_->copyStrings(names));
+            choiceValues_ = arena_->copyObjects<T>(values).data();
+        }
+
+        // If choices were mapped to values, these are used instead of parsing the string again
+        template <typename T>
+        std::optional<T> convert(std::string_view str, size_t choice) const
+        {
+            if (choiceValues_ && choice != ChoiceIndex::npos) {
+                return static_cast<const T*>(choiceValues_)[choice];
+            }
+#ifdef CLIPP_INSTRUMENT
+            if (const auto observer = currentObserver) {
+                const auto start = std::chrono::steady_clock::now();
+                auto res = Value<T>::parse(str);
+                observer->conversion({ this, str, Value<T>::typeName, &typeKey<T>,
+                    std::chrono::steady_clock::now() - start, res.has_value() });
+                return res;
+            }
+#endif
+            return Value<T>::parse(str);
+        }
+
+        // After the first error, the values after it are not converted anymore, but the ones
+        // before it always are, so the result is the same as if they were converted in order.
+        // Values that don't fit into out anymore count as errors, like ones that can't be converted
+        template <typename C>
+        size_t convertMany(C& out, Span<std::string_view> values, Span<size_t> choices,
+            size_t numThreads) const
+        {
+            using T = typename C::value_type;
+            const auto room = out.max_size() - out.size();
+            if (values.size() > room) {
+                const auto failed = convertMany(
+                    out, Span(values.data(), room), Span(choices.data(), room), numThreads);
+                return failed == npos ? room : failed;
+            }
+
+            std::vector<std::optional<T>> results(values.size());
+            std::atomic<size_t> firstError { npos };
+#ifdef CLIPP_INSTRUMENT
+            const auto observer = currentObserver;
+#endif
+            parallelFor(values.size(), numThreads, [&](size_t i) {
+#ifdef CLIPP_INSTRUMENT
+                ObserverScope scope(observer);
+#endif
+                if (i > firstError.load(std::memory_order_relaxed)) {
+                    return;
+                }
+                results[i] = convert<T>(values[i], choices[i]);
+                if (!results[i]) {
+                    auto current = firstError.load(std::memory_order_relaxed);
+                    while (i < current && !firstError.compare_exchange_weak(current, i)) { }
+                }
+            });
+
+            const auto num = std::min(firstError.load(), values.size());
+            out.reserve(out.size() + num);
+            for (size_t i = 0; i < num; ++i) {
+                out.push_back(std::move(*results[i]));
+            }
+            return firstError;
+        }
+
+        Arena* arena_;
+        std::string_view name_;
+        std::string_view typeName_;
+        std::string_view help_;
+        Span<std::string_view> choices_;
+        ChoiceIndex choiceIndex_;
+        // Points to an array of the value type of the argument with an element for every choice
+        const void* choiceValues_ = nullptr;
+        Validate validate_ = nullptr;
+        bool halt_ = false;
+        char delimiter_ = 0;
+    };
+
+    class FlagBase : public ArgBase {
+    public:
+        FlagBase(Arena& arena, std::string_view name, std::string_view typeName, char shortOpt)
+            : ArgBase(arena, name, typeName)
+            , shortOpt_(shortOpt)
+        {
+        }
+
+        char shortOpt() const
+        {
+            return shortOpt_;
+        }
+
+        size_t num() const
+        {
+            return num_;
+        }
+
+        bool collect() const
+        {
+            return collect_;
+        }
+
+        Span<std::string_view> valueNames() const
+        {
+            return valueNames_;
+        }
+
+        // The position in Schema::flags
+        size_t index() const
+        {
+            return index_;
+        }
+
+        // The environment variable the value is taken from, if the flag is not given
+        std::string_view env() const
+        {
+            return env_;
+        }
+
+        virtual void reset([[maybe_unused]] ArgsBase& args) const
+        {
+        }
+
+    protected:
+        friend class clipp::ArgsBase;
+
+        size_t index_ = 0;
+        char shortOpt_;
+        std::string_view env_;
+        size_t num_ = 0;
+        bool collect_ = false;
+        Span<std::string_view> valueNames_;
+    };
+
+    class PositionalBase : public ArgBase {
+    public:
+        PositionalBase(Arena& arena, std::string_view name, std::string_view typeName)
+            : ArgBase(arena, name, typeName)
+        {
+        }
+
+        bool optional() const
+        {
+            return optional_;
+        }
+
+        bool many() const
+        {
+            return many_;
+        }
+
+    protected:
+        bool optional_ = false;
+        bool many_ = false;
+    };
+
+    template <typename Derived>
+    struct FlagBuilderMixin : public FlagBase {
+        FlagBuilderMixin(
+            Arena& arena, std::string_view name, std::string_view typeName, char shortOpt)
+            : FlagBase(arena, name, typeName, shortOpt)
+        {
+        }
+
+        // Take a list of strings, because with custom types, we might not be able to
+        // give a nice error message or conversion might be lossy somehow.
+        Derived& choices(const std::vector<std::string>& c)
+        {
+            setChoices(arena_->copyStrings(c));
+            return derived();
+        }
+
+        // Maps every choice to a value, which is then assigned without parsing the string
+        template <typename Arg = Derived>
+        Derived& choices(
+            std::initializer_list<std::pair<std::string_view, typename Arg::ValueType>> c)
+        {
+            setChoices(c);
+            return derived();
+        }
+
+        Derived& help(std::string_view help)
+        {
+            help_ = arena_->copy(help);
+            return derived();
+        }
+
+        Derived& halt(bool halt = true)
+        {
+            halt_ = halt;
+            return derived();
+        }
+
+        // If the flag is not given, its value is taken from this environment variable
+        Derived& env(std::string_view name)
+        {
+            // Terminated for getenv
+            env_ = arena_->copyTerminated(name);
+            return derived();
+        }
+
+        template <typename... Names>
+        Derived& valueNames(Names&&... names)
+        {
+            assert(num_ != 0);
+            assert(sizeof...(Names) == 1 || sizeof...(Names) == num_);
+            const std::string_view list[] = { std::string_view(std::forward<Names>(names))... };
+            valueNames_ = arena_->copyStrings(list);
+            return derived();
+        }
+
+    private:
+        Derived& derived()
+        {
+            return *static_cast<Derived*>(this);
+        }
+    };
+
+    template <typename Derived>
+    struct PositionalBuilderMixin : public PositionalBase {
+        PositionalBuilderMixin(Arena& arena, std::string_view name, std::string_view typeName)
+            : PositionalBase(arena, name, typeName)
+        {
+        }
+
+        Derived& optional(bool optional = true)
+        {
+            optional_ = optional;
+            return derived();
+        }
+
+        Derived& choices(const std::vector<std::string>& c)
+        {
+            setChoices(arena_->copyStrings(c));
+            return derived();
+        }
+
+        // Maps every choice to a value, which is then assigned without parsing the string
+        template <typename Arg = Derived>
+        Derived& choices(
+            std::initializer_list<std::pair<std::string_view, typename Arg::ValueType>> c)
+        {
+            setChoices(c);
+            return derived();
+        }
+
+        Derived& help(std::string_view help)
+        {
+            help_ = arena_->copy(help);
+            return derived();
+        }
+
+        Derived& halt(bool halt = true)
+        {
+            halt_ = halt;
+            return derived();
+        }
+
+    private:
+        Derived& derived()
+        {
+            return *static_cast<Derived*>(this);
+        }
+    };
+
+    // std::vector or InplaceVector
+    template <typename T>
+    struct IsVector : std::false_type { };
+
+    template <typename T>
+    struct IsVector<std::vector<T>> : std::true_type { };
+
+    template <typename T, size_t N>
+    struct IsVector<InplaceVector<T, N>> : std::true_type { };
+
+    template <typename T, typename = void>
+    class Flag;
+
+    // A simple flag like. "--foo" => v = true
+    template <>
+    class Flag<bool> : public FlagBuilderMixin<Flag<bool>> {
+    public:
+        Flag(Binding<bool> value, Arena& arena, std::string_view name, char shortOpt)
+            : FlagBuilderMixin(arena, name, "", shortOpt)
+            , value_(value)
+        {
+        }
+
+        void init(ArgsBase& args) const override
+        {
+            value_.get(args) = false;
+        }
+
+        bool parse(ArgsBase& args, [[maybe_unused]] std::string_view str, size_t) const override
+        {
+            assert(str.empty());
+            value_.get(args) = true;
+            return true;
+        }
+
+    private:
+        Binding<bool> value_;
+    };
+
+    // Counts flags. "-vvvv" => v = 4
+    template <>
+    class Flag<size_t> : public FlagBuilderMixin<Flag<size_t>> {
+    public:
+        Flag(Binding<size_t> value, Arena& arena, std::string_view name, char shortOpt)
+            : FlagBuilderMixin(arena, name, "", shortOpt)
+            , value_(value)
+        {
+        }
+
+        void init(ArgsBase& args) const override
+        {
+            value_.get(args) = 0;
+        }
+
+        bool parse(ArgsBase& args, [[maybe_unused]] std::string_view str, size_t) const override
+        {
+            assert(str.empty());
+            value_.get(args)++;
+            return true;
+        }
+
+    private:
+        Binding<size_t> value_;
+    };
+
+    // An optional flag. "--foo cool" => v = cool
+    template <typename T>
+    class Flag<std::optional<T>> : public FlagBuilderMixin<Flag<std::optional<T>>> {
+    public:
+        using ValueType = T;
+
+        Flag(Binding<std::optional<T>> value, Arena& arena, std::string_view name, char shortOpt)
+            : FlagBuilderMixin<Flag<std::optional<T>>>(arena, name, Value<T>::typeName, shortOpt)
+            , value_(value)
+        {
+            this->template setValidate<T>();
+            this->num_ = 1;
+        }
+
+        bool parse(ArgsBase& args, std::string_view str, size_t choice) const override
+        {
+            const auto res = this->template convert<T>(str, choice);
+            if (!res) {
+                return false;
+            }
+            value_.get(args) = res.value();
+            return true;
+        }
+
+        void saveDefault(ArgsBase& args) override
+        {
+            default_ = value_.get(args);
+        }
+
+        void resetToDefault(ArgsBase& args) const override
+        {
+            value_.get(args) = default_;
+        }
+
+    private:
+        Binding<std::optional<T>> value_;
+        std::optional<T> default_;
+    };
+
+    template <typename C>
+    class Flag<C, std::enable_if_t<IsVector<C>::value>> : public FlagBuilderMixin<Flag<C>> {
+    public:
+        using ValueType = typename C::value_type;
+
+        Flag(Binding<C> values, Arena& arena, std::string_view name, char shortOpt)
+            : FlagBuilderMixin<Flag<C>>(arena, name, Value<ValueType>::typeName, shortOpt)
+            , values_(values)
+        {
+            this->template setValidate<ValueType>();
+            this->num_ = 1;
+            this->collect_ = true;
+        }
+
+        auto& num(size_t num)
+        {
+            this->num_ = num;
+            this->collect_ = false;
+            return *this;
+        }
+
+        auto& collect(bool collect = true)
+        {
+            this->collect_ = collect;
+            return *this;
+        }
+
+        // "--ids 1,2,3" => v = { 1, 2, 3 }
+        auto& delimiter(char delimiter)
+        {
+            this->delimiter_ = delimiter;
+            return *this;
+        }
+
+        void reserve(ArgsBase& args, size_t num) const override
+        {
+            auto& values = values_.get(args);
+            values.reserve(values.size() + num);
+        }
+
+        bool full(ArgsBase& args) const override
+        {
+            const auto& values = values_.get(args);
+            return values.size() >= values.max_size();
+        }
+
+        size_t maxSize() const override
+        {
+            return default_.max_size();
+        }
+
+        void reset(ArgsBase& args) const override
+        {
+            debug("reset");
+            values_.get(args).clear();
+        }
+
+        bool parse(ArgsBase& args, std::string_view str, size_t choice) const override
+        {
+            debug("parse ", str);
+            const auto res = this->template convert<ValueType>(str, choice);
+            if (!res) {
+                return false;
+            }
+            auto& values = values_.get(args);
+            values.push_back(res.value());
+            debug("size after: ", values.size());
+            return true;
+        }
+
+        size_t parseMany(ArgsBase& args, Span<std::string_view> values, Span<size_t> choices,
+            size_t numThreads) const override
+        {
+            return this->convertMany(values_.get(args), values, choices, numThreads);
+        }
+
+        void saveDefault(ArgsBase& args) override
+        {
+            default_ = values_.get(args);
+        }
+
+        // Assigning keeps the capacity of the vector
+        void resetToDefault(ArgsBase& args) const override
+        {
+            values_.get(args) = default_;
+        }
+
+    private:
+        Binding<C> values_;
+        C default_;
+    };
+
+    template <typename T, typename = void>
+    class Positional : public PositionalBuilderMixin<Positional<T>> {
+    public:
+        using ValueType = T;
+
+        Positional(Binding<T> value, Arena& arena, std::string_view name)
+            : PositionalBuilderMixin<Positional<T>>(arena, name, Value<T>::typeName)
+            , value_(value)
+        {
+            this->template setValidate<T>();
+        }
+
+        bool parse(ArgsBase& args, std::string_view str, size_t choice) const override
+        {
+            const auto res = this->template convert<T>(str, choice);
+            if (!res) {
+                return false;
+            }
+            value_.get(args) = res.value();
+            return true;
+        }
+
+        void saveDefault(ArgsBase& args) override
+        {
+            default_ = value_.get(args);
+        }
+
+        void resetToDefault(ArgsBase& args) const override
+        {
+            value_.get(args) = *default_;
+        }
+
+    private:
+        Binding<T> value_;
+        // Optional, so T doesn't need to be default constructible
+        std::optional<T> default_;
+    };
+
+    template <typename T>
+    class Positional<std::optional<T>>
+        : public PositionalBuilderMixin<Positional<std::optional<T>>> {
+    public:
+        using ValueType = T;
+
+        Positional(Binding<std::optional<T>> value, Arena& arena, std::string_view name)
+            : PositionalBuilderMixin<Positional<std::optional<T>>>(arena, name, Value<T>::typeName)
+            , value_(value)
+        {
+            this->template setValidate<T>();
+            this->optional();
+        }
+
+        bool parse(ArgsBase& args, std::string_view str, size_t choice) const override
+        {
+            const auto res = this->template convert<T>(str, choice);
+            if (!res) {
+                return false;
+            }
+            value_.get(args) = res.value();
+            return true;
+        }
+
+        void saveDefault(ArgsBase& args) override
+        {
+            default_ = value_.get(args);
+        }
+
+        void resetToDefault(ArgsBase& args) const override
+        {
+            value_.get(args) = default_;
+        }
+
+    private:
+        Binding<std::optional<T>> value_;
+        std::optional<T> default_;
+    };
+
+    template <typename C>
+    class Positional<C, std::enable_if_t<IsVector<C>::value>>
+        : public PositionalBuilderMixin<Positional<C>> {
+    public:
+        using ValueType = typename C::value_type;
+
+        Positional(Binding<C> values, Arena& arena, std::string_view name)
+            : PositionalBuilderMixin<Positional<C>>(arena, name, Value<ValueType>::typeName)
+            , values_(values)
+        {
+            this->template setValidate<ValueType>();
+            this->many_ = true;
+        }
+
+        // "1,2 3" => v = { 1, 2, 3 }
+        auto& delimiter(char delimiter)
+        {
+            this->delimiter_ = delimiter;
+            return *this;
+        }
+
+        void reserve(ArgsBase& args, size_t num) const override
+        {
+            auto& values = values_.get(args);
+            values.reserve(values.size() + num);
+        }
+
+        bool full(ArgsBase& args) const override
+        {
+            const auto& values = values_.get(args);
+            return values.size() >= values.max_size();
+        }
+
+        size_t maxSize() const override
+        {
+            return default_.max_size();
+        }
+
+        bool parse(ArgsBase& args, std::string_view str, size_t choice) const override
+        {
+            const auto res = this->template convert<ValueType>(str, choice);
+            if (!res) {
+                return false;
+            }
+            values_.get(args).push_back(res.value());
+            return true;
+        }
+
+        size_t parseMany(ArgsBase& args, Span<std::string_view> values, Span<size_t> choices,
+            size_t numThreads) const override
+        {
+            return this->convertMany(values_.get(args), values, choices, numThreads);
+        }
+
+        void saveDefault(ArgsBase& args) override
+        {
+            default_ = values_.get(args);
+        }
+
+        void resetToDefault(ArgsBase& args) const override
+        {
+            values_.get(args) = default_;
+        }
+
+    private:
+        Binding<C> values_;
+        C default_;
+    };
+
+    // Like a vector positional, but every value is passed to the callback as soon as it was
+    // converted, instead of collecting all of them.
+    template <typename T>
+    class Positional<std::function<void(T)>>
+        : public PositionalBuilderMixin<Positional<std::function<void(T)>>> {
+    public:
+        using ValueType = std::decay_t<T>;
+
+        Positional(Binding<std::function<void(T)>> sink, Arena& arena, std::string_view name)
+            : PositionalBuilderMixin<Positional<std::function<void(T)>>>(
+                arena, name, Value<std::decay_t<T>>::typeName)
+            , sink_(sink)
+        {
+            this->template setValidate<std::decay_t<T>>();
+            this->many_ = true;
+        }
+
+        bool parse(ArgsBase& args, std::string_view str, size_t choice) const override
+        {
+            auto res = this->template convert<std::decay_t<T>>(str, choice);
+            if (!res) {
+                return false;
+            }
+            const auto& sink = sink_.get(args);
+            if (sink) {
+                sink(std::move(*res));
+            }
+            return true;
+        }
+
+    private:
+        Binding<std::function<void(T)>> sink_;
+    };
+
+    class SubcommandBase : public ArgBase {
+    public:
+        SubcommandBase(Arena& arena, std::string_view name)
+            : ArgBase(arena, name, "")
+        {
+        }
+
+        // Subcommands are not parsed from a single value, but get all following arguments
+        bool parse(ArgsBase&, std::string_view, size_t) const override
+        {
+            return false;
+        }
+
+        // Returns the arguments of the subcommand if it was given or nullptr
+        virtual ArgsBase* get(ArgsBase& parent) const = 0;
+
+        // Constructs the arguments of the subcommand and binds their schema
+        virtual ArgsBase& start(const Parser& parser, ArgsBase& parent) const = 0;
+
+        // Builds the schema of the subcommand in advance, so start doesn't need to
+        virtual void compile(Parser& parser) const = 0;
+    };
+
+    template <typename Sub>
+    class Subcommand : public SubcommandBase {
+    public:
+        Subcommand(Binding<std::optional<Sub>> sub, Arena& arena, std::string_view name)
+            : SubcommandBase(arena, name)
+            , sub_(sub)
+        {
+        }
+
+        Subcommand& help(std::string_view help)
+        {
+            help_ = arena_->copy(help);
+            return *this;
+        }
+
+        void init(ArgsBase& args) const override
+        {
+            sub_.get(args).reset();
+        }
+
+        ArgsBase* get(ArgsBase& parent) const override
+        {
+            auto& sub = sub_.get(parent);
+            return sub ? &*sub : nullptr;
+        }
+
+        // These need the definition of Parser, so they are defined after it
+        ArgsBase& start(const Parser& parser, ArgsBase& parent) const override;
+        void compile(Parser& parser) const override;
+
+    private:
+        Binding<std::optional<Sub>> sub_;
+    };
+
+    inline char toUpperCase(char ch)
+    {
+        if (ch >= 'a' && ch <= 'z') {
+            assert('a' > 'A');
+            return ch - ('a' - 'A');
+        }
+        return ch;
+    }
+
+    inline std::string toUpperCase(std::string_view str)
+    {
+        std::string upper;
+        for (const auto ch : str) {
+            upper.push_back(toUpperCase(ch));
+        }
+        return upper;
+    }
+
+    // memchr and std::count are vectorized by the standard library, so long lists are split fast
+    inline size_t count(std::string_view str, char ch)
+    {
+        return static_cast<size_t>(std::count(str.begin(), str.end(), ch));
+    }
+
+    // Calls func with every part of str between the delimiters, until it returns false
+    template <typename Func>
+    bool split(std::string_view str, char delim, Func&& func)
+    {
+        const char* begin = str.data();
+        const char* const end = str.data() + str.size();
+        while (true) {
+            const auto next = static_cast<const char*>(
+                std::memchr(begin, delim, static_cast<size_t>(end - begin)));
+            if (!func(std::string_view(begin, static_cast<size_t>((next ? next : end) - begin)))) {
+                return false;
+            }
+            if (!next) {
+                return true;
+            }
+            begin = next + 1;
         }
-        return upper;
     }
 
     inline std::string repeated(const std::string& str, size_t num)
     {
-        std::string ret;
-        for (size_t i = 0; i < num; ++i) {
-            if (i > 0) {
-                ret.append(" ");
+        std::string ret;
+        for (size_t i = 0; i < num; ++i) {
+            if (i > 0) {
+                ret.append(" ");
+            }
+            ret.append(str);
+        }
+        return ret;
+    }
+
+    // Out is anything with append(std::string_view), like std::string or FixedWriter
+    template <typename Out, typename Container>
+    void joinTo(Out& out, const Container& container, std::string_view delim)
+    {
+        bool first = true;
+        for (const auto& elem : container) {
+            if (!first) {
+                out.append(delim);
+            }
+            first = false;
+            out.append(std::string_view(elem));
+        }
+    }
+
+    template <typename Container>
+    std::string join(const Container& container, std::string_view delim)
+    {
+        std::string ret;
+        joinTo(ret, container, delim);
+        return ret;
+    }
+
+    template <typename Out>
+    void appendNumber(Out& out, size_t num)
+    {
+        char buffer[std::numeric_limits<size_t>::digits10 + 1];
+        const auto res = std::to_chars(buffer, buffer + sizeof(buffer), num);
+        out.append(std::string_view(buffer, static_cast<size_t>(res.ptr - buffer)));
+    }
+
+    // Writes to a buffer provided by the caller and cuts off whatever doesn't fit, but it keeps
+    // counting, so the caller knows how big the buffer would have had to be.
+    class FixedWriter {
+    public:
+        FixedWriter(char* data, size_t size)
+            : data_(data)
+            , capacity_(size)
+        {
+        }
+
+        void append(std::string_view str)
+        {
+            if (size_ < capacity_) {
+                std::memcpy(data_ + size_, str.data(), std::min(str.size(), capacity_ - size_));
+            }
+            size_ += str.size();
+        }
+
+        size_t size() const
+        {
+            return size_;
+        }
+
+    private:
+        char* data_;
+        size_t capacity_;
+        size_t size_ = 0;
+    };
+
+    CLIPP_DECL bool isNumber(std::string_view str);
+
+    // An open addressing hash table to find flags by their long name
+    class FlagIndex {
+    public:
+        FlagBase* find(std::string_view name) const
+        {
+            if (slots_.empty()) {
+                return nullptr;
+            }
+            for (size_t i = hash(name);; ++i) {
+                const auto flag = slots_[i & (slots_.size() - 1)];
+                if (!flag || flag->name() == name) {
+                    return flag;
+                }
+            }
+        }
+
+        void insert(FlagBase* flag)
+        {
+            // Keep the load factor below 0.5, so probe sequences stay short
+            if ((size_ + 1) * 2 > slots_.size()) {
+                auto slots = std::move(slots_);
+                slots_.assign(std::max<size_t>(16, slots.size() * 2), nullptr);
+                for (const auto f : slots) {
+                    if (f) {
+                        place(f);
+                    }
+                }
+            }
+            place(flag);
+            size_++;
+        }
+
+    private:
+        static size_t hash(std::string_view name)
+        {
+            return std::hash<std::string_view> {}(name);
+        }
+
+        void place(FlagBase* flag)
+        {
+            for (size_t i = hash(flag->name());; ++i) {
+                auto& slot = slots_[i & (slots_.size() - 1)];
+                if (!slot) {
+                    slot = flag;
+                    return;
+                }
+            }
+        }
+
+        std::vector<FlagBase*> slots_;
+        size_t size_ = 0;
+    };
+
+    // Everything about the arguments of an Args struct, that doesn't depend on the instance.
+    // It is built once by calling args() and can then be shared by all instances (see Binding).
+    struct Schema {
+        // Declared first, so it is destroyed last
+        Arena arena;
+        std::vector<FlagBase*> flags;
+        std::vector<PositionalBase*> positionals;
+        std::vector<SubcommandBase*> subcommands;
+        Span<std::string_view> subcommandNames;
+        // Lookup tables for flags, so parsing doesn't have to scan all flags for every option.
+        // They are filled when flags are registered, which also keeps the uniqueness checks cheap.
+        FlagIndex longOpts;
+        std::array<FlagBase*, 256> shortOpts {};
+        bool hasDigitShortOpt = false;
+        // Whether any flag may receive more than one value, so it is worth counting them
+        bool hasCollectingFlags = false;
+        // The flags with an environment variable, sorted by its name (see readEnv)
+        std::vector<FlagBase*> envFlags;
+        size_t positionalsRequired = 0;
+        // The positional that takes many values, if there is exactly one
+        PositionalBase* manyPositional = nullptr;
+        // False if any variable is not a member of the Args struct
+        bool shareable = true;
+        // See ArgsBase::usage() and ArgsBase::help()
+        std::once_flag usageRendered;
+        std::string usage;
+        std::once_flag helpRendered;
+        std::string help;
+        size_t helpOffset = 0;
+
+        FlagBase* flag(std::string_view name) const
+        {
+            return longOpts.find(name);
+        }
+
+        FlagBase* flag(char shortOpt) const
+        {
+            return shortOpts[static_cast<unsigned char>(shortOpt)];
+        }
+
+        // There are usually only a handful, so this doesn't need an index
+        SubcommandBase* subcommand(std::string_view name) const
+        {
+            for (const auto sub : subcommands) {
+                if (sub->name() == name) {
+                    return sub;
+                }
+            }
+            return nullptr;
+        }
+
+        void finalize()
+        {
+            // The first positional argument is the subcommand, so they can't be mixed
+            assert(positionals.empty() || subcommands.empty());
+            if (!subcommands.empty()) {
+                std::vector<std::string_view> names;
+                for (const auto sub : subcommands) {
+                    names.push_back(sub->name());
+                }
+                subcommandNames = arena.copyStrings(names);
+            }
+
+            for (const auto& arg : flags) {
+                assert('0' < '9');
+                if (arg->shortOpt() >= '0' && arg->shortOpt() <= '9') {
+                    hasDigitShortOpt = true;
+                    break;
+                }
+            }
+
+            for (const auto& arg : flags) {
+                hasCollectingFlags = hasCollectingFlags || arg->collect() || arg->num() > 1;
+                if (!arg->env().empty()) {
+                    envFlags.push_back(arg);
+                }
+            }
+            std::stable_sort(envFlags.begin(), envFlags.end(),
+                [](const FlagBase* a, const FlagBase* b) { return a->env() < b->env(); });
+
+            size_t numMany = 0;
+            for (const auto& arg : positionals) {
+                if (!arg->optional()) {
+                    positionalsRequired++;
+                }
+                if (arg->many()) {
+                    numMany++;
+                    manyPositional = arg;
+                }
+            }
+            if (numMany != 1) {
+                manyPositional = nullptr;
+            }
+        }
+
+        void init(ArgsBase& args) const
+        {
+            for (const auto& arg : flags) {
+                arg->init(args);
+            }
+            for (const auto& arg : positionals) {
+                arg->init(args);
+            }
+            for (const auto& sub : subcommands) {
+                sub->init(args);
+            }
+        }
+
+        void resetToDefaults(ArgsBase& args) const
+        {
+            for (const auto& arg : flags) {
+                arg->resetToDefault(args);
+            }
+            for (const auto& arg : positionals) {
+                arg->resetToDefault(args);
+            }
+            for (const auto& sub : subcommands) {
+                sub->resetToDefault(args);
+            }
+        }
+    };
+
+    // A (sub)command for the completion scripts, e.g. "remote add" for "git remote add"
+    struct CompletionCommand {
+        std::vector<std::string_view> path;
+        const Schema* schema;
+    };
+
+    // 'str' for sh, fish understands it too
+    inline std::string shellQuote(std::string_view str)
+    {
+        std::string quoted = "'";
+        for (const auto ch : str) {
+            quoted.append(ch == '\'' ? "'\\''" : std::string(1, ch));
+        }
+        quoted.append("'");
+        return quoted;
+    }
+
+    inline std::string shellWords(const std::vector<std::string_view>& words)
+    {
+        std::string joined;
+        for (const auto word : words) {
+            if (!joined.empty()) {
+                joined.append(" ");
+            }
+            joined.append(word);
+        }
+        return shellQuote(joined);
+    }
+
+    // The words that can follow a command, which are not options
+    CLIPP_DECL std::vector<std::string_view> completionWords(const Schema& schema, bool& files);
+
+    CLIPP_DECL std::string bashCompletion(
+        std::string_view programName, const std::vector<CompletionCommand>& commands);
+
+    CLIPP_DECL std::string fishCompletion(
+        std::string_view programName, const std::vector<CompletionCommand>& commands);
+
+    CLIPP_DECL bool isFlag(std::string_view arg, bool hasDigitShortOpt);
+
+    struct Token {
+        enum class Kind : uint8_t {
+            Positional,
+            Value, // A value of the last preceding flag
+            Separator, // "--"
+            Long, // --flag
+            LongWithValue, // --flag=value
+            Short, // -f, -fVALUE or -abc
+        };
+
+        static constexpr size_t noFlag = std::numeric_limits<size_t>::max();
+
+        std::string_view arg;
+        // The index of the flag this token refers to (in Schema::flags or the StaticSchema) or
+        // noFlag. For stacked short options this is the one that takes the values (i.e. the first
+        // for -fVALUE and else the last).
+        size_t flag = noFlag;
+        // The position of '=' for LongWithValue
+        uint32_t eq = 0;
+        Kind kind = Kind::Positional;
+    };
+
+    // The buffers used while parsing. They belong to the ArgsBase that is parsed into, so they are
+    // reused if it is parsed into again (see Parser::parseInto).
+    struct ParseScratch {
+        std::vector<Token> tokens;
+        // How many values every positional received
+        std::vector<size_t> positionalSizes;
+        // How many values every flag will receive
+        std::vector<size_t> valueCounts;
+        // Which flags were given on the command line
+        std::vector<bool> given;
+        // The values of the environment variables of the flags (see readEnv)
+        std::vector<const char*> envValues;
+    };
+
+    // Like std::once_flag, but it can be moved (with the object it belongs to) and reset
+    class LazyOnce {
+    public:
+        LazyOnce() = default;
+
+        LazyOnce(LazyOnce&& other) noexcept
+            : state_(other.state_.load(std::memory_order_relaxed))
+        {
+        }
+
+        LazyOnce& operator=(LazyOnce&& other) noexcept
+        {
+            state_.store(other.state_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            return *this;
+        }
+
+        // Calls f if it hasn't been called yet. Concurrent callers wait until it has returned.
+        template <typename F>
+        void call(F&& f)
+        {
+            if (state_.load(std::memory_order_acquire) == Done) {
+                return;
+            }
+            auto expected = Idle;
+            if (!state_.compare_exchange_strong(expected, Running, std::memory_order_acquire)) {
+                while (state_.load(std::memory_order_acquire) != Done) {
+                    std::this_thread::yield();
+                }
+                return;
+            }
+            try {
+                f();
+            } catch (...) {
+                state_.store(Idle, std::memory_order_release);
+                throw;
+            }
+            state_.store(Done, std::memory_order_release);
+        }
+
+        void reset()
+        {
+            state_.store(Idle, std::memory_order_relaxed);
+        }
+
+    private:
+        enum State : uint8_t { Idle, Running, Done };
+        std::atomic<State> state_ { Idle };
+    };
+
+    // What tokenize needs to know about a Schema. StaticSchemaOps is the same for a StaticSchema.
+    struct SchemaOps {
+        const Schema& schema;
+
+        bool hasDigitShortOpt() const
+        {
+            return schema.hasDigitShortOpt;
+        }
+
+        bool hasSubcommands() const
+        {
+            return !schema.subcommands.empty();
+        }
+
+        // These return the index of the flag or Token::noFlag
+        size_t findFlag(std::string_view name) const
+        {
+            const auto flag = schema.flag(name);
+            return flag ? flag->index() : Token::noFlag;
+        }
+
+        size_t findFlag(char shortOpt) const
+        {
+            const auto flag = schema.flag(shortOpt);
+            return flag ? flag->index() : Token::noFlag;
+        }
+
+        size_t num(size_t flag) const
+        {
+            return schema.flags[flag]->num();
+        }
+    };
+
+    // Classifies every argument once, so the parser doesn't need to look at any argument twice.
+    // Flags are already looked up here to determine which of the following arguments are their
+    // values, which makes the number of positionals exact. next() returns a default constructed
+    // token to fill in for every argument. If the schema has subcommands, the first positional is
+    // one and the arguments after it belong to it, so they are not tokenized here.
+    template <typename Ops, typename Next>
+    void tokenize(const Ops& ops, ArgvView argv, Next&& next)
+    {
+        const bool hasDigitShortOpt = ops.hasDigitShortOpt();
+        const bool hasSubcommands = ops.hasSubcommands();
+        bool afterPosDelim = false;
+        size_t valuesLeft = 0;
+        for (size_t i = 0; i < argv.size(); ++i) {
+            auto& token = next();
+            token.arg = argv[i];
+            const auto arg = token.arg;
+
+            // Values are consumed until the next flag, so they might also be "--"
+            if (!afterPosDelim && isFlag(arg, hasDigitShortOpt)) {
+                valuesLeft = 0;
+                if (arg[1] == '-') {
+                    const auto eq = arg.find('=');
+                    if (eq != std::string_view::npos) {
+                        token.kind = Token::Kind::LongWithValue;
+                        token.eq = static_cast<uint32_t>(eq);
+                        token.flag = ops.findFlag(arg.substr(2, eq - 2));
+                    } else {
+                        token.kind = Token::Kind::Long;
+                        token.flag = ops.findFlag(arg.substr(2));
+                        valuesLeft = token.flag != Token::noFlag ? ops.num(token.flag) : 0;
+                    }
+                } else {
+                    token.kind = Token::Kind::Short;
+                    const auto first = ops.findFlag(arg[1]);
+                    if (first != Token::noFlag && ops.num(first) == 1 && arg.size() > 2) {
+                        token.flag = first;
+                    } else {
+                        token.flag = ops.findFlag(arg.back());
+                        valuesLeft = token.flag != Token::noFlag ? ops.num(token.flag) : 0;
+                    }
+                }
+            } else if (valuesLeft > 0) {
+                token.kind = Token::Kind::Value;
+                valuesLeft--;
+            } else if (arg == "--") {
+                token.kind = Token::Kind::Separator;
+                afterPosDelim = true;
+            } else {
+                token.kind = Token::Kind::Positional;
+            }
+            if (hasSubcommands && token.kind == Token::Kind::Positional) {
+                return;
+            }
+        }
+    }
+
+    CLIPP_DECL void tokenize(const Schema& schema, ArgvView argv, std::vector<Token>& tokens);
+
+    // The complete contents of a file. It is memory mapped if possible and read otherwise.
+    class FileContents {
+    public:
+        // Returns nullptr if the file could not be read
+        static std::shared_ptr<const FileContents> open(const std::string& path)
+        {
+            auto file = std::shared_ptr<FileContents>(new FileContents());
+#ifdef CLIPP_HAS_MMAP
+            const auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1) {
+                return nullptr;
+            }
+            struct stat st;
+            // Pipes and such can't be mapped
+            if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+                const auto size = static_cast<size_t>(st.st_size);
+                void* ptr = size > 0 ? ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)
+                                     : nullptr;
+                ::close(fd);
+                if (ptr == MAP_FAILED) {
+                    return nullptr;
+                }
+                file->mapping_ = ptr;
+                file->data_ = std::string_view(static_cast<const char*>(ptr), size);
+                return file;
+            }
+            ::close(fd);
+#endif
+            auto f = std::fopen(path.c_str(), "rb");
+            if (!f) {
+                return nullptr;
+            }
+            char buf[4096];
+            size_t n = 0;
+            while ((n = std::fread(buf, 1, sizeof(buf), f)) > 0) {
+                file->buffer_.append(buf, n);
+            }
+            const auto failed = std::ferror(f);
+            std::fclose(f);
+            if (failed) {
+                return nullptr;
+            }
+            file->data_ = file->buffer_;
+            return file;
+        }
+
+        FileContents(const FileContents&) = delete;
+        FileContents& operator=(const FileContents&) = delete;
+
+        ~FileContents()
+        {
+#ifdef CLIPP_HAS_MMAP
+            if (mapping_) {
+                ::munmap(mapping_, data_.size());
+            }
+#endif
+        }
+
+        std::string_view data() const
+        {
+            return data_;
+        }
+
+    private:
+        FileContents() = default;
+
+        void* mapping_ = nullptr;
+        std::string buffer_;
+        std::string_view data_;
+    };
+
+    inline bool isSpace(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    inline size_t findSpaceScalar(std::string_view data, size_t i)
+    {
+        while (i < data.size() && !isSpace(data[i])) {
+            i++;
+        }
+        return i;
+    }
+
+#if defined(CLIPP_SIMD_SSE2) || defined(CLIPP_SIMD_NEON)
+    inline unsigned countTrailingZeros(uint64_t bits)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward64(&index, bits);
+        return static_cast<unsigned>(index);
+#else
+        return static_cast<unsigned>(__builtin_ctzll(bits));
+#endif
+    }
+#endif
+
+    // Returns the index of the first whitespace character at or after i, or data.size() if there
+    // is none. Splitting response files with hundreds of thousands of arguments spends most of its
+    // time in here, so it checks 16 or 32 bytes at once if it can. '\t', '\n', '\v', '\f' and '\r'
+    // are 9 to 13, so they are the bytes with (c - 9) <= 4 unsigned.
+    CLIPP_DECL size_t findSpace(std::string_view data, size_t i);
+
+    // Splits the contents of a response file at whitespace. An argument may be enclosed in single
+    // or double quotes to contain whitespace. There are no escapes and quotes always enclose a
+    // whole argument, so every argument is a view into the file itself.
+    // Returns false if a quote is not terminated.
+    CLIPP_DECL bool splitResponseFile(std::string_view data, std::vector<std::string_view>& args);
+
+    // Stores the values of the environment variables of schema.envFlags in values (indexed like
+    // schema.flags, nullptr if unset), skipping the given flags. The environment is scanned once
+    // and every variable is looked up in the sorted envFlags, so nothing is allocated. The values
+    // point into the environment itself, so it must not be changed while they are in use.
+    inline void readEnv(
+        const Schema& schema, const std::vector<bool>& given, std::vector<const char*>& values)
+    {
+        values.assign(schema.flags.size(), nullptr);
+#ifdef CLIPP_HAS_ENVIRON
+        const auto byEnv = [](const FlagBase* flag, std::string_view name) {
+            return flag->env() < name;
+        };
+        for (char** var = environ; var && *var; ++var) {
+            const auto str = std::string_view(*var);
+            const auto eq = str.find('=');
+            if (eq == std::string_view::npos) {
+                continue;
+            }
+            const auto name = str.substr(0, eq);
+            auto it = std::lower_bound(schema.envFlags.begin(), schema.envFlags.end(), name, byEnv);
+            for (; it != schema.envFlags.end() && (*it)->env() == name; ++it) {
+                // The first definition wins, like for getenv
+                auto& value = values[(*it)->index()];
+                if (!given[(*it)->index()] && !value) {
+                    value = *var + eq + 1;
+                }
+            }
+        }
+#else
+        for (const auto flag : schema.envFlags) {
+            if (!given[flag->index()]) {
+                // env() is copied with a terminating '\0' for this
+                values[flag->index()] = std::getenv(flag->env().data());
+            }
+        }
+#endif
+    }
+
+    // "key = value" in the section "[section]" (empty before the first section)
+    struct ConfigEntry {
+        std::string_view section;
+        std::string_view key;
+        std::string_view value;
+        size_t line;
+    };
+
+    inline std::string_view trim(std::string_view str)
+    {
+        while (!str.empty() && isSpace(str.front())) {
+            str.remove_prefix(1);
+        }
+        while (!str.empty() && isSpace(str.back())) {
+            str.remove_suffix(1);
+        }
+        return str;
+    }
+
+    // Parses a subset of INI: sections, "key = value" and comments starting with '#' or ';'.
+    // A value may be enclosed in single or double quotes. Like for response files, everything is
+    // a view into the file. Returns the 1-based number of the first invalid line (which is
+    // assigned to invalid) or 0.
+    CLIPP_DECL size_t parseConfigFile(
+        std::string_view data, std::vector<ConfigEntry>& entries, std::string_view& invalid);
+
+    // A parsed config file. file is null if it could not be read.
+    struct ConfigFile {
+        std::shared_ptr<const FileContents> file;
+        std::vector<ConfigEntry> entries;
+        std::string_view invalid;
+        size_t invalidLine = 0;
+    };
+
+    CLIPP_DECL std::shared_ptr<const ConfigFile> readConfigFile(const std::string& path);
+
+    // The value of a flag without values from the environment or a config file, which is how
+    // often it is given (so only 0 or 1 make sense for bool flags)
+    inline std::optional<size_t> parseFlagCount(std::string_view str)
+    {
+        if (str == "1" || str == "true" || str == "yes" || str == "on") {
+            return 1;
+        }
+        if (str.empty() || str == "0" || str == "false" || str == "no" || str == "off") {
+            return 0;
+        }
+        size_t count = 0;
+        const auto res = std::from_chars(str.data(), str.data() + str.size(), count);
+        if (res.ec != std::errc() || res.ptr < str.data() + str.size()) {
+            return std::nullopt;
+        }
+        return count;
+    }
+
+}
+
+class ArgsBase {
+public:
+    ArgsBase() = default;
+    virtual ~ArgsBase() = default;
+
+    // Copies would share remaining() and the schema, which is more confusing than useful
+    ArgsBase(const ArgsBase&) = delete;
+    ArgsBase& operator=(const ArgsBase&) = delete;
+
+    ArgsBase(ArgsBase&&) = default;
+    ArgsBase& operator=(ArgsBase&&) = default;
+
+    template <typename T>
+    detail::Flag<std::decay_t<T>>& flag(T& v, std::string_view name, char shortOpt = 0)
+    {
+        assert(!name.empty());
+        assert(nameUnique(name));
+        assert(shortOptUnique(shortOpt));
+        auto& s = schema();
+        auto arg = s.arena.create<detail::Flag<std::decay_t<T>>>(bind(v), s.arena, name, shortOpt);
+        arg->index_ = s.flags.size();
+        arg->saveDefault(*this);
+        s.flags.push_back(arg);
+        s.longOpts.insert(arg);
+        if (shortOpt) {
+            s.shortOpts[static_cast<unsigned char>(shortOpt)] = arg;
+        }
+        return *arg;
+    }
+
+    template <typename T>
+    detail::Positional<std::decay_t<T>>& positional(T& v, std::string_view name)
+    {
+        assert(!name.empty());
+        assert(nameUnique(name));
+        auto& s = schema();
+        auto arg = s.arena.create<detail::Positional<std::decay_t<T>>>(bind(v), s.arena, name);
+        arg->saveDefault(*this);
+        s.positionals.push_back(arg);
+        return *arg;
+    }
+
+    // The arguments of the subcommand are parsed into sub, which stays empty if it's not given.
+    // If an Args type has subcommands, one of them has to be given and it can't have positional
+    // arguments, because the first positional argument is the name of the subcommand.
+    template <typename Sub>
+    detail::Subcommand<Sub>& subcommand(std::optional<Sub>& sub, std::string_view name)
+    {
+        static_assert(std::is_base_of_v<ArgsBase, Sub>);
+        assert(!name.empty());
+        auto& s = schema();
+        assert(!s.subcommand(name));
+        auto arg = s.arena.create<detail::Subcommand<Sub>>(bind(sub), s.arena, name);
+        s.subcommands.push_back(arg);
+        return *arg;
+    }
+
+    // These are views into the arguments that were passed to Parser::parse (or the response files
+    // they came from), so they are only valid as long as those are.
+    detail::Span<std::string_view> remainingView() const
+    {
+        return detail::Span<std::string_view>(remainingViews_.data(), remainingViews_.size());
+    }
+
+    // The same as remainingView, but copied on the first call, so halting doesn't copy anything.
+    // After that they don't depend on the arguments passed to parse anymore.
+    const std::vector<std::string>& remaining() const
+    {
+        remainingCopied_.call(
+            [this]() { remaining_.assign(remainingViews_.begin(), remainingViews_.end()); });
+        return remaining_;
+    }
+
+    virtual std::string description() const
+    {
+        return "";
+    }
+
+    virtual std::string epilog() const
+    {
+        return "";
+    }
+
+    std::string getValueString(const detail::FlagBase* flag) const;
+
+    virtual std::string usage(std::string_view programName) const
+    {
+        const auto& arguments = cachedUsage();
+        std::string usage;
+        usage.reserve(programName.size() + 1 + arguments.size());
+        usage.append(programName);
+        usage.append(" ");
+        usage.append(arguments);
+        return usage;
+    }
+
+    virtual size_t helpOffset() const
+    {
+        return 35;
+    }
+
+    virtual std::string help(std::string_view programName) const
+    {
+        const auto usageStr = usage(programName);
+        const auto descr = description();
+        const auto epi = epilog();
+        std::string uncached;
+        const auto& arguments = cachedHelp(uncached);
+
+        std::string help;
+        help.reserve(7 + usageStr.size() + 2 + descr.size() + 2 + arguments.size() + 1
+            + epi.size() + 1);
+        help.append("Usage: ");
+        help.append(usageStr);
+        help.append("\n\n");
+
+        if (!descr.empty()) {
+            help.append(descr);
+            help.append("\n\n");
+        }
+
+        help.append(arguments);
+
+        if (!epi.empty()) {
+            help.append("\n");
+            help.append(epi);
+            help.append("\n");
+        }
+
+        return help;
+    }
+
+private:
+    // The following functions are useless and potentially "dangerous" to be public
+    // and since I only need them from Parser, I friend Parser here.
+    friend class Parser;
+    template <typename Args>
+    friend class CompiledParser;
+
+    // Everything in usage() after the program name, which only depends on the schema, so it is
+    // rendered once for every schema. Schemas are shared between threads, hence call_once.
+    const std::string& cachedUsage() const
+    {
+        static const std::string empty;
+        if (!schema_) {
+            return empty;
+        }
+        std::call_once(schema_->usageRendered, [this]() { schema_->usage = renderUsage(); });
+        return schema_->usage;
+    }
+
+    // The help for all arguments, which is rendered once for every schema as well, unless
+    // helpOffset() doesn't always return the same value.
+    const std::string& cachedHelp(std::string& uncached) const
+    {
+        const auto offset = helpOffset();
+        if (schema_) {
+            std::call_once(schema_->helpRendered, [this, offset]() {
+                schema_->help = renderHelp(offset);
+                schema_->helpOffset = offset;
+            });
+            if (schema_->helpOffset == offset) {
+                return schema_->help;
+            }
+        }
+        uncached = renderHelp(offset);
+        return uncached;
+    }
+
+    std::string renderUsage() const;
+
+    std::string renderHelp(size_t offset) const;
+
+    detail::Schema& schema()
+    {
+        if (!schema_) {
+            schema_ = std::make_shared<detail::Schema>();
+        }
+        return *schema_;
+    }
+
+    detail::Span<detail::FlagBase*> flags() const
+    {
+        if (!schema_) {
+            return {};
+        }
+        return detail::Span<detail::FlagBase*>(schema_->flags.data(), schema_->flags.size());
+    }
+
+    detail::Span<detail::PositionalBase*> positionals() const
+    {
+        if (!schema_) {
+            return {};
+        }
+        return detail::Span<detail::PositionalBase*>(
+            schema_->positionals.data(), schema_->positionals.size());
+    }
+
+    template <typename T>
+    detail::Binding<std::decay_t<T>> bind(T& v)
+    {
+        // Only Parser knows how large the Args struct is. If it's not set, nothing is a member.
+        const auto addr = reinterpret_cast<std::uintptr_t>(&v);
+        const bool member = addr >= objectBegin_ && addr + sizeof(T) <= objectEnd_;
+        if (!member) {
+            schema().shareable = false;
+        }
+        return detail::Binding<std::decay_t<T>>(v, *this, member);
+    }
+
+    detail::FlagBase* flag(std::string_view name) const
+    {
+        return schema_ ? schema_->flag(name) : nullptr;
+    }
+
+    detail::FlagBase* flag(char shortOpt) const
+    {
+        return schema_ ? schema_->flag(shortOpt) : nullptr;
+    }
+
+    template <typename Container>
+    bool nameUnique(std::string_view name, Container&& args)
+    {
+        for (const auto& arg : args) {
+            if (arg->name() == name) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool nameUnique(std::string_view name)
+    {
+        return !flag(name) && nameUnique(name, positionals());
+    }
+
+    bool shortOptUnique(char shortOpt)
+    {
+        return shortOpt == 0 || !flag(shortOpt);
+    }
+
+    // Copies remaining() for this and all given subcommands
+    void copyRemaining()
+    {
+        remaining();
+        if (schema_) {
+            for (const auto sub : schema_->subcommands) {
+                if (auto subArgs = sub->get(*this)) {
+                    subArgs->copyRemaining();
+                }
+            }
+        }
+    }
+
+    std::shared_ptr<detail::Schema> schema_;
+    std::vector<std::string_view> remainingViews_;
+    mutable std::vector<std::string> remaining_;
+    mutable detail::LazyOnce remainingCopied_;
+    // Arguments from response files and values from config files point into these
+    std::vector<std::shared_ptr<const detail::FileContents>> files_;
+    detail::ParseScratch scratch_;
+    // The range of the Args struct while the schema is built (see bind)
+    std::uintptr_t objectBegin_ = 0;
+    std::uintptr_t objectEnd_ = 0;
+    // Targets of the flags added by Parser
+    bool helpFlag_ = false;
+    bool versionFlag_ = false;
+};
+
+namespace detail {
+    template <typename C, typename T>
+    C memberClass(T C::*);
+
+    template <typename C, typename T>
+    T memberType(T C::*);
+
+    template <typename T>
+    struct IsOptional : std::false_type { };
+
+    template <typename T>
+    struct IsOptional<std::optional<T>> : std::true_type { };
+
+    // Strips std::optional and std::vector from T
+    template <typename T>
+    struct ElementType {
+        using Type = T;
+    };
+
+    template <typename T>
+    struct ElementType<std::optional<T>> {
+        using Type = T;
+    };
+
+    template <typename T>
+    struct ElementType<std::vector<T>> {
+        using Type = T;
+    };
+
+    template <typename T, size_t N>
+    struct ElementType<InplaceVector<T, N>> {
+        using Type = T;
+    };
+
+    constexpr uint32_t fnv1a(std::string_view str)
+    {
+        uint32_t hash = 2166136261u;
+        for (const auto ch : str) {
+            hash ^= static_cast<unsigned char>(ch);
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+}
+
+// StaticFlag and StaticPositional are the building blocks of a StaticSchema, which is an
+// alternative to ArgsBase for programs where every microsecond of startup counts. Everything
+// about the arguments is known at compile time, so parsing does not need any virtual calls or
+// allocations (except for error messages). The supported types are the same as for ArgsBase.
+template <auto Member>
+class StaticFlag {
+public:
+    using Class = decltype(detail::memberClass(Member));
+    using Type = decltype(detail::memberType(Member));
+    using ElementType = typename detail::ElementType<Type>::Type;
+    static constexpr bool isFlag = true;
+
+    constexpr StaticFlag(std::string_view name, char shortOpt = 0)
+        : name_(name)
+        , hash_(detail::fnv1a(name))
+        , shortOpt_(shortOpt)
+        , num_(std::is_same_v<Type, bool> || std::is_same_v<Type, size_t> ? 0 : 1)
+        , collect_(detail::IsVector<Type>::value)
+    {
+        static_assert(std::is_same_v<Type, bool> || std::is_same_v<Type, size_t>
+                || detail::IsOptional<Type>::value || detail::IsVector<Type>::value,
+            "Flags must be bool, size_t, std::optional<T>, std::vector<T> or InplaceVector<T, N>");
+    }
+
+    constexpr StaticFlag num(size_t num) const
+    {
+        static_assert(detail::IsVector<Type>::value, "num() is only available for vectors");
+        auto flag = *this;
+        flag.num_ = num;
+        flag.collect_ = false;
+        return flag;
+    }
+
+    constexpr StaticFlag collect(bool collect = true) const
+    {
+        static_assert(detail::IsVector<Type>::value, "collect() is only available for vectors");
+        auto flag = *this;
+        flag.collect_ = collect;
+        return flag;
+    }
+
+    constexpr std::string_view name() const
+    {
+        return name_;
+    }
+
+    constexpr uint32_t hash() const
+    {
+        return hash_;
+    }
+
+    constexpr char shortOpt() const
+    {
+        return shortOpt_;
+    }
+
+    constexpr size_t num() const
+    {
+        return num_;
+    }
+
+    // Not called collect(), because that is the setter, like in Flag
+    constexpr bool collects() const
+    {
+        return collect_;
+    }
+
+    std::string_view typeName() const
+    {
+        if constexpr (std::is_same_v<Type, bool> || std::is_same_v<Type, size_t>) {
+            return "";
+        } else {
+            return Value<ElementType>::typeName;
+        }
+    }
+
+    void init(Class& obj) const
+    {
+        if constexpr (std::is_same_v<Type, bool>) {
+            obj.*Member = false;
+        } else if constexpr (std::is_same_v<Type, size_t>) {
+            obj.*Member = 0;
+        }
+    }
+
+    void reset(Class& obj) const
+    {
+        if constexpr (detail::IsVector<Type>::value) {
+            (obj.*Member).clear();
+        }
+    }
+
+    bool parse(Class& obj, [[maybe_unused]] std::string_view str) const
+    {
+        if constexpr (std::is_same_v<Type, bool>) {
+            obj.*Member = true;
+        } else if constexpr (std::is_same_v<Type, size_t>) {
+            (obj.*Member)++;
+        } else {
+            auto res = Value<ElementType>::parse(str);
+            if (!res) {
+                return false;
+            }
+            if constexpr (detail::IsVector<Type>::value) {
+                // A full InplaceVector is reported like a value that can't be converted
+                if ((obj.*Member).size() >= (obj.*Member).max_size()) {
+                    return false;
+                }
+                (obj.*Member).push_back(std::move(*res));
+            } else {
+                obj.*Member = std::move(res);
+            }
+        }
+        return true;
+    }
+
+private:
+    std::string_view name_;
+    uint32_t hash_;
+    char shortOpt_;
+    size_t num_;
+    bool collect_;
+};
+
+template <auto Member>
+class StaticPositional {
+public:
+    using Class = decltype(detail::memberClass(Member));
+    using Type = decltype(detail::memberType(Member));
+    using ElementType = typename detail::ElementType<Type>::Type;
+    static constexpr bool isFlag = false;
+
+    constexpr StaticPositional(std::string_view name)
+        : name_(name)
+        , optional_(detail::IsOptional<Type>::value)
+    {
+    }
+
+    constexpr StaticPositional optional(bool optional = true) const
+    {
+        auto pos = *this;
+        pos.optional_ = optional;
+        return pos;
+    }
+
+    constexpr std::string_view name() const
+    {
+        return name_;
+    }
+
+    constexpr bool isOptional() const
+    {
+        return optional_;
+    }
+
+    constexpr bool many() const
+    {
+        return detail::IsVector<Type>::value;
+    }
+
+    std::string_view typeName() const
+    {
+        return Value<ElementType>::typeName;
+    }
+
+    void init(Class&) const
+    {
+    }
+
+    bool parse(Class& obj, std::string_view str) const
+    {
+        auto res = Value<ElementType>::parse(str);
+        if (!res) {
+            return false;
+        }
+        if constexpr (detail::IsVector<Type>::value) {
+            if ((obj.*Member).size() >= (obj.*Member).max_size()) {
+                return false;
+            }
+            (obj.*Member).push_back(std::move(*res));
+        } else {
+            obj.*Member = std::move(*res);
+        }
+        return true;
+    }
+
+private:
+    std::string_view name_;
+    bool optional_;
+};
+
+template <auto Member>
+constexpr StaticFlag<Member> flag(std::string_view name, char shortOpt = 0)
+{
+    return StaticFlag<Member>(name, shortOpt);
+}
+
+template <auto Member>
+constexpr StaticPositional<Member> positional(std::string_view name)
+{
+    return StaticPositional<Member>(name);
+}
+
+template <typename... Args>
+class StaticSchema {
+public:
+    using Class = typename std::tuple_element_t<0, std::tuple<Args...>>::Class;
+    static constexpr size_t size = sizeof...(Args);
+    static constexpr size_t numPositionals = (0 + ... + (Args::isFlag ? 0 : 1));
+    static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+    constexpr StaticSchema(Args... args)
+        : args_(args...)
+    {
+        static_assert((std::is_same_v<typename Args::Class, Class> && ...),
+            "All arguments of a schema must belong to the same struct");
+    }
+
+    template <size_t I>
+    constexpr const auto& get() const
+    {
+        return std::get<I>(args_);
+    }
+
+    bool hasDigitShortOpt() const
+    {
+        return hasDigitShortOpt(std::index_sequence_for<Args...> {});
+    }
+
+    size_t positionalsRequired() const
+    {
+        return positionalsRequired(std::index_sequence_for<Args...> {});
+    }
+
+    // The hashes of the names are computed at compile time and the unrolled comparisons usually
+    // end up as a chain of integer comparisons, so this is rarely more than a single strcmp.
+    size_t findFlag(std::string_view name) const
+    {
+        return findFlag(name, detail::fnv1a(name), std::index_sequence_for<Args...> {});
+    }
+
+    size_t findFlag(char shortOpt) const
+    {
+        return findFlag(shortOpt, std::index_sequence_for<Args...> {});
+    }
+
+    // Calls func with the flag at index idx (as returned by findFlag)
+    template <typename Func>
+    bool visitFlag(size_t idx, Func&& func) const
+    {
+        return visitFlag(idx, func, std::index_sequence_for<Args...> {});
+    }
+
+    // Calls func with the idx-th positional (not counting flags)
+    template <typename Func>
+    bool visitPositional(size_t idx, Func&& func) const
+    {
+        return visitPositional(idx, func, std::index_sequence_for<Args...> {});
+    }
+
+    template <typename Func>
+    void forEach(Func&& func) const
+    {
+        std::apply([&func](const auto&... args) { (func(args), ...); }, args_);
+    }
+
+    std::string usage(std::string_view programName) const
+    {
+        std::string usage = std::string(programName);
+        usage.append(" ");
+        forEach([&usage](const auto& arg) {
+            if constexpr (std::decay_t<decltype(arg)>::isFlag) {
+                usage.append("[--");
+                usage.append(arg.name());
+                const auto value = detail::toUpperCase(arg.name());
+                for (size_t i = 0; i < arg.num(); ++i) {
+                    usage.append(" ");
+                    usage.append(value);
+                }
+                usage.append(arg.collects() ? "]... " : "] ");
+            }
+        });
+        forEach([&usage](const auto& arg) {
+            if constexpr (!std::decay_t<decltype(arg)>::isFlag) {
+                if (arg.isOptional()) {
+                    usage.append("[");
+                    usage.append(arg.name());
+                    usage.append(arg.many() ? "...]" : "]");
+                } else {
+                    usage.append(arg.name());
+                    if (arg.many()) {
+                        usage.append(" [");
+                        usage.append(arg.name());
+                        usage.append("...]");
+                    }
+                }
+                usage.append(" ");
+            }
+        });
+        return usage;
+    }
+
+private:
+    // The index of the I-th argument among the positionals
+    template <size_t I>
+    static constexpr size_t positionalIndex()
+    {
+        constexpr bool isFlag[] = { Args::isFlag... };
+        size_t idx = 0;
+        for (size_t i = 0; i < I; ++i) {
+            idx += isFlag[i] ? 0 : 1;
+        }
+        return idx;
+    }
+
+    template <size_t... I>
+    bool hasDigitShortOpt(std::index_sequence<I...>) const
+    {
+        return ((isDigitShortOpt<I>()) || ...);
+    }
+
+    template <size_t I>
+    bool isDigitShortOpt() const
+    {
+        if constexpr (std::tuple_element_t<I, std::tuple<Args...>>::isFlag) {
+            return get<I>().shortOpt() >= '0' && get<I>().shortOpt() <= '9';
+        } else {
+            return false;
+        }
+    }
+
+    template <size_t... I>
+    size_t positionalsRequired(std::index_sequence<I...>) const
+    {
+        return (0 + ... + isRequired<I>());
+    }
+
+    template <size_t I>
+    size_t isRequired() const
+    {
+        if constexpr (std::tuple_element_t<I, std::tuple<Args...>>::isFlag) {
+            return 0;
+        } else {
+            return get<I>().isOptional() ? 0 : 1;
+        }
+    }
+
+    template <size_t... I>
+    size_t findFlag(std::string_view name, uint32_t hash, std::index_sequence<I...>) const
+    {
+        size_t idx = npos;
+        ((matches<I>(name, hash) ? (idx = I, true) : false) || ...);
+        return idx;
+    }
+
+    template <size_t I>
+    bool matches(std::string_view name, uint32_t hash) const
+    {
+        if constexpr (std::tuple_element_t<I, std::tuple<Args...>>::isFlag) {
+            return get<I>().hash() == hash && get<I>().name() == name;
+        } else {
+            return false;
+        }
+    }
+
+    template <size_t... I>
+    size_t findFlag(char shortOpt, std::index_sequence<I...>) const
+    {
+        size_t idx = npos;
+        ((matches<I>(shortOpt) ? (idx = I, true) : false) || ...);
+        return idx;
+    }
+
+    template <size_t I>
+    bool matches(char shortOpt) const
+    {
+        if constexpr (std::tuple_element_t<I, std::tuple<Args...>>::isFlag) {
+            return shortOpt != 0 && get<I>().shortOpt() == shortOpt;
+        } else {
+            return false;
+        }
+    }
+
+    template <typename Func, size_t... I>
+    bool visitFlag(size_t idx, Func& func, std::index_sequence<I...>) const
+    {
+        bool res = false;
+        ((I == idx ? (res = callFlag<I>(func), true) : false) || ...);
+        return res;
+    }
+
+    template <size_t I, typename Func>
+    bool callFlag(Func& func) const
+    {
+        if constexpr (std::tuple_element_t<I, std::tuple<Args...>>::isFlag) {
+            return func(get<I>());
+        } else {
+            return false;
+        }
+    }
+
+    template <typename Func, size_t... I>
+    bool visitPositional(size_t idx, Func& func, std::index_sequence<I...>) const
+    {
+        bool res = false;
+        ((callPositional<I>(idx, func, res)) || ...);
+        return res;
+    }
+
+    template <size_t I, typename Func>
+    bool callPositional(size_t idx, Func& func, bool& res) const
+    {
+        if constexpr (!std::tuple_element_t<I, std::tuple<Args...>>::isFlag) {
+            if (positionalIndex<I>() == idx) {
+                res = func(get<I>());
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::tuple<Args...> args_;
+};
+
+template <typename... Args>
+constexpr StaticSchema<Args...> schema(Args... args)
+{
+    return StaticSchema<Args...>(args...);
+}
+
+namespace detail {
+    // Like SchemaOps for a StaticSchema
+    template <typename Schema>
+    struct StaticSchemaOps {
+        const Schema& schema;
+
+        bool hasDigitShortOpt() const
+        {
+            return schema.hasDigitShortOpt();
+        }
+
+        static constexpr bool hasSubcommands()
+        {
+            return false;
+        }
+
+        // Schema::npos is Token::noFlag
+        size_t findFlag(std::string_view name) const
+        {
+            return schema.findFlag(name);
+        }
+
+        size_t findFlag(char shortOpt) const
+        {
+            return schema.findFlag(shortOpt);
+        }
+
+        size_t num(size_t flag) const
+        {
+            size_t num = 0;
+            schema.visitFlag(flag, [&num](const auto& f) {
+                num = f.num();
+                return true;
+            });
+            return num;
+        }
+    };
+}
+
+// Describes why parsing failed. The strings are views into the arguments and the schema, so
+// nothing is formatted unless message() is called.
+struct Error {
+    enum class Code : uint8_t {
+        InvalidOption, // name
+        EqualsSyntax, // --flag=value for a flag that takes num != 1 values: name, num
+        MissingValue, // A flag got less than num values: name, num
+        InvalidValue, // Conversion failed: name, value, typeName
+        InvalidChoice, // The value is none of the choices: name, value, choices
+        SuperfluousArgument, // value
+        MissingArgument, // A positional got no value: name
+        InvalidSubcommand, // value, choices
+        MissingSubcommand, // choices
+        UnreadableResponseFile, // value is the path
+        UnterminatedQuote, // In a response file, value is the path
+        ResponseFileDepth, // value is the path
+        UnreadableConfigFile, // value is the path
+        InvalidConfigLine, // value is the line, origin and line where it is
+        UnknownConfigKey, // name is the key, origin and line where it is
+        UnterminatedQuoteInLine, // In a line passed to CompiledParser::parseLines: value, line
+        TooManyValues, // An InplaceVector is full: name, value, num is the capacity
+        Completion, // Not an error: The candidates for --__complete were printed (try* only)
+    };
+
+    static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+    Code code = Code::InvalidOption;
+    // The index of the offending argument (after response file expansion). For errors inside of
+    // response files it is the one of the response file and for missing arguments it is npos.
+    size_t argIndex = npos;
+    // The offending argument descriptor or nullptr (always for static schemas)
+    const detail::ArgBase* arg = nullptr;
+    // Either the name of the option as given or the name of the positional argument
+    std::string_view name;
+    std::string_view value;
+    std::string_view typeName;
+    detail::Span<std::string_view> choices;
+    size_t num = 0;
+    // For delimited lists, the index of the offending element, which is value, or npos
+    size_t element = npos;
+    // For values that are not from the command line, where they are from. That is the path of
+    // the config file and the line in it (starting at 1), or the environment variable (line 0).
+    std::string_view origin;
+    size_t line = 0;
+    // Whether name refers to an option or a positional argument
+    bool option = false;
+
+    std::string message() const;
+
+    // Writes the message without allocating, like snprintf: At most size - 1 characters and a
+    // null terminator (if size > 0). Returns the length of the whole message.
+    size_t format(char* buffer, size_t size) const;
+
+    // Out is anything with append(std::string_view), like std::string
+    template <typename Out>
+    void write(Out& out) const
+    {
+        const auto quoted = [&](std::string_view str) {
+            out.append("'");
+            out.append(str);
+            out.append("'");
+        };
+        const auto originStr = [&]() {
+            if (origin.empty()) {
+                return;
+            }
+            if (line == 0) {
+                out.append(" in environment variable ");
+                quoted(origin);
+            } else {
+                out.append(" in ");
+                quoted(origin);
+                out.append(" line ");
+                detail::appendNumber(out, line);
+            }
+        };
+        const auto argStr = [&]() {
+            if (element != npos) {
+                out.append("at index ");
+                detail::appendNumber(out, element);
+                out.append(" ");
+            }
+            out.append(option ? "for option " : "for argument ");
+            quoted(name);
+        };
+        const auto choicesStr = [&]() {
+            out.append(". Possible values: ");
+            detail::joinTo(out, choices, ", ");
+        };
+        switch (code) {
+        case Code::InvalidOption:
+            out.append("Invalid option ");
+            quoted(name);
+            break;
+        case Code::EqualsSyntax:
+            out.append("'='-syntax can not be used for ");
+            quoted(name);
+            out.append(" because it takes ");
+            detail::appendNumber(out, num);
+            out.append(" arguments");
+            break;
+        case Code::MissingValue:
+            out.append("Option ");
+            quoted(name);
+            out.append(" requires ");
+            if (num == 1) {
+                out.append("an argument");
+            } else {
+                detail::appendNumber(out, num);
+                out.append(" arguments");
+            }
+            originStr();
+            break;
+        case Code::InvalidValue:
+            out.append("Invalid value ");
+            quoted(value);
+            out.append(" ");
+            argStr();
+            if (!typeName.empty()) {
+                out.append(" (");
+                out.append(typeName);
+                out.append(")");
+            }
+            originStr();
+            break;
+        case Code::InvalidChoice:
+            out.append("Invalid value ");
+            quoted(value);
+            out.append(" ");
+            argStr();
+            originStr();
+            choicesStr();
+            break;
+        case Code::TooManyValues:
+            out.append("Too many values ");
+            argStr();
+            out.append(" (at most ");
+            detail::appendNumber(out, num);
+            out.append(")");
+            originStr();
+            break;
+        case Code::SuperfluousArgument:
+            out.append("Superfluous argument ");
+            quoted(value);
+            break;
+        case Code::MissingArgument:
+            out.append("Missing argument ");
+            quoted(name);
+            break;
+        case Code::InvalidSubcommand:
+            out.append("Invalid command ");
+            quoted(value);
+            choicesStr();
+            break;
+        case Code::MissingSubcommand:
+            out.append("Missing command");
+            choicesStr();
+            break;
+        case Code::UnreadableResponseFile:
+            out.append("Could not read response file ");
+            quoted(value);
+            break;
+        case Code::UnterminatedQuote:
+            out.append("Unterminated quote in response file ");
+            quoted(value);
+            break;
+        case Code::ResponseFileDepth:
+            out.append("Response file ");
+            quoted(value);
+            out.append(" is nested too deeply");
+            break;
+        case Code::UnreadableConfigFile:
+            out.append("Could not read config file ");
+            quoted(value);
+            break;
+        case Code::InvalidConfigLine:
+            out.append("Invalid line ");
+            quoted(value);
+            originStr();
+            break;
+        case Code::UnknownConfigKey:
+            out.append("Unknown option ");
+            quoted(name);
+            originStr();
+            break;
+        case Code::UnterminatedQuoteInLine:
+            out.append("Unterminated quote in line ");
+            detail::appendNumber(out, line);
+            break;
+        case Code::Completion:
+            out.append("Completion candidates were printed");
+            break;
+        }
+    }
+};
+
+// Returned by Parser::tryParse. If parsing failed, it still holds the partially parsed
+// arguments, because the error may refer to them and they are needed for usage().
+template <typename T>
+class Result {
+public:
+    explicit Result(T value)
+        : value_(std::move(value))
+    {
+    }
+
+    Result(T value, Error error)
+        : value_(std::move(value))
+        , error_(error)
+    {
+    }
+
+    // For errors before anything was parsed, so the value is default constructed
+    explicit Result(Error error)
+        : error_(error)
+    {
+    }
+
+    explicit operator bool() const
+    {
+        return !error_;
+    }
+
+    T& operator*()
+    {
+        return value_;
+    }
+
+    const T& operator*() const
+    {
+        return value_;
+    }
+
+    T* operator->()
+    {
+        return &value_;
+    }
+
+    const T* operator->() const
+    {
+        return &value_;
+    }
+
+    const Error& error() const
+    {
+        assert(error_);
+        return *error_;
+    }
+
+private:
+    T value_;
+    std::optional<Error> error_;
+};
+
+template <typename Args>
+class CompiledParser;
+
+// See Parser::completionScript
+enum class Shell : uint8_t { Bash, Zsh, Fish };
+
+// Parsers are cheap to copy. The configuration methods and parse modify the parser (the latter
+// caches schemas), so to parse from multiple threads at the same time use compile().
+class Parser {
+public:
+    Parser(std::string programName)
+        : programName_(std::move(programName))
+        , output_(std::make_shared<StdOutErr>())
+        , exit_([](int status) { std::exit(status); })
+    {
+    }
+
+    // The schemas depend on these two, so they throw away the cached ones
+    void version(std::string version)
+    {
+        version_ = std::move(version);
+        schemas_.clear();
+    }
+
+    void addHelp(bool addHelp)
+    {
+        addHelp_ = addHelp;
+        schemas_.clear();
+    }
+
+    void exitOnError(bool exitOnError)
+    {
+        exitOnError_ = exitOnError;
+    }
+
+    // This is essentialy haltOnFirstSuperfluousPositional
+    void errorOnExtraArgs(bool errorOnExtraArgs)
+    {
+        errorOnExtraArgs_ = errorOnExtraArgs;
+    }
+
+    // If enabled, arguments of the form @file are replaced by the arguments in that file
+    void responseFiles(bool responseFiles)
+    {
+        responseFiles_ = responseFiles;
+    }
+
+    // If enabled, "prog --__complete WORDS... CURRENT" prints the candidates for the last word,
+    // one per line, and exits. Nothing is converted or read from the environment or config file.
+    // The try* methods don't exit, but return an error with Error::Code::Completion.
+    void completion(bool completion)
+    {
+        completion_ = completion;
+    }
+
+    // If enabled, values are only converted once the whole command line has been accepted, in the
+    // order they were given. So an expensive Value<T>::parse is not run at all, if there is an
+    // error in a later argument or --help is given. Choices are still checked right away.
+    void deferConversion(bool deferConversion)
+    {
+        deferConversion_ = deferConversion;
+    }
+
+    // Flags that are not given on the command line (or in the environment) are taken from this
+    // file. The keys of a subcommand are in a section with its name, like "[remote.add]". If the
+    // file doesn't exist, it is ignored, unless it is required. It is only read once the command
+    // line is accepted (so --help works without it) and compile() reads it once for all parses.
+    void configFile(std::string path, bool required = false)
+    {
+        configFile_ = std::move(path);
+        configRequired_ = required;
+        config_.reset();
+    }
+
+    // If more than one thread is given, the values of vector arguments are converted by that
+    // many threads after parsing. This implies deferConversion and Value<T>::parse of the element
+    // types has to be thread-safe.
+    void conversionThreads(size_t conversionThreads)
+    {
+        conversionThreads_ = std::max<size_t>(conversionThreads, 1);
+    }
+
+    // Values of types with a Value<T>::validate function are checked with that after all of them
+    // were converted, all at once by up to this many threads. validate has to be thread-safe then.
+    void validationThreads(size_t validationThreads)
+    {
+        validationThreads_ = std::max<size_t>(validationThreads, 1);
+    }
+
+    // These two are mostly for testing, but maybe they are useful for other stuff
+    void output(std::shared_ptr<OutputBase> output)
+    {
+        output_ = std::move(output);
+    }
+
+    void exit(std::function<void(int)> exit)
+    {
+        exit_ = std::move(exit);
+    }
+
+#ifdef CLIPP_INSTRUMENT
+    // Reports the duration of every phase and conversion of parsing to the observer
+    void observer(std::shared_ptr<ObserverBase> observer)
+    {
+        observer_ = std::move(observer);
+    }
+#endif
+
+    // The vector is often a temporary, so remaining() is copied right away
+    template <typename Args>
+    std::optional<Args> parse(const std::vector<std::string>& argv)
+    {
+        auto args = parse<Args>(ArgvView(argv));
+        if (args) {
+            args->copyRemaining();
+        }
+        return args;
+    }
+
+    // Parses the arguments directly from wherever they live, without copying them first.
+    template <typename Args>
+    std::optional<Args> parse(ArgvView argv)
+    {
+        static_assert(std::is_base_of_v<ArgsBase, Args>);
+        detail::debug(">>> parse");
+        if (complete<Args>(argv)) {
+            exit_(0);
+            return std::nullopt; // exit_ might return
+        }
+
+        Args args;
+        bindSchema(args);
+        if (!parseBound(args, argv)) {
+            return std::nullopt;
+        }
+        return args;
+    }
+
+    // Like parse, but errors are only returned and neither printed nor do they exit. Help and
+    // version flags are still handled like in parse.
+    template <typename Args>
+    Result<Args> tryParse(ArgvView argv)
+    {
+        static_assert(std::is_base_of_v<ArgsBase, Args>);
+        detail::debug(">>> tryParse");
+        if (const auto err = complete<Args>(argv)) {
+            return Result<Args>(*err);
+        }
+
+        Args args;
+        bindSchema(args);
+        return tryParseBound(std::move(args), argv);
+    }
+
+    template <typename Args>
+    Result<Args> tryParse(const std::vector<std::string>& argv)
+    {
+        auto res = tryParse<Args>(ArgvView(argv));
+        res->copyRemaining();
+        return res;
+    }
+
+    template <typename Args>
+    std::optional<Args> parse(int argc, char** argv)
+    {
+        assert(argc >= 1);
+        return parse<Args>(ArgvView(argv + 1, static_cast<size_t>(argc - 1)));
+    }
+
+    // Parses into an existing object, which is either default constructed or was parsed into
+    // before. In the latter case, all variables are reset to the values they had when the schema
+    // was built and the schema as well as the memory of the object (e.g. the capacity of vectors)
+    // are reused, so parsing into the same object over and over doesn't allocate.
+    template <typename Args>
+    bool parseInto(Args& args, ArgvView argv)
+    {
+        static_assert(std::is_base_of_v<ArgsBase, Args>);
+        detail::debug(">>> parseInto");
+        if (complete<Args>(argv)) {
+            exit_(0);
+            return false; // exit_ might return
+        }
+        if (args.schema_) {
+            resetArgs(args);
+        } else {
+            bindSchema(args);
+        }
+        return parseBound(args, argv);
+    }
+
+    // Like parseInto, but returns the error instead of reporting it, like tryParse
+    template <typename Args>
+    std::optional<Error> tryParseInto(Args& args, ArgvView argv)
+    {
+        static_assert(std::is_base_of_v<ArgsBase, Args>);
+        detail::debug(">>> tryParseInto");
+        if (auto err = complete<Args>(argv)) {
+            return err;
+        }
+        if (args.schema_) {
+            resetArgs(args);
+        } else {
+            bindSchema(args);
+        }
+        Error err;
+        if (!parseCommand(args, argv, err)) {
+            return err;
+        }
+        return std::nullopt;
+    }
+
+    // A script for the shell that completes options, choices and subcommands of Args, so the
+    // program doesn't have to run for that. The zsh script uses bashcompinit.
+    template <typename Args>
+    std::string completionScript(Shell shell)
+    {
+        static_assert(std::is_base_of_v<ArgsBase, Args>);
+        Args args;
+        bindSchema(args);
+        std::vector<detail::CompletionCommand> commands;
+        collectCommands(args, {}, commands);
+        switch (shell) {
+        case Shell::Bash:
+            return detail::bashCompletion(programName_, commands);
+        case Shell::Zsh:
+            return "# zsh completion for " + programName_
+                + ", generated by clipp\nautoload -U +X bashcompinit && bashcompinit\n"
+                + detail::bashCompletion(programName_, commands);
+        case Shell::Fish:
+            return detail::fishCompletion(programName_, commands);
+        }
+        return "";
+    }
+
+    // Returns an immutable copy of this parser, that can be used from multiple threads at the
+    // same time. The schemas of Args and all its subcommands are built right away.
+    template <typename Args>
+    CompiledParser<Args> compile() const;
+
+    // Parses into the struct described by a StaticSchema. The rules are the same as for ArgsBase,
+    // but there is no --help and --version and superfluous arguments are always an error.
+    template <typename... Args>
+    std::optional<typename StaticSchema<Args...>::Class> parse(
+        const StaticSchema<Args...>& schema, ArgvView argv) const
+    {
+        detail::debug(">>> parse static");
+        typename StaticSchema<Args...>::Class target {};
+        Error err;
+        if (!parseStatic(schema, argv, target, err)) {
+            printError(schema, programName_, err);
+            return std::nullopt;
+        }
+        return target;
+    }
+
+    template <typename... Args>
+    Result<typename StaticSchema<Args...>::Class> tryParse(
+        const StaticSchema<Args...>& schema, ArgvView argv) const
+    {
+        using Class = typename StaticSchema<Args...>::Class;
+        detail::debug(">>> tryParse static");
+        Class target {};
+        Error err;
+        if (!parseStatic(schema, argv, target, err)) {
+            return Result<Class>(std::move(target), err);
+        }
+        return Result<Class>(std::move(target));
+    }
+
+private:
+    template <typename Sub>
+    friend class detail::Subcommand;
+
+    template <typename Args>
+    friend class CompiledParser;
+
+    // The names of the (sub)commands that are parsed, e.g. "git remote add"
+    struct CommandPath {
+        const CommandPath* parent;
+        std::string_view name;
+
+        std::string str() const
+        {
+            return parent ? parent->str() + " " + std::string(name) : std::string(name);
+        }
+
+        // The section in the config file, e.g. "remote.add" (empty for the program itself)
+        std::string section() const
+        {
+            if (!parent) {
+                return {};
+            }
+            const auto prefix = parent->section();
+            return prefix.empty() ? std::string(name) : prefix + "." + std::string(name);
+        }
+    };
+
+    // Matches the tokens to the flags and positionals. This is the same for ArgsBase and static
+    // schemas, so everything that depends on the kind of schema is left to the Matcher (see
+    // parseArgs and parseStatic). positionalSizes receives the number of values given to every
+    // positional and halted whether parsing stopped before the last token.
+    template <typename Matcher>
+    bool matchTokens(Matcher& m, const detail::Token* tokens, size_t count,
+        size_t* positionalSizes, bool& halted, Error& err) const
+    {
+        using Kind = detail::Token::Kind;
+        constexpr auto noFlag = detail::Token::noFlag;
+        const auto numPositionals = m.numPositionals();
+        size_t positionalsRequired = m.positionalsRequired();
+        size_t positionalsLeft = 0;
+        for (size_t i = 0; i < count; ++i) {
+            positionalsLeft += tokens[i].kind == Kind::Positional;
+        }
+
+        bool afterPosDelim = false;
+        size_t positionalIdx = 0;
+        halted = false;
+        for (size_t argIdx = 0; argIdx < count && !halted; ++argIdx) {
+            const auto& token = tokens[argIdx];
+            const auto arg = token.arg;
+            detail::debug("arg: '", arg, "'");
+
+            if (token.kind == Kind::Separator) {
+                detail::debug("sep");
+                if (afterPosDelim && positionalIdx < numPositionals) {
+                    detail::debug("inc pos idx");
+                    positionalsRequired -= !m.optional(positionalIdx);
+                    positionalIdx++;
+                }
+                afterPosDelim = true;
+            } else if (token.kind == Kind::Long || token.kind == Kind::LongWithValue
+                || token.kind == Kind::Short) {
+                detail::debug("flag");
+                const auto flag = token.flag;
+                // The value given with --flag=value or -fVALUE
+                std::optional<std::string_view> inlineValue;
+                std::string_view optName;
+
+                if (token.kind == Kind::Long) {
+                    // long option: --flag
+                    optName = arg;
+                } else if (token.kind == Kind::LongWithValue) {
+                    // --flag=value
+                    detail::debug("eq");
+                    optName = arg.substr(0, token.eq);
+                    if (flag != noFlag && m.num(flag) != 1) {
+                        err = makeError(
+                            Error::Code::EqualsSyntax, argIdx, m.descriptor(flag), optName);
+                        err.num = m.num(flag);
+                        return false;
+                    }
+                    inlineValue = arg.substr(token.eq + 1);
+                } else {
+                    // parse short option(s)
+                    const auto first = m.findFlag(arg[1]);
+                    if (first != noFlag && m.num(first) == 1 && arg.size() > 2) {
+                        detail::debug("short + value");
+                        // -fVALUE
+                        inlineValue = arg.substr(2);
+                        optName = arg.substr(1, 1);
+                    } else {
+                        // parse all except the last as bool flags
+                        for (size_t i = 1; i < arg.size() - 1; ++i) {
+                            const auto c = arg.substr(i, 1);
+                            detail::debug("short: ", c);
+                            const auto sw = i == 1 ? first : m.findFlag(arg[i]);
+                            if (sw == noFlag) {
+                                err = makeError(Error::Code::InvalidOption, argIdx, nullptr, c);
+                                return false;
+                            }
+
+                            if (m.num(sw) != 0) {
+                                err = makeError(
+                                    Error::Code::MissingValue, argIdx, m.descriptor(sw), c);
+                                err.num = m.num(sw);
+                                return false;
+                            }
+
+                            m.parseSwitch(sw);
+
+                            // If we need to halt, we do not break, so we can finish this arg
+                            // completely. If we don't finish it "remaining" is not quite right
+                            // and parts of this argument would be remaining still.
+                            if (m.flagHalts(sw)) {
+                                halted = true;
+                                m.halt(argIdx + 1);
+                            }
+                        }
+                        optName = arg.substr(arg.size() - 1);
+                        detail::debug("lastOpt: ", optName);
+                    }
+                }
+
+                if (flag == noFlag) {
+                    err = makeError(Error::Code::InvalidOption, argIdx, nullptr, optName);
+                    return false;
+                }
+
+                const auto num = m.num(flag);
+                if (num == 0) {
+                    detail::debug("0 arg flag");
+                    m.parseSwitch(flag);
+                } else {
+                    // The tokenizer already determined which of the following arguments are
+                    // values of this flag
+                    size_t numValues = inlineValue ? 1 : 0;
+                    while (!inlineValue && argIdx + 1 + numValues < count
+                        && tokens[argIdx + 1 + numValues].kind == Kind::Value) {
+                        numValues++;
+                    }
+                    assert(numValues <= num);
+
+                    if (numValues < num) {
+                        err = makeError(
+                            Error::Code::MissingValue, argIdx, m.descriptor(flag), optName);
+                        err.num = num;
+                        return false;
+                    }
+
+                    m.startFlag(flag, optName, argIdx);
+                    for (size_t i = 0; i < numValues; ++i) {
+                        const auto valIdx = inlineValue ? argIdx : argIdx + 1 + i;
+                        const auto val = inlineValue ? *inlineValue : tokens[valIdx].arg;
+                        detail::debug("flag value: ", val);
+                        if (!m.parseFlag(flag, optName, val, valIdx, err)) {
+                            return false;
+                        }
+                    }
+                    if (!inlineValue) {
+                        argIdx += numValues;
+                    }
+                }
+
+                if (m.flagHalts(flag)) {
+                    halted = true;
+                    m.halt(argIdx + 1);
+                }
+            } else if (m.hasSubcommands()) {
+                // The subcommand gets the rest of the arguments
+                if (!m.subcommand(argIdx, err)) {
+                    return false;
+                }
+                halted = true;
+            } else if (positionalIdx < numPositionals) {
+                // Optional positionals get nothing if the rest is needed for the required ones
+                while (positionalIdx + 1 < numPositionals && positionalsLeft <= positionalsRequired
+                    && m.optional(positionalIdx)) {
+                    positionalIdx++;
+                }
+
+                if (!m.parsePositional(positionalIdx, arg, argIdx, err)) {
+                    return false;
+                }
+                positionalSizes[positionalIdx]++;
+
+                // The positionals after this one that still need a value
+                const auto requiredAfter = positionalsRequired - !m.optional(positionalIdx);
+                if (m.positionalHalts(positionalIdx)) {
+                    halted = true;
+                    m.halt(argIdx + 1);
+                } else if (!m.many(positionalIdx) || positionalsLeft - 1 == requiredAfter) {
+                    // If we don't have positionals to spare (we just have enough left to give
+                    // one to every positional that needs one) we don't give any positional
+                    // multiple anymore.
+                    positionalIdx++;
+                    positionalsRequired = requiredAfter;
+                }
+
+                positionalsLeft--;
+            } else if (m.errorOnExtraArgs()) {
+                err = makeError(Error::Code::SuperfluousArgument, argIdx, nullptr, {}, arg);
+                return false;
+            } else {
+                halted = true;
+                m.halt(argIdx);
+            }
+        }
+        return true;
+    }
+
+    template <typename... Args>
+    bool parseStatic(const StaticSchema<Args...>& schema, ArgvView argv,
+        typename StaticSchema<Args...>::Class& target, Error& err) const
+    {
+        using Schema = StaticSchema<Args...>;
+        using Target = typename Schema::Class;
+        schema.forEach([&target](const auto& arg) { arg.init(target); });
+
+        // Short command lines are tokenized on the stack, so parsing doesn't allocate
+        std::array<detail::Token, 32> buffer;
+        std::vector<detail::Token> heap;
+        auto tokens = buffer.data();
+        if (argv.size() > buffer.size()) {
+            heap.resize(argv.size());
+            tokens = heap.data();
+        }
+        detail::tokenize(detail::StaticSchemaOps<Schema> { schema }, argv,
+            [next = tokens]() mutable -> detail::Token& { return *next++; });
+
+        // Everything is resolved with visitFlag and visitPositional, so there are no virtual
+        // calls. Static schemas have no subcommands, nothing halts and superfluous arguments are
+        // always an error.
+        struct Matcher : detail::StaticSchemaOps<Schema> {
+            Target& target;
+
+            static constexpr size_t numPositionals()
+            {
+                return Schema::numPositionals;
             }
-            ret.append(str);
+
+            size_t positionalsRequired() const
+            {
+                return this->schema.positionalsRequired();
+            }
+
+            static const detail::ArgBase* descriptor(size_t)
+            {
+                return nullptr;
+            }
+
+            static constexpr bool flagHalts(size_t)
+            {
+                return false;
+            }
+
+            static constexpr bool positionalHalts(size_t)
+            {
+                return false;
+            }
+
+            static constexpr bool subcommand(size_t, Error&)
+            {
+                return false;
+            }
+
+            static constexpr bool errorOnExtraArgs()
+            {
+                return true;
+            }
+
+            static void halt(size_t) { }
+
+            void parseSwitch(size_t flag) const
+            {
+                this->schema.visitFlag(flag, [this](const auto& f) { return f.parse(target, ""); });
+            }
+
+            void startFlag(size_t flag, std::string_view, size_t) const
+            {
+                this->schema.visitFlag(flag, [this](const auto& f) {
+                    if (!f.collects()) {
+                        f.reset(target);
+                    }
+                    return true;
+                });
+            }
+
+            bool parseFlag(size_t flag, std::string_view name, std::string_view value,
+                size_t argIdx, Error& err) const
+            {
+                return this->schema.visitFlag(flag, [&](const auto& f) {
+                    if (!f.parse(target, value)) {
+                        err = makeError(Error::Code::InvalidValue, argIdx, nullptr, name, value);
+                        err.typeName = f.typeName();
+                        err.option = true;
+                        return false;
+                    }
+                    return true;
+                });
+            }
+
+            bool optional(size_t idx) const
+            {
+                return this->schema.visitPositional(
+                    idx, [](const auto& pos) { return pos.isOptional(); });
+            }
+
+            bool many(size_t idx) const
+            {
+                return this->schema.visitPositional(
+                    idx, [](const auto& pos) { return pos.many(); });
+            }
+
+            bool parsePositional(
+                size_t idx, std::string_view value, size_t argIdx, Error& err) const
+            {
+                return this->schema.visitPositional(idx, [&](const auto& pos) {
+                    if (!pos.parse(target, value)) {
+                        err = makeError(
+                            Error::Code::InvalidValue, argIdx, nullptr, pos.name(), value);
+                        err.typeName = pos.typeName();
+                        return false;
+                    }
+                    return true;
+                });
+            }
+        };
+
+        Matcher matcher { { schema }, target };
+        std::array<size_t, Schema::numPositionals> positionalSizes {};
+        bool halted = false;
+        if (!matchTokens(matcher, tokens, argv.size(), positionalSizes.data(), halted, err)) {
+            return false;
         }
-        return ret;
+
+        for (size_t i = 0; i < Schema::numPositionals; ++i) {
+            bool missing = false;
+            schema.visitPositional(i, [&](const auto& pos) {
+                if (!pos.isOptional() && positionalSizes[i] == 0) {
+                    err = makeError(Error::Code::MissingArgument, Error::npos, nullptr, pos.name());
+                    missing = true;
+                }
+                return true;
+            });
+            if (missing) {
+                return false;
+            }
+        }
+
+        return true;
     }
 
-    template <typename Container>
-    std::string join(Container&& container, std::string_view delim)
+    // args() is only called the first time an Args type is parsed with this Parser. After that
+    // the instances just share the schema built back then.
+    template <typename Args>
+    void bindSchema(Args& args)
     {
-        std::stringstream ss;
-        bool first = true;
-        for (const auto& elem : container) {
-            if (!first) {
-                ss << delim;
+        auto& cached = schemas_[&detail::typeKey<Args>];
+        if (cached) {
+            args.schema_ = cached;
+        } else {
+            buildSchema(args);
+            if (args.schema_->shareable) {
+                cached = args.schema_;
             }
-            first = false;
-            ss << elem;
+            for (const auto sub : args.schema_->subcommands) {
+                sub->compile(*this);
+            }
+        }
+        args.schema_->init(args);
+    }
+
+    // This never modifies the cache, so it can be called from multiple threads at the same time
+    template <typename Args>
+    void bindCachedSchema(Args& args) const
+    {
+        const auto it = schemas_.find(&detail::typeKey<Args>);
+        if (it != schemas_.end()) {
+            args.schema_ = it->second;
+        } else {
+            buildSchema(args);
+        }
+        args.schema_->init(args);
+    }
+
+    // Makes the observer of this parser the current one until the end of the scope
+    detail::ObserverScope observe() const
+    {
+#ifdef CLIPP_INSTRUMENT
+        return detail::ObserverScope(observer_.get());
+#else
+        return detail::ObserverScope();
+#endif
+    }
+
+    template <typename Args>
+    void buildSchema(Args& args) const
+    {
+        [[maybe_unused]] const auto observing = observe();
+        detail::PhaseScope phase(Phase::Schema);
+        args.schema_ = std::make_shared<detail::Schema>();
+        args.objectBegin_ = reinterpret_cast<std::uintptr_t>(&args);
+        args.objectEnd_ = args.objectBegin_ + sizeof(Args);
+
+        if (addHelp_) {
+            args.flag(args.helpFlag_, "help", 'h')
+                .halt()
+                .help("Show this help message and exit");
+        }
+
+        if (!version_.empty()) {
+            args.flag(args.versionFlag_, "version").halt().help("Show version string and exit");
+        }
+
+        args.args();
+        args.schema_->finalize();
+
+        args.objectBegin_ = 0;
+        args.objectEnd_ = 0;
+    }
+
+    // Everything from here on is const, so a compiled parser can use it from many threads
+
+    template <typename Args>
+    void bindCachedOrReset(Args& args) const
+    {
+        if (args.schema_) {
+            resetArgs(args);
+        } else {
+            bindCachedSchema(args);
+        }
+    }
+
+    // Like bindCachedOrReset, but args may also have been moved from, in which case they are
+    // replaced with new ones
+    template <typename Args>
+    void bindReusable(Args& args) const
+    {
+        if (!args.schema_) {
+            args = Args();
+        }
+        bindCachedOrReset(args);
+    }
+
+    static void resetArgs(ArgsBase& args);
+
+    // A value, that is converted after the whole command line was accepted (see deferConversion).
+    // For flags that don't collect, the reset is recorded too, so the order stays the same.
+    struct Conversion {
+        ArgsBase* args;
+        const detail::ArgBase* arg;
+        const detail::FlagBase* reset; // only set for resets
+        std::string_view name;
+        std::string_view value;
+        size_t choice;
+        size_t argIndex;
+        size_t element;
+        bool option;
+        std::string_view origin;
+        size_t line;
+    };
+
+    // Everything that is shared between a command and its subcommands during a parse
+    struct ParseState {
+        // Only used if defer is set
+        std::vector<Conversion> conversions;
+        // The values that have to be validated once everything is converted, in argument order
+        std::vector<Conversion> validations;
+        bool defer = false;
+        // Set if parsing stopped at a value that couldn't be converted or didn't fit (see
+        // validateValues)
+        bool conversionFailed = false;
+        // Set once --help or --version was handled, after which nothing else is done
+        bool exited = false;
+        // Only read once a command without --help or --version is parsed
+        std::shared_ptr<const detail::ConfigFile> config;
+    };
+
+    bool parseCommand(ArgsBase& args, ArgvView argv, Error& err) const;
+
+    // Subcommands are constructed in args, so the schemas stay alive as long as args
+    void collectCommands(ArgsBase& args, std::vector<std::string_view> path,
+        std::vector<detail::CompletionCommand>& commands) const;
+
+    // Follows the words like parseArgs would, without converting anything, to find out what the
+    // last one could be
+    void complete(ArgsBase& args, ArgvView words) const;
+
+    // If argv is "--__complete WORDS..." (and completion is enabled), this prints the candidates
+    // and returns an error with Error::Code::Completion. This is checked before the Args passed
+    // to parse are bound, so the candidates are completed with a separate instance.
+    template <typename Args>
+    std::optional<Error> complete(ArgvView argv) const
+    {
+        if (!completion_ || argv.empty() || argv[0] != "--__complete") {
+            return std::nullopt;
+        }
+        Args args;
+        bindCachedSchema(args);
+        complete(args, argv.subview(1));
+        Error err;
+        err.code = Error::Code::Completion;
+        return err;
+    }
+
+    // Reads the config file the first time it is needed in a parse (or takes the one compile()
+    // read) and reports if it could not be read or is invalid
+    bool loadConfigFile(ParseState& state, Error& err) const;
+
+    // Consecutive values of the same argument are converted with a single parseMany, so vector
+    // arguments can convert them in parallel.
+    bool convertDeferred(const std::vector<Conversion>& conversions, Error& err) const;
+
+    // Runs all checks at once, but reports the first value that failed, like converting them in
+    // order would. If failed is set, err is about a value that couldn't be converted and only the
+    // values before it are checked, so whichever comes first in the arguments is reported.
+    bool validateValues(const std::vector<Conversion>& validations, bool failed, Error& err) const;
+
+    template <typename Args>
+    bool parseBound(Args& args, ArgvView argv) const
+    {
+        Error err;
+        if (!parseCommand(args, argv, err)) {
+            report(args, err);
+            return false;
+        }
+        return true;
+    }
+
+    template <typename Args>
+    Result<Args> tryParseBound(Args&& args, ArgvView argv) const
+    {
+        Error err;
+        if (!parseCommand(args, argv, err)) {
+            return Result<Args>(std::move(args), err);
+        }
+        return Result<Args>(std::move(args));
+    }
+
+    static bool isResponseFile(std::string_view arg)
+    {
+        return arg.size() > 1 && arg[0] == '@';
+    }
+
+    // This would be hit by response files that include themselves
+    static constexpr size_t maxResponseFileDepth = 16;
+
+    // argIndex is the index of the response file in the original arguments for nested ones
+    bool expandResponseFiles(ArgsBase& args, ArgvView argv, std::vector<std::string_view>& expanded,
+        size_t depth, size_t argIndex, Error& err) const;
+
+    bool parseArgs(ArgsBase& args, ArgvView argv, Error& err, const CommandPath& path,
+        ParseState& state) const;
+
+    void resetFlag(ArgsBase& args, const detail::FlagBase& flag, std::string_view name,
+        size_t argIndex, std::vector<Conversion>* deferred) const;
+
+    // Flags that were not given on the command line are taken from the environment and then
+    // from the config file
+    bool applyLayers(ArgsBase& args, std::vector<bool>& given, const CommandPath& path,
+        ParseState& state, Error& err) const;
+
+    // A value that is not from the command line. Flags without values get how often they are
+    // given (e.g. "true" or "3") and ones with multiple values get them separated by whitespace.
+    bool applyValue(ArgsBase& args, const detail::FlagBase& flag, std::string_view value,
+        std::string_view origin, size_t line, ParseState& state, Error& err) const;
+
+    // Counts the values of every vector argument in advance, so they can be reserved and don't
+    // have to grow while parsing. Delimited lists are reserved when they are split instead.
+    void reserveValues(
+        ArgsBase& args, const std::vector<detail::Token>& tokens, size_t positionalsLeft) const;
+
+    // name is the name of the option as given or the name of the positional argument and option
+    // is whether it is the value of an option
+    bool parseValue(ArgsBase& args, const detail::ArgBase& arg, std::string_view name,
+        std::string_view value, size_t argIndex, bool option, ParseState& state, Error& err) const;
+
+    bool parseElement(ArgsBase& args, const detail::ArgBase& arg, std::string_view name,
+        std::string_view value, size_t argIndex, size_t element, bool option, ParseState& state,
+        Error& err) const;
+
+    static Error makeError(Error::Code code, size_t argIndex, const detail::ArgBase* arg,
+        std::string_view name, std::string_view value = {});
+
+    // Errors in subcommands are reported with the usage of the subcommand
+    void report(ArgsBase& args, const Error& err) const;
+
+    // Schema is either an ArgsBase or a StaticSchema
+    template <typename Schema>
+    void printError(const Schema& args, std::string_view programName, const Error& err) const
+    {
+        detail::PhaseScope phase(Phase::Format);
+        // Most messages fit, so printing them doesn't allocate
+        char buffer[256];
+        const auto size = err.format(buffer, sizeof(buffer));
+        if (size < sizeof(buffer)) {
+            output_->err(std::string_view(buffer, size));
+        } else {
+            output_->err(err.message());
+        }
+        output_->err("\n");
+        const auto usage = args.usage(programName);
+        if (!usage.empty()) {
+            output_->err("Usage: ");
+            output_->err(usage);
+            output_->err("\n");
+        }
+        phase.end();
+        if (exitOnError_) {
+            exit_(1);
+        }
+    }
+
+    std::string programName_;
+    std::string version_;
+    std::shared_ptr<OutputBase> output_;
+#ifdef CLIPP_INSTRUMENT
+    std::shared_ptr<ObserverBase> observer_;
+#endif
+    std::function<void(int)> exit_;
+    bool addHelp_ = true;
+    bool exitOnError_ = true;
+    bool errorOnExtraArgs_ = true;
+    bool responseFiles_ = false;
+    bool completion_ = false;
+    bool deferConversion_ = false;
+    std::string configFile_;
+    bool configRequired_ = false;
+    // Set by compile(), so the file is not read again for every parse
+    std::shared_ptr<const detail::ConfigFile> config_;
+    size_t conversionThreads_ = 1;
+    size_t validationThreads_ = 1;
+    std::unordered_map<const void*, std::shared_ptr<detail::Schema>> schemas_;
+};
+
+// Created by Parser::compile. It has the same parse methods as Parser, but they are all const and
+// can be called from multiple threads at the same time, as long as the OutputBase and the exit
+// function passed to the parser are thread-safe too (the default ones are). Every parse only
+// allocates its own state and shares the schemas of the parser.
+// Args types that bind variables which are not members (e.g. globals) are not thread-safe.
+template <typename Args>
+class CompiledParser {
+public:
+    std::optional<Args> parse(ArgvView argv) const
+    {
+        if (parser_.complete<Args>(argv)) {
+            parser_.exit_(0);
+            return std::nullopt; // exit_ might return
+        }
+        Args args;
+        parser_.bindCachedSchema(args);
+        if (!parser_.parseBound(args, argv)) {
+            return std::nullopt;
+        }
+        return args;
+    }
+
+    std::optional<Args> parse(const std::vector<std::string>& argv) const
+    {
+        auto args = parse(ArgvView(argv));
+        if (args) {
+            args->copyRemaining();
+        }
+        return args;
+    }
+
+    std::optional<Args> parse(int argc, char** argv) const
+    {
+        assert(argc >= 1);
+        return parse(ArgvView(argv + 1, static_cast<size_t>(argc - 1)));
+    }
+
+    Result<Args> tryParse(ArgvView argv) const
+    {
+        if (const auto err = parser_.complete<Args>(argv)) {
+            return Result<Args>(*err);
+        }
+        Args args;
+        parser_.bindCachedSchema(args);
+        return parser_.tryParseBound(std::move(args), argv);
+    }
+
+    Result<Args> tryParse(const std::vector<std::string>& argv) const
+    {
+        auto res = tryParse(ArgvView(argv));
+        res->copyRemaining();
+        return res;
+    }
+
+    // See Parser::parseInto
+    bool parseInto(Args& args, ArgvView argv) const
+    {
+        if (parser_.complete<Args>(argv)) {
+            parser_.exit_(0);
+            return false; // exit_ might return
+        }
+        parser_.bindCachedOrReset(args);
+        return parser_.parseBound(args, argv);
+    }
+
+    std::optional<Error> tryParseInto(Args& args, ArgvView argv) const
+    {
+        if (auto err = parser_.complete<Args>(argv)) {
+            return err;
+        }
+        parser_.bindCachedOrReset(args);
+        Error err;
+        if (!parser_.parseCommand(args, argv, err)) {
+            return err;
+        }
+        return std::nullopt;
+    }
+
+    // Parses every line of text as a separate command line (without the program name), which is
+    // split like a response file. func(lineNumber, Result<Args>&&) is called with the result of
+    // every line that is not empty, where lines are numbered from 1. The Result points into text,
+    // so it must be copied from, if it is needed after text is gone. If func doesn't move the
+    // value out of the Result, it is parsed into again for the next line (like parseInto), so
+    // similar lines don't allocate.
+    // With more than one thread, the lines are parsed concurrently and func is called from all of
+    // the threads and not in order.
+    template <typename Func>
+    void parseLines(std::string_view text, Func&& func, size_t numThreads = 1) const
+    {
+        if (numThreads <= 1) {
+            LineState state;
+            size_t lineNum = 0;
+            detail::split(text, '\n', [&](std::string_view line) {
+                parseLine(line, ++lineNum, state, func);
+                return true;
+            });
+            return;
+        }
+
+        std::vector<std::string_view> lines;
+        lines.reserve(static_cast<size_t>(std::count(text.begin(), text.end(), '\n')) + 1);
+        detail::split(text, '\n', [&](std::string_view line) {
+            lines.push_back(line);
+            return true;
+        });
+        std::vector<LineState> states(detail::numWorkers(lines.size(), numThreads));
+        detail::parallelForWorkers(
+            lines.size(), numThreads, [&](size_t worker, size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                    parseLine(lines[i], i + 1, states[worker], func);
+                }
+            });
+    }
+
+    // Like parseLines for the contents of a file, which is memory mapped. Returns false if the
+    // file could not be read.
+    template <typename Func>
+    bool parseFile(const std::string& path, Func&& func, size_t numThreads = 1) const
+    {
+        const auto file = detail::FileContents::open(path);
+        if (!file) {
+            return false;
+        }
+        parseLines(file->data(), std::forward<Func>(func), numThreads);
+        return true;
+    }
+
+private:
+    friend class Parser;
+
+    // Every thread of parseLines has one of these, so their memory is reused for all its lines
+    struct LineState {
+        Args args;
+        std::vector<std::string_view> argv;
+    };
+
+    template <typename Func>
+    void parseLine(std::string_view line, size_t lineNum, LineState& state, Func& func) const
+    {
+        state.argv.clear();
+        const auto ok = detail::splitResponseFile(line, state.argv);
+        if (ok && state.argv.empty()) {
+            return;
         }
-        return ss.str();
+
+        parser_.bindReusable(state.args);
+        Error err;
+        if (!ok) {
+            err.code = Error::Code::UnterminatedQuoteInLine;
+            err.value = line;
+            err.line = lineNum;
+        }
+        const auto failed = !ok || !parser_.parseCommand(state.args, ArgvView(state.argv), err);
+        auto res = failed ? Result<Args>(std::move(state.args), err)
+                          : Result<Args>(std::move(state.args));
+        func(lineNum, std::move(res));
+        state.args = std::move(*res);
     }
 
-    inline bool isNumber(std::string_view str)
+    CompiledParser(Parser parser)
+        : parser_(std::move(parser))
     {
-        double v;
-        const auto res = std::from_chars(str.data(), str.data() + str.size(), v);
-        return res.ec == std::errc {} && res.ptr == str.data() + str.size();
     }
-}
-
-class Parser;
 
-class ArgsBase {
-public:
-    ArgsBase() = default;
-    virtual ~ArgsBase() = default;
+    Parser parser_;
+};
 
-    // Automatically deleted because of vector<unique_ptr> members, but this gives nicer errors
-    ArgsBase(const ArgsBase&) = delete;
-    ArgsBase& operator=(const ArgsBase&) = delete;
+template <typename Sub>
+ArgsBase& detail::Subcommand<Sub>::start(const Parser& parser, ArgsBase& parent) const
+{
+    auto& sub = sub_.get(parent).emplace();
+    parser.bindCachedSchema(sub);
+    return sub;
+}
 
-    ArgsBase(ArgsBase&&) = default;
-    ArgsBase& operator=(ArgsBase&&) = default;
+template <typename Sub>
+void detail::Subcommand<Sub>::compile(Parser& parser) const
+{
+    Sub sub;
+    parser.bindSchema(sub);
+}
 
-    template <typename T>
-    detail::Flag<std::decay_t<T>>& flag(T& v, std::string name, char shortOpt = 0)
-    {
-        assert(!name.empty());
-        assert(nameUnique(name));
-        assert(shortOptUnique(shortOpt));
-        // new is bad, but the alternative looks worse and a bit confusing
-        auto arg = new detail::Flag<std::decay_t<T>>(v, std::move(name), shortOpt);
-        flags_.emplace_back(arg);
-        return *arg;
+template <typename Args>
+CompiledParser<Args> Parser::compile() const
+{
+    auto parser = *this;
+    Args args;
+    parser.bindSchema(args);
+    if (!parser.configFile_.empty() && !parser.config_) {
+        parser.config_ = detail::readConfigFile(parser.configFile_);
     }
+    return CompiledParser<Args>(std::move(parser));
+}
+}
 
-    template <typename T>
-    detail::Positional<std::decay_t<T>>& positional(T& v, std::string name)
+// The definitions of everything declared with CLIPP_DECL
+#if !defined(CLIPP_SEPARATE_COMPILATION) || defined(CLIPP_SOURCE)
+namespace clipp {
+namespace detail {
+    CLIPP_DECL bool isNumber(std::string_view str)
     {
-        assert(!name.empty());
-        assert(nameUnique(name));
-        auto arg = new detail::Positional<std::decay_t<T>>(v, std::move(name));
-        positionals_.emplace_back(arg);
-        return *arg;
+        // Most arguments that get here are flags, which from_chars would reject after the dashes.
+        // This rejects them without the call. Numbers start with a digit, '.', "inf" or "nan".
+        const auto first = str.size() > 1 && str[0] == '-' ? str[1] : str.empty() ? '\0' : str[0];
+        if (!(first >= '0' && first <= '9') && first != '.' && first != 'i' && first != 'I'
+            && first != 'n' && first != 'N') {
+            return false;
+        }
+        double v;
+        const auto res = std::from_chars(str.data(), str.data() + str.size(), v);
+        return res.ec == std::errc {} && res.ptr == str.data() + str.size();
     }
 
-    const auto& remaining() const
+    CLIPP_DECL bool isFlag(std::string_view arg, bool hasDigitShortOpt)
     {
-        return remaining_;
+        if (arg == "--" || arg.size() < 2 || arg[0] != '-') {
+            return false;
+        }
+        if (!hasDigitShortOpt && isNumber(arg)) {
+            return false;
+        }
+        return true;
     }
 
-    virtual std::string description() const
+    CLIPP_DECL void tokenize(const Schema& schema, ArgvView argv, std::vector<Token>& tokens)
     {
-        return "";
+        // With subcommands, only the (usually few) arguments up to the first one are tokenized
+        constexpr size_t maxReserve = 16;
+        tokens.clear();
+        tokens.reserve(
+            schema.subcommands.empty() ? argv.size() : std::min(argv.size(), maxReserve));
+        tokenize(
+            SchemaOps { schema }, argv, [&tokens]() -> Token& { return tokens.emplace_back(); });
     }
 
-    virtual std::string epilog() const
+    CLIPP_DECL size_t findSpace(std::string_view data, size_t i)
     {
-        return "";
+#ifdef CLIPP_SIMD_AVX2
+        const auto space32 = _mm256_set1_epi8(' ');
+        const auto tab32 = _mm256_set1_epi8(9);
+        const auto four32 = _mm256_set1_epi8(4);
+        for (; i + 32 <= data.size(); i += 32) {
+            const auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data.data() + i));
+            const auto d = _mm256_sub_epi8(v, tab32);
+            const auto ctrl = _mm256_cmpeq_epi8(_mm256_min_epu8(d, four32), d);
+            const auto spaces = _mm256_or_si256(ctrl, _mm256_cmpeq_epi8(v, space32));
+            const auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(spaces));
+            if (mask) {
+                return i + countTrailingZeros(mask);
+            }
+        }
+#endif
+#ifdef CLIPP_SIMD_SSE2
+        const auto space = _mm_set1_epi8(' ');
+        const auto tab = _mm_set1_epi8(9);
+        const auto four = _mm_set1_epi8(4);
+        for (; i + 16 <= data.size(); i += 16) {
+            const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data.data() + i));
+            const auto d = _mm_sub_epi8(v, tab);
+            const auto ctrl = _mm_cmpeq_epi8(_mm_min_epu8(d, four), d);
+            const auto spaces = _mm_or_si128(ctrl, _mm_cmpeq_epi8(v, space));
+            const auto mask = static_cast<uint32_t>(_mm_movemask_epi8(spaces));
+            if (mask) {
+                return i + countTrailingZeros(mask);
+            }
+        }
+#elif defined(CLIPP_SIMD_NEON)
+        const auto space = vdupq_n_u8(' ');
+        const auto tab = vdupq_n_u8(9);
+        const auto four = vdupq_n_u8(4);
+        for (; i + 16 <= data.size(); i += 16) {
+            const auto v = vld1q_u8(reinterpret_cast<const uint8_t*>(data.data() + i));
+            const auto spaces = vorrq_u8(vceqq_u8(v, space), vcleq_u8(vsubq_u8(v, tab), four));
+            // There is no movemask, but narrowing gives us 4 bits per byte
+            const auto nibbles = vshrn_n_u16(vreinterpretq_u16_u8(spaces), 4);
+            const auto bits = vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+            if (bits) {
+                return i + countTrailingZeros(bits) / 4;
+            }
+        }
+#endif
+        return findSpaceScalar(data, i);
     }
 
-    std::string getValueString(detail::FlagBase* flag) const
+    CLIPP_DECL bool splitResponseFile(std::string_view data, std::vector<std::string_view>& args)
     {
-        std::vector<std::string> valueNames;
-        if (flag->valueNames().empty()) {
-            valueNames = std::vector<std::string>(flag->num(), detail::toUpperCase(flag->name()));
-        } else if (flag->valueNames().size() == 1) {
-            valueNames = std::vector<std::string>(flag->num(), flag->valueNames()[0]);
-        } else {
-            assert(flag->valueNames().size() == flag->num());
-            valueNames = flag->valueNames();
+        size_t i = 0;
+        while (i < data.size()) {
+            if (isSpace(data[i])) {
+                i++;
+            } else if (data[i] == '"' || data[i] == '\'') {
+                const auto end = data.find(data[i], i + 1);
+                if (end == std::string_view::npos) {
+                    return false;
+                }
+                args.push_back(data.substr(i + 1, end - i - 1));
+                i = end + 1;
+            } else {
+                const auto start = i;
+                i = findSpace(data, i);
+                args.push_back(data.substr(start, i - start));
+            }
         }
-        return detail::join(valueNames, " ");
+        return true;
     }
 
-    virtual std::string usage(std::string_view programName) const
+    CLIPP_DECL size_t parseConfigFile(
+        std::string_view data, std::vector<ConfigEntry>& entries, std::string_view& invalid)
     {
-        std::string usage = std::string(programName);
-        usage.append(" ");
-        for (const auto& arg : flags_) {
-            usage.append("[--");
-            usage.append(arg->name());
-
-            const auto values = getValueString(arg.get());
-            if (!values.empty()) {
-                usage.append(" ");
-                usage.append(values);
+        std::string_view section;
+        size_t lineNum = 0;
+        while (!data.empty()) {
+            lineNum++;
+            const auto nl = data.find('\n');
+            const auto line = trim(data.substr(0, nl));
+            data.remove_prefix(nl == std::string_view::npos ? data.size() : nl + 1);
+
+            if (line.empty() || line[0] == '#' || line[0] == ';') {
+                continue;
             }
-            usage.append("]");
-            if (arg->collect()) {
-                usage.append("...");
+            if (line[0] == '[') {
+                if (line.back() != ']') {
+                    invalid = line;
+                    return lineNum;
+                }
+                section = trim(line.substr(1, line.size() - 2));
+                continue;
             }
-            usage.append(" ");
-        }
 
-        for (const auto& arg : positionals_) {
-            std::string name = arg->name();
-            if (!arg->choices().empty()) {
-                name = "{";
-                name.append(detail::join(arg->choices(), ","));
-                name.append("}");
+            const auto eq = line.find('=');
+            if (eq == std::string_view::npos || trim(line.substr(0, eq)).empty()) {
+                invalid = line;
+                return lineNum;
             }
-            if (arg->optional()) {
-                usage.append("[");
-                usage.append(name);
-                if (arg->many()) {
-                    usage.append("...");
-                }
-                usage.append("]");
-            } else {
-                usage.append(name);
-                if (arg->many()) {
-                    usage.append(" ");
-                    usage.append("[");
-                    usage.append(name);
-                    usage.append("...]");
-                }
+            auto value = trim(line.substr(eq + 1));
+            if (value.size() >= 2 && (value[0] == '"' || value[0] == '\'')
+                && value.back() == value[0]) {
+                value = value.substr(1, value.size() - 2);
             }
-            usage.append(" ");
+            entries.push_back({ section, trim(line.substr(0, eq)), value, lineNum });
         }
-        return usage;
+        return 0;
     }
 
-    virtual size_t helpOffset() const
+    CLIPP_DECL std::shared_ptr<const ConfigFile> readConfigFile(const std::string& path)
     {
-        return 35;
+        auto config = std::make_shared<ConfigFile>();
+        config->file = FileContents::open(path);
+        if (config->file) {
+            config->invalidLine
+                = parseConfigFile(config->file->data(), config->entries, config->invalid);
+        }
+        return config;
     }
 
-    virtual std::string help(std::string_view programName) const
+    CLIPP_DECL std::vector<std::string_view> completionWords(const Schema& schema, bool& files)
     {
-        auto getSpacing = [this](size_t size) {
-            const auto minSpacing = 2;
-            return size > helpOffset() - minSpacing ? minSpacing : helpOffset() - size;
-        };
-
-        std::string help = "Usage: " + usage(programName);
-        help.append("\n\n");
+        std::vector<std::string_view> words;
+        files = false;
+        for (const auto sub : schema.subcommands) {
+            words.push_back(sub->name());
+        }
+        for (const auto pos : schema.positionals) {
+            words.insert(words.end(), pos->choices().begin(), pos->choices().end());
+            files = files || pos->choices().empty();
+        }
+        return words;
+    }
 
-        const auto descr = description();
-        if (!descr.empty()) {
-            help.append(descr);
-            help.append("\n\n");
+    CLIPP_DECL std::string bashCompletion(
+        std::string_view programName, const std::vector<CompletionCommand>& commands)
+    {
+        std::string id;
+        for (const auto ch : programName) {
+            const bool alnum = (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z')
+                || (ch >= '0' && ch <= '9');
+            id.push_back(alnum ? ch : '_');
         }
+        const auto pathKey = [](const std::vector<std::string_view>& path) {
+            std::string key;
+            for (const auto name : path) {
+                key.append("/");
+                key.append(name);
+            }
+            return key;
+        };
 
-        if (!positionals_.empty()) {
-            help.append("Positional Arguments:\n");
-            for (const auto& arg : positionals_) {
-                help.append("  ");
-                if (!arg->choices().empty()) {
-                    help.append("{");
-                    help.append(detail::join(arg->choices(), ","));
-                    help.append("}\n");
-                } else {
-                    help.append(arg->name());
-                    help.append(getSpacing(arg->name().size()), ' ');
-                    help.append(arg->help());
-                    help.append("\n");
+        std::string script = "# bash completion for " + std::string(programName)
+            + ", generated by clipp\n_clipp_complete_" + id + "() {\n"
+            + "    local cur=\"${COMP_WORDS[COMP_CWORD]}\" path='' value='' skip=0 word i\n"
+            + "    for ((i = 1; i < COMP_CWORD; i++)); do\n"
+            + "        word=\"${COMP_WORDS[i]}\"\n"
+            + "        if ((skip > 0)); then\n"
+            + "            skip=$((skip - 1))\n"
+            + "            continue\n"
+            + "        fi\n"
+            + "        case \"$path/$word\" in\n";
+        std::string values;
+        for (const auto& cmd : commands) {
+            const auto key = pathKey(cmd.path);
+            for (const auto flag : cmd.schema->flags) {
+                if (flag->num() == 0) {
+                    continue;
+                }
+                const auto longKey = shellQuote(key + "/--" + std::string(flag->name()));
+                script.append("        " + longKey);
+                if (flag->shortOpt()) {
+                    const auto shortKey = key + "/-" + std::string(1, flag->shortOpt());
+                    script.append(" | " + shellQuote(shortKey));
+                }
+                script.append(") skip=" + std::to_string(flag->num()) + " value=" + longKey
+                    + " ;;\n");
+                if (!flag->choices().empty()) {
+                    const std::vector<std::string_view> choices(
+                        flag->choices().begin(), flag->choices().end());
+                    values.append("        " + longKey + ") COMPREPLY=($(compgen -W "
+                        + shellWords(choices) + " -- \"$cur\")) ;;\n");
                 }
             }
-            help.append("\n");
+            for (const auto sub : cmd.schema->subcommands) {
+                const auto subKey = shellQuote(key + "/" + std::string(sub->name()));
+                script.append("        " + subKey + ") path=" + subKey + " ;;\n");
+            }
+        }
+        script.append("        esac\n"
+                      "    done\n"
+                      "    if ((skip > 0)); then\n"
+                      "        case \"$value\" in\n"
+            + values
+            + "        *) COMPREPLY=($(compgen -f -- \"$cur\")) ;;\n"
+              "        esac\n"
+              "        return\n"
+              "    fi\n"
+              "    case \"$path\" in\n");
+        for (const auto& cmd : commands) {
+            std::string optionWords;
+            for (const auto flag : cmd.schema->flags) {
+                optionWords.append(optionWords.empty() ? "--" : " --");
+                optionWords.append(flag->name());
+                if (flag->shortOpt()) {
+                    optionWords.append(" -");
+                    optionWords.push_back(flag->shortOpt());
+                }
+            }
+            bool files = false;
+            const auto words = completionWords(*cmd.schema, files);
+            script.append("    " + shellQuote(pathKey(cmd.path)) + ")\n"
+                + "        if [[ \"$cur\" == -* ]]; then\n"
+                + "            COMPREPLY=($(compgen -W " + shellQuote(optionWords)
+                + " -- \"$cur\"))\n"
+                + "        else\n"
+                + "            COMPREPLY=(");
+            if (!words.empty()) {
+                script.append("$(compgen -W " + shellWords(words) + " -- \"$cur\")");
+            }
+            if (files) {
+                script.append(words.empty() ? "" : " ");
+                script.append("$(compgen -f -- \"$cur\")");
+            }
+            script.append(")\n"
+                          "        fi\n"
+                          "        ;;\n");
         }
+        script.append("    esac\n"
+                      "}\n"
+                      "complete -F _clipp_complete_"
+            + id + " " + std::string(programName) + "\n");
+        return script;
+    }
 
-        if (!flags_.empty()) {
-            help.append("Optional Arguments:\n");
-            for (const auto& arg : flags_) {
-                help.append("  ");
-                if (arg->shortOpt()) {
-                    help.append("-");
-                    help.append(std::string(1, arg->shortOpt()));
-                    help.append(", ");
-                } else {
-                    help.append("    ");
+    CLIPP_DECL std::string fishCompletion(
+        std::string_view programName, const std::vector<CompletionCommand>& commands)
+    {
+        std::string script
+            = "# fish completion for " + std::string(programName) + ", generated by clipp\n";
+        const auto prefix = "complete -c " + shellQuote(programName);
+        for (const auto& cmd : commands) {
+            // The options and words of a command are only offered after the names of all of its
+            // parents and before the name of any of its subcommands
+            std::string condition;
+            for (const auto name : cmd.path) {
+                condition.append(condition.empty() ? "" : "; and ");
+                condition.append("__fish_seen_subcommand_from " + std::string(name));
+            }
+            if (!cmd.schema->subcommands.empty()) {
+                condition.append(condition.empty() ? "not " : "; and not ");
+                condition.append("__fish_seen_subcommand_from");
+                for (const auto sub : cmd.schema->subcommands) {
+                    condition.append(" " + std::string(sub->name()));
+                }
+            }
+            const auto command
+                = prefix + (condition.empty() ? "" : " -n " + shellQuote(condition));
+
+            for (const auto flag : cmd.schema->flags) {
+                script.append(command + " -l " + shellQuote(flag->name()));
+                if (flag->shortOpt()) {
+                    script.append(" -s " + shellQuote(std::string(1, flag->shortOpt())));
+                }
+                if (!flag->choices().empty()) {
+                    const std::vector<std::string_view> choices(
+                        flag->choices().begin(), flag->choices().end());
+                    script.append(" -x -a " + shellWords(choices));
+                } else if (flag->num() > 0) {
+                    script.append(" -r");
                 }
-                help.append("--");
-                help.append(arg->name());
-                size_t size = 4 + 2 + arg->name().size();
-                const auto values = getValueString(arg.get());
-                if (!values.empty()) {
-                    help.append(" ");
-                    help.append(values);
-                    size += 1 + values.size();
+                if (!flag->help().empty()) {
+                    script.append(" -d " + shellQuote(flag->help()));
                 }
-                help.append(getSpacing(size), ' ');
-                help.append(arg->help());
-                help.append("\n");
+                script.append("\n");
+            }
+            for (const auto sub : cmd.schema->subcommands) {
+                script.append(command + " -f -a " + shellQuote(sub->name()));
+                if (!sub->help().empty()) {
+                    script.append(" -d " + shellQuote(sub->help()));
+                }
+                script.append("\n");
+            }
+            bool files = false;
+            std::vector<std::string_view> choices;
+            for (const auto pos : cmd.schema->positionals) {
+                choices.insert(choices.end(), pos->choices().begin(), pos->choices().end());
+                files = files || pos->choices().empty();
+            }
+            if (!choices.empty()) {
+                script.append(command + (files ? "" : " -f") + " -a " + shellWords(choices) + "\n");
             }
-            help.append("\n");
         }
+        return script;
+    }
+}
 
-        const auto epi = epilog();
-        if (!epi.empty()) {
-            help.append("\n");
-            help.append(epi);
-            help.append("\n");
+CLIPP_DECL std::string ArgsBase::getValueString(const detail::FlagBase* flag) const
+{
+    const auto valueNames = flag->valueNames();
+    assert(valueNames.size() <= 1 || valueNames.size() == flag->num());
+    std::string values;
+    for (size_t i = 0; i < flag->num(); ++i) {
+        if (i > 0) {
+            values.append(" ");
+        }
+        const auto name = valueNames.empty()
+            ? detail::toUpperCase(flag->name())
+            : std::string(valueNames[valueNames.size() == 1 ? 0 : i]);
+        values.append(name);
+        if (flag->delimiter()) {
+            values.append("[" + std::string(1, flag->delimiter()) + name + "...]");
         }
-
-        return help;
     }
+    return values;
+}
 
-private:
-    // The following two functions are two useless and potentially "dangerous" to be public
-    // and since I only need them from Parser, I friend Parser here.
-    friend class Parser;
+CLIPP_DECL std::string ArgsBase::renderUsage() const
+{
+    std::string usage;
+    for (const auto& arg : flags()) {
+        usage.append("[--");
+        usage.append(arg->name());
 
-    detail::FlagBase* flag(std::string_view name)
-    {
-        for (const auto& f : flags_) {
-            if (f->name() == name) {
-                return f.get();
+        const auto values = getValueString(arg);
+        if (!values.empty()) {
+            usage.append(" ");
+            usage.append(values);
+        }
+        usage.append("]");
+        if (arg->collect()) {
+            usage.append("...");
+        }
+        usage.append(" ");
+    }
+
+    for (const auto& arg : positionals()) {
+        std::string name = std::string(arg->name());
+        if (!arg->choices().empty()) {
+            name = "{";
+            name.append(detail::join(arg->choices(), ","));
+            name.append("}");
+        }
+        if (arg->optional()) {
+            usage.append("[");
+            usage.append(name);
+            if (arg->many()) {
+                usage.append("...");
+            }
+            usage.append("]");
+        } else {
+            usage.append(name);
+            if (arg->many()) {
+                usage.append(" ");
+                usage.append("[");
+                usage.append(name);
+                usage.append("...]");
             }
         }
-        return nullptr;
+        usage.append(" ");
     }
 
-    detail::FlagBase* flag(char shortOpt)
-    {
-        for (const auto& f : flags_) {
-            if (f->shortOpt() == shortOpt) {
-                return f.get();
+    if (schema_ && !schema_->subcommands.empty()) {
+        usage.append("{");
+        usage.append(detail::join(schema_->subcommandNames, ","));
+        usage.append("} ... ");
+    }
+    return usage;
+}
+
+CLIPP_DECL std::string ArgsBase::renderHelp(size_t offset) const
+{
+    auto getSpacing = [offset](size_t size) {
+        const auto minSpacing = 2;
+        return size > offset - minSpacing ? minSpacing : offset - size;
+    };
+
+    std::string ret;
+    if (!positionals().empty()) {
+        ret.append("Positional Arguments:\n");
+        for (const auto& arg : positionals()) {
+            ret.append("  ");
+            if (!arg->choices().empty()) {
+                ret.append("{");
+                ret.append(detail::join(arg->choices(), ","));
+                ret.append("}\n");
+            } else {
+                ret.append(arg->name());
+                ret.append(getSpacing(arg->name().size()), ' ');
+                ret.append(arg->help());
+                ret.append("\n");
             }
         }
-        return nullptr;
+        ret.append("\n");
     }
 
-    template <typename Container>
-    bool nameUnique(const std::string& name, Container&& args)
-    {
-        for (const auto& arg : args) {
-            if (arg->name() == name) {
-                return false;
+    if (schema_ && !schema_->subcommands.empty()) {
+        ret.append("Commands:\n");
+        for (const auto& sub : schema_->subcommands) {
+            ret.append("  ");
+            ret.append(sub->name());
+            ret.append(getSpacing(sub->name().size()), ' ');
+            ret.append(sub->help());
+            ret.append("\n");
+        }
+        ret.append("\n");
+    }
+
+    if (!flags().empty()) {
+        ret.append("Optional Arguments:\n");
+        for (const auto& arg : flags()) {
+            ret.append("  ");
+            if (arg->shortOpt()) {
+                ret.append("-");
+                ret.append(std::string(1, arg->shortOpt()));
+                ret.append(", ");
+            } else {
+                ret.append("    ");
+            }
+            ret.append("--");
+            ret.append(arg->name());
+            size_t size = 4 + 2 + arg->name().size();
+            const auto values = getValueString(arg);
+            if (!values.empty()) {
+                ret.append(" ");
+                ret.append(values);
+                size += 1 + values.size();
+            }
+            ret.append(getSpacing(size), ' ');
+            ret.append(arg->help());
+            if (!arg->env().empty()) {
+                ret.append(arg->help().empty() ? "[env: " : " [env: ");
+                ret.append(arg->env());
+                ret.append("]");
             }
+            ret.append("\n");
         }
-        return true;
+        ret.append("\n");
     }
 
-    bool nameUnique(const std::string& name)
-    {
-        return nameUnique(name, flags_) && nameUnique(name, positionals_);
+    return ret;
+}
+
+CLIPP_DECL std::string Error::message() const
+{
+    std::string ret;
+    write(ret);
+    return ret;
+}
+
+CLIPP_DECL size_t Error::format(char* buffer, size_t size) const
+{
+    detail::FixedWriter out(buffer, size > 0 ? size - 1 : 0);
+    write(out);
+    if (size > 0) {
+        buffer[std::min(out.size(), size - 1)] = '\0';
     }
+    return out.size();
+}
 
-    bool shortOptUnique(char shortOpt)
-    {
-        if (shortOpt == 0) {
-            return true;
+CLIPP_DECL void Parser::resetArgs(ArgsBase& args)
+{
+    args.schema_->resetToDefaults(args);
+    args.remainingViews_.clear();
+    args.remaining_.clear();
+    args.remainingCopied_.reset();
+    args.files_.clear();
+}
+
+CLIPP_DECL bool Parser::parseCommand(ArgsBase& args, ArgvView argv, Error& err) const
+{
+    [[maybe_unused]] const auto observing = observe();
+    ParseState state;
+    state.defer = deferConversion_ || conversionThreads_ > 1;
+    auto ok = parseArgs(args, argv, err, CommandPath { nullptr, programName_ }, state);
+    // The values (and the error) point into the file
+    if (state.config && state.config->file) {
+        args.files_.push_back(state.config->file);
+    }
+    if (ok && !convertDeferred(state.conversions, err)) {
+        ok = false;
+        state.conversionFailed = true;
+    }
+    // Other errors don't wait for the values to be validated
+    if (!ok && !state.conversionFailed) {
+        return false;
+    }
+    return validateValues(state.validations, !ok, err) && ok;
+}
+
+CLIPP_DECL void Parser::collectCommands(ArgsBase& args, std::vector<std::string_view> path,
+    std::vector<detail::CompletionCommand>& commands) const
+{
+    commands.push_back({ path, args.schema_.get() });
+    for (const auto sub : args.schema_->subcommands) {
+        auto subPath = path;
+        subPath.push_back(sub->name());
+        collectCommands(sub->start(*this, args), std::move(subPath), commands);
+    }
+}
+
+CLIPP_DECL void Parser::complete(ArgsBase& args, ArgvView words) const
+{
+    const auto current = words.empty() ? std::string_view() : words[words.size() - 1];
+    ArgsBase* command = &args;
+    const detail::ArgBase* valueOf = nullptr;
+    size_t valuesLeft = 0;
+    size_t positionalIdx = 0;
+    bool afterPosDelim = false;
+    for (size_t i = 0; i + 1 < words.size(); ++i) {
+        const auto word = words[i];
+        const auto& schema = *command->schema_;
+        if (valuesLeft > 0) {
+            valuesLeft--;
+            continue;
         }
-        for (const auto& flag : flags_) {
-            if (flag->shortOpt() == shortOpt) {
-                return false;
+        if (!afterPosDelim && word == "--") {
+            afterPosDelim = true;
+        } else if (!afterPosDelim && detail::isFlag(word, schema.hasDigitShortOpt)) {
+            const detail::FlagBase* flag = nullptr;
+            if (word[1] == '-') {
+                // --flag=value already has its value
+                if (word.find('=') == std::string_view::npos) {
+                    flag = schema.flag(word.substr(2));
+                }
+            } else {
+                // -fVALUE too, otherwise the last flag in a stack takes the values
+                const auto first = schema.flag(word[1]);
+                if (!(first && first->num() == 1 && word.size() > 2)) {
+                    flag = schema.flag(word.back());
+                }
+            }
+            if (flag && flag->num() > 0) {
+                valueOf = flag;
+                valuesLeft = flag->num();
+            }
+        } else if (!schema.subcommands.empty()) {
+            if (const auto sub = schema.subcommand(word)) {
+                command = &sub->start(*this, *command);
+                positionalIdx = 0;
+                afterPosDelim = false;
             }
+        } else if (positionalIdx < schema.positionals.size()
+            && !schema.positionals[positionalIdx]->many()) {
+            positionalIdx++;
+        }
+    }
+
+    const auto& schema = *command->schema_;
+    const auto candidate = [&](std::string_view word) {
+        if (word.substr(0, current.size()) == current) {
+            output_->out(word);
+            output_->out("\n");
+        }
+    };
+    if (valuesLeft > 0) {
+        for (const auto choice : valueOf->choices()) {
+            candidate(choice);
+        }
+    } else if (!afterPosDelim && !current.empty() && current[0] == '-') {
+        for (const auto flag : schema.flags) {
+            candidate("--" + std::string(flag->name()));
+            if (flag->shortOpt()) {
+                candidate(std::string { '-', flag->shortOpt() });
+            }
+        }
+    } else if (!schema.subcommands.empty()) {
+        for (const auto sub : schema.subcommands) {
+            candidate(sub->name());
+        }
+    } else if (positionalIdx < schema.positionals.size()) {
+        for (const auto choice : schema.positionals[positionalIdx]->choices()) {
+            candidate(choice);
+        }
+    }
+}
+
+CLIPP_DECL bool Parser::loadConfigFile(ParseState& state, Error& err) const
+{
+    if (state.config) {
+        return true;
+    }
+    state.config = config_ ? config_ : detail::readConfigFile(configFile_);
+    const auto& config = *state.config;
+    if (!config.file) {
+        if (configRequired_) {
+            err = makeError(Error::Code::UnreadableConfigFile, Error::npos, nullptr, {},
+                configFile_);
+            return false;
         }
         return true;
     }
+    if (config.invalidLine) {
+        err = makeError(Error::Code::InvalidConfigLine, Error::npos, nullptr, {}, config.invalid);
+        err.origin = configFile_;
+        err.line = config.invalidLine;
+        return false;
+    }
+    return true;
+}
 
-    std::vector<std::unique_ptr<detail::FlagBase>> flags_;
-    std::vector<std::unique_ptr<detail::PositionalBase>> positionals_;
-    std::vector<std::string> remaining_;
-};
+CLIPP_DECL bool Parser::convertDeferred(const std::vector<Conversion>& conversions,
+    Error& err) const
+{
+    if (conversions.empty()) {
+        return true;
+    }
+    detail::PhaseScope phase(Phase::Convert);
+    std::vector<std::string_view> values;
+    std::vector<size_t> choices;
+    for (size_t begin = 0; begin < conversions.size();) {
+        const auto& first = conversions[begin];
+        if (first.reset) {
+            first.reset->reset(*first.args);
+            begin++;
+            continue;
+        }
 
-class Parser {
-public:
-    Parser(std::string programName)
-        : programName_(std::move(programName))
-        , output_(std::make_shared<StdOutErr>())
-        , exit_([](int status) { std::exit(status); })
-    {
+        auto end = begin + 1;
+        while (end < conversions.size() && !conversions[end].reset
+            && conversions[end].arg == first.arg && conversions[end].args == first.args) {
+            end++;
+        }
+
+        values.clear();
+        choices.clear();
+        for (size_t i = begin; i < end; ++i) {
+            values.push_back(conversions[i].value);
+            choices.push_back(conversions[i].choice);
+        }
+        const auto failed = first.arg->parseMany(*first.args,
+            detail::Span(values.data(), values.size()),
+            detail::Span(choices.data(), choices.size()), conversionThreads_);
+        if (failed != detail::ArgBase::npos) {
+            const auto& conv = conversions[begin + failed];
+            if (conv.arg->full(*conv.args)) {
+                err = makeError(
+                    Error::Code::TooManyValues, conv.argIndex, conv.arg, conv.name, conv.value);
+                err.num = conv.arg->maxSize();
+            } else {
+                err = makeError(
+                    Error::Code::InvalidValue, conv.argIndex, conv.arg, conv.name, conv.value);
+                err.typeName = conv.arg->typeName();
+            }
+            err.element = conv.element;
+            err.option = conv.option;
+            err.origin = conv.origin;
+            err.line = conv.line;
+            return false;
+        }
+        begin = end;
     }
+    return true;
+}
 
-    void version(std::string version)
-    {
-        version_ = std::move(version);
+CLIPP_DECL bool Parser::validateValues(const std::vector<Conversion>& validations, bool failed,
+    Error& err) const
+{
+    if (validations.empty()) {
+        return true;
+    }
+    // Values of the same argument are ordered by their element (e.g. "a,b")
+    const auto precedesError = [&err](const Conversion& val) {
+        if (val.argIndex != err.argIndex) {
+            return val.argIndex < err.argIndex;
+        }
+        return val.arg == err.arg && err.element != Error::npos && val.element < err.element;
+    };
+    detail::PhaseScope phase(Phase::Validate);
+    std::atomic<size_t> firstError { Error::npos };
+    detail::parallelFor(validations.size(), validationThreads_, [&](size_t i) {
+        if (i > firstError.load(std::memory_order_relaxed)
+            || (failed && !precedesError(validations[i]))) {
+            return;
+        }
+        if (!validations[i].arg->validate()(validations[i].value)) {
+            auto current = firstError.load(std::memory_order_relaxed);
+            while (i < current && !firstError.compare_exchange_weak(current, i)) { }
+        }
+    });
+    if (firstError == Error::npos) {
+        return true;
     }
 
-    void addHelp(bool addHelp)
-    {
-        addHelp_ = addHelp;
-    }
+    const auto& val = validations[firstError];
+    err = makeError(Error::Code::InvalidValue, val.argIndex, val.arg, val.name, val.value);
+    err.typeName = val.arg->typeName();
+    err.element = val.element;
+    err.option = val.option;
+    err.origin = val.origin;
+    err.line = val.line;
+    return false;
+}
 
-    void exitOnError(bool exitOnError)
-    {
-        exitOnError_ = exitOnError;
-    }
+CLIPP_DECL bool Parser::expandResponseFiles(ArgsBase& args, ArgvView argv,
+    std::vector<std::string_view>& expanded, size_t depth, size_t argIndex, Error& err) const
+{
+    for (size_t i = 0; i < argv.size(); ++i) {
+        const auto arg = argv[i];
+        if (!isResponseFile(arg)) {
+            expanded.push_back(arg);
+            continue;
+        }
 
-    // This is essentialy haltOnFirstSuperfluousPositional
-    void errorOnExtraArgs(bool errorOnExtraArgs)
-    {
-        errorOnExtraArgs_ = errorOnExtraArgs;
+        const auto index = depth == 0 ? i : argIndex;
+        const auto path = arg.substr(1);
+        if (depth >= maxResponseFileDepth) {
+            err = makeError(Error::Code::ResponseFileDepth, index, nullptr, {}, path);
+            return false;
+        }
+
+        auto file = detail::FileContents::open(std::string(path));
+        if (!file) {
+            err = makeError(Error::Code::UnreadableResponseFile, index, nullptr, {}, path);
+            return false;
+        }
+
+        std::vector<std::string_view> fileArgs;
+        if (!detail::splitResponseFile(file->data(), fileArgs)) {
+            err = makeError(Error::Code::UnterminatedQuote, index, nullptr, {}, path);
+            return false;
+        }
+        args.files_.push_back(std::move(file));
+
+        if (!expandResponseFiles(args, ArgvView(fileArgs), expanded, depth + 1, index, err)) {
+            return false;
+        }
     }
+    return true;
+}
 
-    // These two are mostly for testing, but maybe they are useful for other stuff
-    void output(std::shared_ptr<OutputBase> output)
-    {
-        output_ = std::move(output);
+CLIPP_DECL bool Parser::parseArgs(ArgsBase& args, ArgvView argv, Error& err,
+    const CommandPath& path, ParseState& state) const
+{
+    using Kind = detail::Token::Kind;
+    const auto& schema = *args.schema_;
+
+    detail::PhaseScope tokenizePhase(Phase::Tokenize);
+    std::vector<std::string_view> expanded;
+    if (responseFiles_) {
+        bool any = false;
+        for (size_t i = 0; i < argv.size() && !any; ++i) {
+            any = isResponseFile(argv[i]);
+        }
+        if (any) {
+            if (!expandResponseFiles(args, argv, expanded, 0, 0, err)) {
+                return false;
+            }
+            argv = ArgvView(expanded);
+        }
     }
 
-    void exit(std::function<void(int)> exit)
-    {
-        exit_ = std::move(exit);
+    auto& tokens = args.scratch_.tokens;
+    detail::tokenize(schema, argv, tokens);
+
+    size_t positionalsLeft = 0;
+    for (const auto& token : tokens) {
+        if (token.kind == Kind::Positional) {
+            positionalsLeft++;
+        }
     }
 
-    template <typename Args>
-    std::optional<Args> parse(const std::vector<std::string>& argv)
-    {
-        static_assert(std::is_base_of_v<ArgsBase, Args>);
-        detail::debug(">>> parse");
+    reserveValues(args, tokens, positionalsLeft);
+    tokenizePhase.end();
+    detail::PhaseScope matchPhase(Phase::Match);
+
+    // Which flags were given, so the others can be taken from the environment or config file
+    const bool layers = !schema.envFlags.empty() || !configFile_.empty();
+    auto& given = args.scratch_.given;
+    given.assign(layers ? schema.flags.size() : 0, false);
+
+    auto& positionalSizes = args.scratch_.positionalSizes;
+    positionalSizes.assign(schema.positionals.size(), 0);
+
+    struct Matcher : detail::SchemaOps {
+        const Parser& parser;
+        ArgsBase& args;
+        ArgvView argv;
+        const std::vector<detail::Token>& tokens;
+        const CommandPath& path;
+        ParseState& state;
+        // If set, the values are not converted, but added to it
+        std::vector<Conversion>* deferred;
+        std::vector<bool>& given;
+        bool subcommandGiven = false;
+
+        size_t numPositionals() const
+        {
+            return schema.positionals.size();
+        }
 
-        Args args;
+        size_t positionalsRequired() const
+        {
+            return schema.positionalsRequired;
+        }
 
-        bool help = false;
-        if (addHelp_) {
-            args.flag(help, "help", 'h').halt().help("Show this help message and exit");
+        const detail::ArgBase* descriptor(size_t flag) const
+        {
+            return schema.flags[flag];
         }
 
-        bool versionFlag = false;
-        if (!version_.empty()) {
-            args.flag(versionFlag, "version").halt().help("Show version string and exit");
+        bool flagHalts(size_t flag) const
+        {
+            return schema.flags[flag]->halt();
         }
 
-        args.args();
+        bool positionalHalts(size_t idx) const
+        {
+            return schema.positionals[idx]->halt();
+        }
 
-        bool hasDigitShortOpt = false;
-        for (const auto& arg : args.flags_) {
-            assert('0' < '9');
-            if (arg->shortOpt() >= '0' && arg->shortOpt() <= '9') {
-                hasDigitShortOpt = true;
-                break;
-            }
+        bool errorOnExtraArgs() const
+        {
+            return parser.errorOnExtraArgs_;
         }
 
-        auto isFlag = [&hasDigitShortOpt](std::string_view arg) {
-            if (arg == "--" || arg.size() < 2 || arg[0] != '-') {
-                return false;
-            }
-            if (!hasDigitShortOpt && detail::isNumber(arg)) {
-                return false;
+        // The tokens end at a subcommand, so the remaining arguments are taken from argv
+        void halt(size_t argIdx) const
+        {
+            detail::debug("halt");
+            args.remainingViews_.clear();
+            for (size_t i = argIdx; i < argv.size(); ++i) {
+                detail::debug("remaining: ", argv[i]);
+                args.remainingViews_.push_back(argv[i]);
             }
-            return true;
-        };
+        }
 
-        size_t positionalsLeft = 0;
-        for (const auto& arg : argv) {
-            if (!isFlag(arg)) {
-                positionalsLeft++;
+        void markGiven(size_t flag) const
+        {
+            if (!given.empty()) {
+                given[flag] = true;
             }
         }
 
-        size_t positionalsRequired = 0;
-        for (const auto& arg : args.positionals_) {
-            if (!arg->optional()) {
-                positionalsRequired++;
-            }
+        void parseSwitch(size_t flag) const
+        {
+            markGiven(flag);
+            schema.flags[flag]->parse(args, "", detail::ChoiceIndex::npos);
         }
 
-        auto halt = [](Args& args, const std::vector<std::string>& argv, size_t argIdx) -> bool {
-            detail::debug("halt");
-            args.remaining_.clear();
-            for (size_t i = argIdx; i < argv.size(); ++i) {
-                detail::debug("remaining: ", argv[i]);
-                args.remaining_.push_back(argv[i]);
+        void startFlag(size_t flag, std::string_view name, size_t argIdx) const
+        {
+            markGiven(flag);
+            if (!schema.flags[flag]->collect()) {
+                parser.resetFlag(args, *schema.flags[flag], name, argIdx, deferred);
             }
-            return true;
-        };
+        }
 
-        bool afterPosDelim = false;
-        bool halted = false;
-        size_t positionalIdx = 0;
-        for (size_t argIdx = 0; argIdx < argv.size(); ++argIdx) {
-            std::string_view arg = argv[argIdx];
-            detail::debug("arg: '", arg, "'");
+        bool parseFlag(size_t flag, std::string_view name, std::string_view value,
+            size_t argIdx, Error& err) const
+        {
+            return parser.parseValue(
+                args, *schema.flags[flag], name, value, argIdx, true, state, err);
+        }
 
-            if (arg == "--") {
-                detail::debug("sep");
-                if (afterPosDelim) {
-                    detail::debug("inc pos idx");
-                    positionalIdx++;
-                }
-                afterPosDelim = true;
-                continue;
-            } else if (!afterPosDelim && isFlag(arg)) {
-                detail::debug("flag");
-                detail::FlagBase* flag = nullptr;
-                std::vector<std::string_view> values;
-                std::string_view optName;
+        bool optional(size_t idx) const
+        {
+            return schema.positionals[idx]->optional();
+        }
 
-                if (arg[1] == '-') {
-                    // long option: --flag
-                    const auto eq = arg.find('=');
-                    if (eq != std::string_view::npos) {
-                        // --flag=value
-                        detail::debug("eq");
-                        const auto name = arg.substr(0, eq);
-
-                        flag = args.flag(name.substr(2));
-                        if (!flag) {
-                            error(args, "Invalid option '", name, "'");
-                            return std::nullopt;
-                        }
+        bool many(size_t idx) const
+        {
+            return schema.positionals[idx]->many();
+        }
 
-                        if (flag->num() != 1) {
-                            error(args, "'='-syntax can not be used for '", name,
-                                "' because it takes ", std::to_string(flag->num()), " arguments");
-                            return std::nullopt;
-                        }
+        bool parsePositional(size_t idx, std::string_view value, size_t argIdx, Error& err) const
+        {
+            const auto& arg = *schema.positionals[idx];
+            detail::debug("positional ", arg.name());
+            return parser.parseValue(args, arg, arg.name(), value, argIdx, false, state, err);
+        }
 
-                        values.push_back(arg.substr(eq + 1));
-                        optName = name;
-                    } else {
-                        flag = args.flag(arg.substr(2));
-                        if (!flag) {
-                            error(args, "Invalid option '", arg, "'");
-                            return std::nullopt;
-                        }
-                        optName = arg;
-                    }
-                } else {
-                    // parse short option(s)
-                    flag = args.flag(arg[1]);
-                    if (!flag) {
-                        error(args, "Invalid option '", std::string(1, arg[1]), "'");
-                        return std::nullopt;
+        bool subcommand(size_t argIdx, Error& err)
+        {
+            const auto arg = tokens[argIdx].arg;
+            const auto sub = schema.subcommand(arg);
+            if (!sub) {
+                err = makeError(Error::Code::InvalidSubcommand, argIdx, nullptr, {}, arg);
+                err.choices = schema.subcommandNames;
+                return false;
+            }
+
+            // The subcommand gets the rest of the arguments, which are not copied for that
+            detail::debug("subcommand ", sub->name());
+            auto& subArgs = sub->start(parser, args);
+            const auto offset = argIdx + 1;
+            const auto subPath = CommandPath { &path, sub->name() };
+            const auto firstDeferred = state.conversions.size();
+            const auto firstValidation = state.validations.size();
+            const auto ok = parser.parseArgs(subArgs, argv.subview(offset), err, subPath, state);
+            // The values before an error are still validated
+            const auto addOffset = [offset](std::vector<Conversion>& conversions, size_t first) {
+                for (size_t i = first; i < conversions.size(); ++i) {
+                    if (conversions[i].argIndex != Error::npos) {
+                        conversions[i].argIndex += offset;
                     }
+                }
+            };
+            addOffset(state.conversions, firstDeferred);
+            addOffset(state.validations, firstValidation);
+            if (!ok) {
+                if (err.argIndex != Error::npos) {
+                    err.argIndex += offset;
+                }
+                return false;
+            }
+            subcommandGiven = true;
+            return true;
+        }
+    };
 
-                    if (flag->num() == 1 && arg.size() > 2) {
-                        detail::debug("short + value");
-                        // -fVALUE
-                        values.push_back(arg.substr(2));
-                        optName = std::string(1, arg[1]);
-                    } else {
-                        // parse all except the last as bool flags
-                        for (const auto c : arg.substr(1, arg.size() - 2)) {
-                            detail::debug("short: ", std::string(1, c));
-                            auto flag = args.flag(c);
-                            if (!flag) {
-                                error(args, "Invalid option '", std::string(1, c), "'");
-                                return std::nullopt;
-                            }
+    Matcher matcher { { schema }, *this, args, argv, tokens, path, state,
+        state.defer ? &state.conversions : nullptr, given };
+    bool halted = false;
+    if (!matchTokens(matcher, tokens.data(), tokens.size(), positionalSizes.data(), halted, err)) {
+        return false;
+    }
+    // The subcommand printed the help or version
+    if (state.exited) {
+        return true;
+    }
+    const auto subcommandGiven = matcher.subcommandGiven;
 
-                            if (flag->num() != 0) {
-                                const auto argStr = flag->num() == 1
-                                    ? std::string("an argument")
-                                    : std::to_string(flag->num()) + " arguments";
-                                error(args, "Option '", std::string(1, c), "' requires ", argStr);
-                                return std::nullopt;
-                            }
+    matchPhase.end();
 
-                            flag->parse("");
+    // Nothing is converted or validated if we only show the help or version
+    if (args.helpFlag_ || args.versionFlag_) {
+        state.exited = true;
+        state.conversions.clear();
+        state.validations.clear();
+    }
 
-                            // If we need to halt, we do not break, so we can finish this arg
-                            // completely. If we don't finish it "remaining" is not quite right and
-                            // parts of this argument would be remaining still.
-                            if (flag->halt()) {
-                                halted = halt(args, argv, argIdx + 1);
-                            }
-                        }
+    if (args.helpFlag_) {
+        detail::PhaseScope phase(Phase::Format);
+        output_->out(args.help(path.str()));
+        phase.end();
+        exit_(0);
+        return true; // exit_ might return
+    }
 
-                        const auto lastOpt = arg[arg.size() - 1];
-                        detail::debug("lastOpt: ", std::string(1, lastOpt));
-                        flag = args.flag(lastOpt);
-                        if (!flag) {
-                            error(args, "Invalid option '", std::string(1, lastOpt), "'");
-                            return std::nullopt;
-                        }
-                        optName = std::string(1, lastOpt);
-                    }
-                }
+    if (args.versionFlag_) {
+        output_->out(version_);
+        output_->out("\n");
+        exit_(0);
+        return true; // exit_ might return
+    }
 
-                assert(flag);
-                if (flag->num() == 0) {
-                    detail::debug("0 arg flag");
-                    flag->parse("");
-                } else {
-                    if (values.empty()) {
-                        for (size_t i = argIdx + 1;
-                             i < std::min(argv.size(), argIdx + 1 + flag->num()); ++i) {
-                            if (isFlag(argv[i])) {
-                                break;
-                            }
-                            values.push_back(argv[i]);
-                            detail::debug("flag value: ", values.back());
-                        }
-                        assert(values.size() <= flag->num());
-                        argIdx += values.size();
-                    }
+    if (!applyLayers(args, given, path, state, err)) {
+        return false;
+    }
 
-                    if (values.size() < flag->num()) {
-                        error(args, "Option '", optName, "' requires ", std::to_string(flag->num()),
-                            (flag->num() > 1 ? " arguments" : " argument"));
-                        return std::nullopt;
-                    }
+    if (halted) {
+        return true;
+    }
 
-                    if (!flag->collect()) {
-                        flag->reset();
-                    }
+    detail::PhaseScope phase(Phase::Validate);
+    if (!schema.subcommands.empty() && !subcommandGiven) {
+        err = makeError(Error::Code::MissingSubcommand, Error::npos, nullptr, {});
+        err.choices = schema.subcommandNames;
+        return false;
+    }
 
-                    for (const auto val : values) {
-                        const auto name = detail::concat("option '", optName, "'");
-                        if (!parseArg(args, *flag, name, val)) {
-                            return std::nullopt;
-                        }
-                    }
-                }
+    for (size_t i = 0; i < schema.positionals.size(); ++i) {
+        const auto& arg = *schema.positionals[i];
+        if (!arg.optional() && positionalSizes[i] == 0) {
+            err = makeError(Error::Code::MissingArgument, Error::npos, &arg, arg.name());
+            return false;
+        }
+    }
 
-                if (flag->halt()) {
-                    halted = halt(args, argv, argIdx + 1);
-                }
-            } else if (positionalIdx < args.positionals_.size()) {
-                auto& arg = *args.positionals_[positionalIdx];
+    return true;
+}
 
-                detail::debug("positional ", arg.name());
-                const auto name = "argument '" + arg.name() + "'";
-                if (!parseArg(args, arg, name, argv[argIdx])) {
-                    return std::nullopt;
-                }
+CLIPP_DECL void Parser::resetFlag(ArgsBase& args, const detail::FlagBase& flag,
+    std::string_view name, size_t argIndex, std::vector<Conversion>* deferred) const
+{
+    if (deferred) {
+        deferred->push_back(
+            { &args, &flag, &flag, name, {}, 0, argIndex, Error::npos, true, {}, 0 });
+    } else {
+        flag.reset(args);
+    }
+}
 
-                if (arg.halt()) {
-                    halted = halt(args, argv, argIdx + 1);
-                } else if (!arg.many() || positionalsLeft == positionalsRequired) {
-                    // If we don't have positionals to spare (we just have enough left to give one
-                    // to every positional that needs one) we don't give any positional multiple
-                    // anymore.
-                    positionalIdx++;
-                    positionalsRequired--;
+CLIPP_DECL bool Parser::applyLayers(ArgsBase& args, std::vector<bool>& given,
+    const CommandPath& path, ParseState& state, Error& err) const
+{
+    const auto& schema = *args.schema_;
+    if (given.empty()) {
+        return true;
+    }
+    detail::PhaseScope phase(Phase::Layers);
+
+    if (!schema.envFlags.empty()) {
+        // Applied in the order of the flags, so errors don't depend on the environment's order
+        auto& values = args.scratch_.envValues;
+        detail::readEnv(schema, given, values);
+        for (const auto flag : schema.flags) {
+            if (const auto value = values[flag->index()]) {
+                given[flag->index()] = true;
+                if (!applyValue(args, *flag, value, flag->env(), 0, state, err)) {
+                    return false;
                 }
-
-                positionalsLeft--;
-            } else if (errorOnExtraArgs_) {
-                error(args, "Superfluous argument '", argv[argIdx], "'");
-                return std::nullopt;
-            } else {
-                halted = halt(args, argv, argIdx);
             }
+        }
+    }
 
-            if (halted) {
-                break;
+    if (!configFile_.empty()) {
+        if (!loadConfigFile(state, err)) {
+            return false;
+        }
+        const auto section = path.section();
+        for (const auto& entry : state.config->entries) {
+            if (entry.section != section) {
+                continue;
+            }
+            const auto flag = schema.flag(entry.key);
+            if (!flag) {
+                err = makeError(Error::Code::UnknownConfigKey, Error::npos, nullptr, entry.key);
+                err.origin = configFile_;
+                err.line = entry.line;
+                return false;
+            }
+            if (!given[flag->index()]
+                && !applyValue(args, *flag, entry.value, configFile_, entry.line, state, err)) {
+                return false;
             }
         }
+    }
+    return true;
+}
 
-        if (help) {
-            output_->out(args.help(programName_));
-            exit_(0);
-            return args; // exit_ might return
-        }
+CLIPP_DECL bool Parser::applyValue(ArgsBase& args, const detail::FlagBase& flag,
+    std::string_view value, std::string_view origin, size_t line, ParseState& state,
+    Error& err) const
+{
+    const auto deferred = state.defer ? &state.conversions : nullptr;
+    const auto setOrigin = [&]() {
+        err.origin = origin;
+        err.line = line;
+        return false;
+    };
 
-        if (versionFlag) {
-            output_->out(version_);
-            output_->out("\n");
-            exit_(0);
-            return args; // exit_ might return
+    if (flag.num() == 0) {
+        const auto count = detail::parseFlagCount(value);
+        if (!count) {
+            err = makeError(Error::Code::InvalidValue, Error::npos, &flag, flag.name(), value);
+            err.option = true;
+            return setOrigin();
         }
-
-        if (halted) {
-            return args;
+        for (size_t i = 0; i < *count; ++i) {
+            flag.parse(args, "", detail::ChoiceIndex::npos);
         }
+        return true;
+    }
 
-        for (auto& arg : args.positionals_) {
-            if (!arg->optional() && arg->size() == 0) {
-                error(args, "Missing argument '", arg->name(), "'");
-                return std::nullopt;
-            }
+    // Only values for multiple arguments are split, so the common case doesn't allocate
+    auto values = detail::Span<std::string_view>(&value, 1);
+    std::vector<std::string_view> split;
+    if (flag.num() != 1) {
+        if (!detail::splitResponseFile(value, split) || split.empty()
+            || split.size() % flag.num() != 0 || (!flag.collect() && split.size() > flag.num())) {
+            err = makeError(Error::Code::MissingValue, Error::npos, &flag, flag.name());
+            err.num = flag.num();
+            return setOrigin();
         }
-
-        return args;
+        values = detail::Span<std::string_view>(split.data(), split.size());
     }
 
-    template <typename Args>
-    std::optional<Args> parse(int argc, char** argv)
-    {
-        return parse<Args>(std::vector<std::string>(argv + 1, argv + argc));
+    const auto firstDeferred = state.conversions.size();
+    const auto firstValidation = state.validations.size();
+    if (!flag.collect()) {
+        resetFlag(args, flag, flag.name(), Error::npos, deferred);
+    }
+    for (const auto val : values) {
+        if (!parseValue(args, flag, flag.name(), val, Error::npos, true, state, err)) {
+            return setOrigin();
+        }
+    }
+    for (size_t i = firstDeferred; i < state.conversions.size(); ++i) {
+        state.conversions[i].origin = origin;
+        state.conversions[i].line = line;
     }
+    for (size_t i = firstValidation; i < state.validations.size(); ++i) {
+        state.validations[i].origin = origin;
+        state.validations[i].line = line;
+    }
+    return true;
+}
 
-private:
-    bool parseArg(
-        const ArgsBase& args, detail::ArgBase& arg, std::string_view name, std::string_view value)
-    {
-        if (arg.choices().size() > 0) {
-            bool found = false;
-            for (const auto& choice : arg.choices()) {
-                if (choice == value) {
-                    found = true;
-                    break;
+CLIPP_DECL void Parser::reserveValues(ArgsBase& args, const std::vector<detail::Token>& tokens,
+    size_t positionalsLeft) const
+{
+    using Kind = detail::Token::Kind;
+    const auto& schema = *args.schema_;
+
+    bool separator = false;
+    if (schema.hasCollectingFlags) {
+        auto& counts = args.scratch_.valueCounts;
+        counts.assign(schema.flags.size(), 0);
+        const detail::FlagBase* current = nullptr;
+        for (const auto& token : tokens) {
+            const auto flag
+                = token.flag != detail::Token::noFlag ? schema.flags[token.flag] : nullptr;
+            if (token.kind == Kind::Value) {
+                counts[current->index()]++;
+            } else if (token.kind == Kind::Separator) {
+                separator = true;
+            } else if (token.kind == Kind::Long || token.kind == Kind::Short) {
+                current = flag;
+                // -fVALUE
+                if (flag && token.kind == Kind::Short && flag->shortOpt() == token.arg[1]
+                    && flag->num() == 1 && token.arg.size() > 2) {
+                    counts[flag->index()]++;
                 }
-            }
-            if (!found) {
-                std::string valStr = detail::join(arg.choices(), ", ");
-                error(
-                    args, "Invalid value '", value, "' for ", name, ". Possible values: ", valStr);
-                return false;
+            } else if (token.kind == Kind::LongWithValue && flag) {
+                counts[flag->index()]++;
             }
         }
 
-        if (!arg.parse(value)) {
-            std::string message = detail::concat("Invalid value '", value, "' for ", name);
-            if (!arg.typeName().empty()) {
-                message.append(" (" + std::string(arg.typeName()) + ")");
+        for (const auto flag : schema.flags) {
+            const auto count = counts[flag->index()];
+            if (count > 1 && flag->collect() && !flag->delimiter()) {
+                flag->reserve(args, count);
             }
-            error(args, message);
-            return false;
         }
-        return true;
+    } else if (schema.manyPositional) {
+        for (size_t i = 0; i < tokens.size() && !separator; ++i) {
+            separator = tokens[i].kind == Kind::Separator;
+        }
     }
 
-    template <typename... Args>
-    void error(const ArgsBase& args, Args&&... msg)
-    {
-        output_->err(detail::concat(std::forward<Args>(msg)...));
-        output_->err("\n");
-        const auto usage = args.usage(programName_);
-        if (!usage.empty()) {
-            output_->err("Usage: ");
-            output_->err(usage);
-            output_->err("\n");
+    // With "--" the positionals can be distributed arbitrarily, so nothing is reserved. Else
+    // it gets all positionals except the ones required by the others at most.
+    const auto pos = schema.manyPositional;
+    if (pos && !separator && !pos->delimiter()) {
+        const auto others = schema.positionalsRequired - (pos->optional() ? 0 : 1);
+        if (positionalsLeft > others + 1) {
+            pos->reserve(args, positionalsLeft - others);
         }
-        if (exitOnError_) {
-            exit_(1);
+    }
+}
+
+CLIPP_DECL bool Parser::parseValue(ArgsBase& args, const detail::ArgBase& arg,
+    std::string_view name, std::string_view value, size_t argIndex, bool option, ParseState& state,
+    Error& err) const
+{
+    const auto delim = arg.delimiter();
+    if (!delim) {
+        return parseElement(args, arg, name, value, argIndex, Error::npos, option, state, err);
+    }
+
+    // An empty list has no elements instead of a single empty one
+    if (value.empty()) {
+        return true;
+    }
+    if (!state.defer) {
+        arg.reserve(args, detail::count(value, delim) + 1);
+    }
+    size_t element = 0;
+    return detail::split(value, delim, [&](std::string_view elem) {
+        return parseElement(args, arg, name, elem, argIndex, element++, option, state, err);
+    });
+}
+
+CLIPP_DECL bool Parser::parseElement(ArgsBase& args, const detail::ArgBase& arg,
+    std::string_view name, std::string_view value, size_t argIndex, size_t element, bool option,
+    ParseState& state, Error& err) const
+{
+    auto choice = detail::ChoiceIndex::npos;
+    if (arg.choices().size() > 0) {
+        choice = arg.findChoice(value);
+        if (choice == detail::ChoiceIndex::npos) {
+            err = makeError(Error::Code::InvalidChoice, argIndex, &arg, name, value);
+            err.choices = arg.choices();
+            err.element = element;
+            err.option = option;
+            return false;
         }
     }
 
-    std::string programName_;
-    std::string version_;
-    std::shared_ptr<OutputBase> output_;
-    std::function<void(int)> exit_;
-    bool addHelp_ = true;
-    bool exitOnError_ = true;
-    bool errorOnExtraArgs_ = true;
-};
+    if (arg.validate()) {
+        state.validations.push_back(
+            { &args, &arg, nullptr, name, value, choice, argIndex, element, option, {}, 0 });
+    }
+    if (state.defer) {
+        state.conversions.push_back(
+            { &args, &arg, nullptr, name, value, choice, argIndex, element, option, {}, 0 });
+        return true;
+    }
+
+    if (arg.full(args)) {
+        err = makeError(Error::Code::TooManyValues, argIndex, &arg, name, value);
+        err.num = arg.maxSize();
+        err.element = element;
+        err.option = option;
+        state.conversionFailed = true;
+        return false;
+    }
+
+    if (!arg.parse(args, value, choice)) {
+        err = makeError(Error::Code::InvalidValue, argIndex, &arg, name, value);
+        err.typeName = arg.typeName();
+        err.element = element;
+        err.option = option;
+        state.conversionFailed = true;
+        return false;
+    }
+    return true;
+}
+
+CLIPP_DECL Error Parser::makeError(Error::Code code, size_t argIndex, const detail::ArgBase* arg,
+    std::string_view name, std::string_view value)
+{
+    Error err;
+    err.code = code;
+    err.argIndex = argIndex;
+    err.arg = arg;
+    err.name = name;
+    err.value = value;
+    return err;
 }
+
+CLIPP_DECL void Parser::report(ArgsBase& args, const Error& err) const
+{
+    [[maybe_unused]] const auto observing = observe();
+    ArgsBase* current = &args;
+    std::string programName = programName_;
+    for (bool found = true; found;) {
+        found = false;
+        for (const auto sub : current->schema_->subcommands) {
+            if (auto subArgs = sub->get(*current)) {
+                programName.append(" ");
+                programName.append(sub->name());
+                current = subArgs;
+                found = true;
+                break;
+            }
+        }
+    }
+    printError(*current, programName, err);
+}
+}
+#endif
@@ -62,8 +62,6 @@ public:
     ExistingFile(std::string path)
         : path_(std::move(path))
     {
-        // If this was real code, I would be worried about race-conditions
-        assert(std::filesystem::exists(path_));
     }
 
     const std::string& path() const
@@ -81,11 +79,15 @@ struct clipp::Value<ExistingFile> {
 
     static std::optional<ExistingFile> parse(std::string_view str)
     {
-        if (!std::filesystem::exists(str)) {
-            return std::nullopt;
-        }
         return std::string(str);
     }
+
+    // Stat-ing files can be slow (e.g. on network filesystems), so this is not done in parse, but
+    // in validate, which is called for all values at once after everything else was parsed.
+    static bool validate(std::string_view str)
+    {
+        return std::filesystem::exists(str);
+    }
 };
 
 struct Args : public clipp::ArgsBase {
@@ -106,6 +108,8 @@ struct Args : public clipp::ArgsBase {
 int main(int argc, char** argv)
 {
     auto parser = clipp::Parser(argv[0]);
+    // With many files, they can be checked by multiple threads at the same time
+    parser.validationThreads(8);
     const auto args = parser.parse<Args>(argc, argv).value();
     std::cout << "enum: " << static_cast<int>(args.myEnum) << std::endl;
     std::cout << "even int: " << args.evenInt.value() << std::endl;
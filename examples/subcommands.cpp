@@ -3,17 +3,6 @@
 // #define CLIPP_DEBUG
 #include "clipp.hpp"
 
-struct ParentArgs : public clipp::ArgsBase {
-    std::optional<std::string> device;
-    std::string command;
-
-    void args()
-    {
-        flag(device, "device", 'd').help("Which device to start the system on");
-        positional(command, "command").choices({ "start", "stop" }).halt();
-    }
-};
-
 struct StartArgs : public clipp::ArgsBase {
     std::optional<std::string> power;
     std::string system;
@@ -36,6 +25,20 @@ struct StopArgs : public clipp::ArgsBase {
     }
 };
 
+struct ParentArgs : public clipp::ArgsBase {
+    std::optional<std::string> device;
+    // Exactly one of these will be set after parsing
+    std::optional<StartArgs> start;
+    std::optional<StopArgs> stop;
+
+    void args()
+    {
+        flag(device, "device", 'd').help("Which device to start the system on");
+        subcommand(start, "start").help("Start a system");
+        subcommand(stop, "stop").help("Stop a system");
+    }
+};
+
 int main(int argc, char** argv)
 {
     auto parser = clipp::Parser(argv[0]);
@@ -44,17 +47,14 @@ int main(int argc, char** argv)
         std::cout << "Device: " << *args.device << std::endl;
     }
 
-    auto subParser = clipp::Parser(std::string(argv[0]) + " " + args.command);
-    if (args.command == "start") {
-        const auto subArgs = subParser.parse<StartArgs>(args.remaining()).value();
-        if (subArgs.power) {
-            std::cout << "power: " << *subArgs.power << std::endl;
+    if (args.start) {
+        if (args.start->power) {
+            std::cout << "power: " << *args.start->power << std::endl;
         }
-        std::cout << "Starting system: " << subArgs.system << std::endl;
-    } else if (args.command == "stop") {
-        const auto subArgs = subParser.parse<StopArgs>(args.remaining()).value();
-        std::cout << "force: " << subArgs.force << std::endl;
-        std::cout << "Stopping system: " << subArgs.system << std::endl;
+        std::cout << "Starting system: " << args.start->system << std::endl;
+    } else if (args.stop) {
+        std::cout << "force: " << args.stop->force << std::endl;
+        std::cout << "Stopping system: " << args.stop->system << std::endl;
     }
     return 0;
 }
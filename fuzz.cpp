@@ -0,0 +1,944 @@
+// Fuzzes the parse loop of clipp::Parser and cross-checks every result against a much simpler
+// reference implementation. An input describes a schema (the flags, the positionals and some
+// parser settings) and is followed by the arguments.
+//
+// Built with -DCLIPP_LIBFUZZER and -fsanitize=fuzzer this is a libFuzzer target (meson configure
+// -Dfuzz=true, needs clang). Otherwise it has its own main:
+//   fuzz FILES...   runs the given inputs, e.g. a crash found by libFuzzer
+//   fuzz --runs N   runs N random inputs
+//   fuzz --perf     measures exec/s and peak memory and fails if the time per argument of some
+//                   pathological command lines grows with their length
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#if __has_include(<sys/resource.h>)
+#include <sys/resource.h>
+#define HAS_RUSAGE
+#endif
+
+#include "clipp.hpp"
+
+constexpr size_t maxFlags = 6;
+constexpr size_t maxPositionals = 3;
+constexpr size_t maxArgs = 64;
+
+enum class FlagKind : uint8_t { Bool, Count, Value, Int, List, Halt };
+enum class PosKind : uint8_t { Single, Optional, Many, ManyOptional, Halt };
+
+struct FlagSpec {
+    FlagKind kind;
+    std::string name;
+    char shortOpt;
+    size_t num;
+    bool collect;
+};
+
+struct PosSpec {
+    PosKind kind;
+    std::string name;
+
+    bool optional() const
+    {
+        return kind == PosKind::Optional || kind == PosKind::ManyOptional;
+    }
+
+    bool many() const
+    {
+        return kind == PosKind::Many || kind == PosKind::ManyOptional;
+    }
+};
+
+struct Spec {
+    std::vector<FlagSpec> flags;
+    std::vector<PosSpec> positionals;
+    bool errorOnExtraArgs = true;
+    bool defer = false;
+};
+
+// Returns 0 once the input is exhausted
+class Input {
+public:
+    Input(const uint8_t* data, size_t size)
+        : data_(data)
+        , size_(size)
+    {
+    }
+
+    uint8_t byte()
+    {
+        return pos_ < size_ ? data_[pos_++] : 0;
+    }
+
+    bool empty() const
+    {
+        return pos_ >= size_;
+    }
+
+private:
+    const uint8_t* data_;
+    size_t size_;
+    size_t pos_ = 0;
+};
+
+// Short options that are not used by any flag show up in the arguments as well. The digit makes
+// negative numbers flags.
+constexpr std::string_view shortOpts = "abcdxyz1";
+
+Spec readSpec(Input& in)
+{
+    Spec spec;
+    const auto settings = in.byte();
+    spec.errorOnExtraArgs = (settings & 1) == 0;
+    spec.defer = (settings & 2) != 0;
+
+    const auto numFlags = in.byte() % (maxFlags + 1);
+    std::string usedShortOpts;
+    for (size_t i = 0; i < numFlags; ++i) {
+        const auto b = in.byte();
+        FlagSpec flag;
+        flag.kind = static_cast<FlagKind>(b % 6);
+        flag.name = "f" + std::to_string(i);
+        const auto s = in.byte() % (shortOpts.size() + 1);
+        flag.shortOpt = s < shortOpts.size() ? shortOpts[s] : 0;
+        if (flag.shortOpt && usedShortOpts.find(flag.shortOpt) != std::string::npos) {
+            flag.shortOpt = 0;
+        }
+        usedShortOpts.push_back(flag.shortOpt);
+        flag.num = 0;
+        if (flag.kind == FlagKind::Value || flag.kind == FlagKind::Int) {
+            flag.num = 1;
+        } else if (flag.kind == FlagKind::List) {
+            flag.num = 1 + (b / 8) % 3;
+        }
+        flag.collect = flag.kind == FlagKind::List && (b & 0x80) == 0;
+        spec.flags.push_back(flag);
+    }
+
+    const auto numPositionals = in.byte() % (maxPositionals + 1);
+    for (size_t i = 0; i < numPositionals; ++i) {
+        spec.positionals.push_back(
+            { static_cast<PosKind>(in.byte() % 5), "p" + std::to_string(i) });
+    }
+    return spec;
+}
+
+std::string readWord(Input& in)
+{
+    const auto b = in.byte();
+    if (b % 4 == 0) {
+        return std::to_string(b / 4 % 8);
+    }
+    return "w" + std::to_string(b % 8);
+}
+
+std::string readArg(Input& in)
+{
+    const auto b = in.byte();
+    switch (b % 10) {
+    case 0:
+        return "--";
+    case 1:
+        return "--f" + std::to_string(in.byte() % (maxFlags + 1));
+    case 2:
+        return "--f" + std::to_string(in.byte() % (maxFlags + 1)) + "=" + readWord(in);
+    case 3: {
+        std::string arg = "-";
+        for (size_t i = 0, n = 1 + b / 10 % 4; i < n; ++i) {
+            arg.push_back(shortOpts[in.byte() % shortOpts.size()]);
+        }
+        return arg;
+    }
+    case 4:
+        return std::string("-") + shortOpts[in.byte() % shortOpts.size()] + readWord(in);
+    case 5: {
+        static const char* numbers[]
+            = { "-1", "-0.5", "-1e3", "-inf", "-nan", "-12", "-1x", "-.", "-", "" };
+        return numbers[in.byte() % std::size(numbers)];
+    }
+    case 8: {
+        std::string arg;
+        for (size_t i = 0, n = b / 10 % 8; i < n; ++i) {
+            arg.push_back(static_cast<char>(in.byte()));
+        }
+        return arg;
+    }
+    default:
+        return readWord(in);
+    }
+}
+
+// Every input needs its own parser, because the schema is built from this
+const Spec* currentSpec = nullptr;
+
+struct FuzzArgs : public clipp::ArgsBase {
+    bool bools[maxFlags] = {};
+    size_t counts[maxFlags] = {};
+    std::optional<std::string> values[maxFlags];
+    std::optional<int64_t> ints[maxFlags];
+    std::vector<std::string> lists[maxFlags];
+    std::string singles[maxPositionals];
+    std::optional<std::string> optionals[maxPositionals];
+    std::vector<std::string> manys[maxPositionals];
+
+    void args()
+    {
+        for (size_t i = 0; i < currentSpec->flags.size(); ++i) {
+            const auto& f = currentSpec->flags[i];
+            switch (f.kind) {
+            case FlagKind::Bool:
+                flag(bools[i], f.name, f.shortOpt);
+                break;
+            case FlagKind::Count:
+                flag(counts[i], f.name, f.shortOpt);
+                break;
+            case FlagKind::Value:
+                flag(values[i], f.name, f.shortOpt);
+                break;
+            case FlagKind::Int:
+                flag(ints[i], f.name, f.shortOpt);
+                break;
+            case FlagKind::List:
+                flag(lists[i], f.name, f.shortOpt).num(f.num).collect(f.collect);
+                break;
+            case FlagKind::Halt:
+                flag(bools[i], f.name, f.shortOpt).halt();
+                break;
+            }
+        }
+        for (size_t i = 0; i < currentSpec->positionals.size(); ++i) {
+            const auto& p = currentSpec->positionals[i];
+            switch (p.kind) {
+            case PosKind::Single:
+                positional(singles[i], p.name);
+                break;
+            case PosKind::Optional:
+                positional(optionals[i], p.name);
+                break;
+            case PosKind::Many:
+                positional(manys[i], p.name);
+                break;
+            case PosKind::ManyOptional:
+                positional(manys[i], p.name).optional();
+                break;
+            case PosKind::Halt:
+                positional(singles[i], p.name).halt();
+                break;
+            }
+        }
+    }
+};
+
+// The values of all flags and positionals as strings (bools and counts as numbers)
+struct Outcome {
+    bool ok = false;
+    clipp::Error::Code code = clipp::Error::Code::InvalidOption;
+    size_t argIndex = 0;
+    std::string name;
+    std::vector<std::vector<std::string>> flags;
+    std::vector<std::vector<std::string>> positionals;
+    std::vector<std::string> remaining;
+
+    bool operator==(const Outcome& other) const
+    {
+        if (ok != other.ok) {
+            return false;
+        }
+        if (!ok) {
+            return code == other.code && argIndex == other.argIndex && name == other.name;
+        }
+        return flags == other.flags && positionals == other.positionals
+            && remaining == other.remaining;
+    }
+};
+
+Outcome fromClipp(const Spec& spec, const clipp::Result<FuzzArgs>& res)
+{
+    Outcome out;
+    if (!res) {
+        out.code = res.error().code;
+        out.argIndex = res.error().argIndex;
+        out.name = res.error().name;
+        return out;
+    }
+    out.ok = true;
+    for (size_t i = 0; i < spec.flags.size(); ++i) {
+        auto& values = out.flags.emplace_back();
+        switch (spec.flags[i].kind) {
+        case FlagKind::Bool:
+        case FlagKind::Halt:
+            values.push_back(res->bools[i] ? "1" : "0");
+            break;
+        case FlagKind::Count:
+            values.push_back(std::to_string(res->counts[i]));
+            break;
+        case FlagKind::Value:
+            if (res->values[i]) {
+                values.push_back(*res->values[i]);
+            }
+            break;
+        case FlagKind::Int:
+            if (res->ints[i]) {
+                values.push_back(std::to_string(*res->ints[i]));
+            }
+            break;
+        case FlagKind::List:
+            values = res->lists[i];
+            break;
+        }
+    }
+    for (size_t i = 0; i < spec.positionals.size(); ++i) {
+        auto& values = out.positionals.emplace_back();
+        const auto kind = spec.positionals[i].kind;
+        if (kind == PosKind::Single || kind == PosKind::Halt) {
+            values.push_back(res->singles[i]);
+        } else if (kind == PosKind::Optional) {
+            if (res->optionals[i]) {
+                values.push_back(*res->optionals[i]);
+            }
+        } else {
+            values = res->manys[i];
+        }
+    }
+    out.remaining = res->remaining();
+    return out;
+}
+
+// Written down as directly as possible from reference.md: no tokenizer, no lookup tables and
+// its own number parsing. Values are strings until the end.
+class Reference {
+public:
+    Reference(const Spec& spec, const std::vector<std::string>& argv)
+        : spec_(spec)
+        , argv_(argv)
+        , flagValues_(spec.flags.size())
+        , counts_(spec.flags.size())
+        , positionalValues_(spec.positionals.size())
+    {
+        for (const auto& flag : spec.flags) {
+            hasDigitShortOpt_ = hasDigitShortOpt_ || (flag.shortOpt >= '0' && flag.shortOpt <= '9');
+        }
+    }
+
+    Outcome run()
+    {
+        classify();
+        size_t positionalsLeft = std::count(kinds_.begin(), kinds_.end(), Kind::Positional);
+        size_t positionalsRequired = 0;
+        for (const auto& pos : spec_.positionals) {
+            positionalsRequired += !pos.optional();
+        }
+
+        bool afterDelim = false;
+        size_t posIdx = 0;
+        for (i_ = 0; i_ < argv_.size(); ++i_) {
+            const auto& arg = argv_[i_];
+            if (kinds_[i_] == Kind::Separator) {
+                // Every "--" after the first one skips to the next positional
+                if (afterDelim && posIdx < spec_.positionals.size()) {
+                    positionalsRequired -= !spec_.positionals[posIdx].optional();
+                    posIdx++;
+                }
+                afterDelim = true;
+            } else if (kinds_[i_] == Kind::Flag) {
+                if (!flagArg(arg)) {
+                    return error_;
+                }
+            } else if (posIdx < spec_.positionals.size()) {
+                // Optional positionals get nothing if the rest is needed for the required ones
+                while (posIdx + 1 < spec_.positionals.size()
+                    && positionalsLeft <= positionalsRequired
+                    && spec_.positionals[posIdx].optional()) {
+                    posIdx++;
+                }
+                const auto& pos = spec_.positionals[posIdx];
+                positionalValues_[posIdx].push_back(arg);
+                // A positional with many values leaves enough for the required ones after it
+                const auto requiredAfter = positionalsRequired - !pos.optional();
+                if (pos.kind == PosKind::Halt) {
+                    halt(i_ + 1);
+                } else if (!pos.many() || positionalsLeft - 1 == requiredAfter) {
+                    posIdx++;
+                    positionalsRequired = requiredAfter;
+                }
+                positionalsLeft--;
+            } else if (spec_.errorOnExtraArgs) {
+                return fail(clipp::Error::Code::SuperfluousArgument, i_, "");
+            } else {
+                halt(i_);
+            }
+            if (halted_) {
+                break;
+            }
+        }
+
+        if (!halted_) {
+            for (size_t p = 0; p < spec_.positionals.size(); ++p) {
+                if (!spec_.positionals[p].optional() && positionalValues_[p].empty()) {
+                    return fail(clipp::Error::Code::MissingArgument, clipp::Error::npos,
+                        spec_.positionals[p].name);
+                }
+            }
+        }
+        // Deferred conversions are only done once all the arguments are fine
+        if (conversionError_) {
+            return *conversionError_;
+        }
+        return result();
+    }
+
+private:
+    enum class Kind { Flag, Value, Separator, Positional };
+
+    bool isNumber(std::string_view str) const
+    {
+        double v;
+        const auto res = std::from_chars(str.data(), str.data() + str.size(), v);
+        return res.ec == std::errc() && res.ptr == str.data() + str.size();
+    }
+
+    bool isFlag(const std::string& arg) const
+    {
+        return arg != "--" && arg.size() >= 2 && arg[0] == '-'
+            && (hasDigitShortOpt_ || !isNumber(arg));
+    }
+
+    const FlagSpec* findLong(std::string_view name) const
+    {
+        for (const auto& flag : spec_.flags) {
+            if (flag.name == name) {
+                return &flag;
+            }
+        }
+        return nullptr;
+    }
+
+    const FlagSpec* findShort(char c) const
+    {
+        for (const auto& flag : spec_.flags) {
+            if (flag.shortOpt && flag.shortOpt == c) {
+                return &flag;
+            }
+        }
+        return nullptr;
+    }
+
+    size_t index(const FlagSpec* flag) const
+    {
+        return static_cast<size_t>(flag - spec_.flags.data());
+    }
+
+    // The number of arguments after a flag that are its values (at most, fewer is an error later)
+    size_t valuesOf(const std::string& arg) const
+    {
+        const FlagSpec* flag = nullptr;
+        if (arg[1] == '-') {
+            if (arg.find('=') != std::string::npos) {
+                return 0;
+            }
+            flag = findLong(std::string_view(arg).substr(2));
+        } else {
+            const auto first = findShort(arg[1]);
+            if (first && first->num == 1 && arg.size() > 2) {
+                return 0;
+            }
+            flag = findShort(arg.back());
+        }
+        return flag ? flag->num : 0;
+    }
+
+    void classify()
+    {
+        bool afterDelim = false;
+        size_t valuesLeft = 0;
+        for (const auto& arg : argv_) {
+            if (!afterDelim && isFlag(arg)) {
+                kinds_.push_back(Kind::Flag);
+                valuesLeft = valuesOf(arg);
+            } else if (valuesLeft > 0) {
+                kinds_.push_back(Kind::Value);
+                valuesLeft--;
+            } else if (arg == "--") {
+                kinds_.push_back(Kind::Separator);
+                afterDelim = true;
+            } else {
+                kinds_.push_back(Kind::Positional);
+            }
+        }
+    }
+
+    bool flagArg(const std::string& arg)
+    {
+        const std::string_view view = arg;
+        if (arg[1] == '-') {
+            const auto eq = arg.find('=');
+            if (eq == std::string::npos) {
+                const auto flag = findLong(view.substr(2));
+                if (!flag) {
+                    return fail(clipp::Error::Code::InvalidOption, i_, arg), false;
+                }
+                return take(*flag, arg, std::nullopt);
+            }
+            const auto name = arg.substr(0, eq);
+            const auto flag = findLong(view.substr(2, eq - 2));
+            if (!flag) {
+                return fail(clipp::Error::Code::InvalidOption, i_, name), false;
+            }
+            if (flag->num != 1) {
+                return fail(clipp::Error::Code::EqualsSyntax, i_, name), false;
+            }
+            return take(*flag, name, arg.substr(eq + 1));
+        }
+
+        const auto first = findShort(arg[1]);
+        if (!first) {
+            return fail(clipp::Error::Code::InvalidOption, i_, arg.substr(1, 1)), false;
+        }
+        if (first->num == 1 && arg.size() > 2) {
+            return take(*first, arg.substr(1, 1), arg.substr(2));
+        }
+        for (size_t c = 1; c + 1 < arg.size(); ++c) {
+            const auto flag = findShort(arg[c]);
+            if (!flag) {
+                return fail(clipp::Error::Code::InvalidOption, i_, arg.substr(c, 1)), false;
+            }
+            if (flag->num != 0) {
+                return fail(clipp::Error::Code::MissingValue, i_, arg.substr(c, 1)), false;
+            }
+            set(*flag);
+        }
+        const auto last = findShort(arg.back());
+        if (!last) {
+            return fail(clipp::Error::Code::InvalidOption, i_, arg.substr(arg.size() - 1)), false;
+        }
+        return take(*last, arg.substr(arg.size() - 1), std::nullopt);
+    }
+
+    // A flag without values
+    void set(const FlagSpec& flag)
+    {
+        counts_[index(&flag)]++;
+        if (flag.kind == FlagKind::Halt) {
+            halt(i_ + 1);
+        }
+    }
+
+    bool take(const FlagSpec& flag, const std::string& name, std::optional<std::string> inlineValue)
+    {
+        if (flag.num == 0) {
+            set(flag);
+            return true;
+        }
+
+        size_t numValues = inlineValue ? 1 : 0;
+        while (!inlineValue && i_ + 1 + numValues < argv_.size()
+            && kinds_[i_ + 1 + numValues] == Kind::Value) {
+            numValues++;
+        }
+        if (numValues < flag.num) {
+            return fail(clipp::Error::Code::MissingValue, i_, name), false;
+        }
+
+        auto& values = flagValues_[index(&flag)];
+        if (!flag.collect) {
+            values.clear();
+        }
+        for (size_t v = 0; v < numValues; ++v) {
+            const auto valIdx = inlineValue ? i_ : i_ + 1 + v;
+            const auto& value = inlineValue ? *inlineValue : argv_[valIdx];
+            if (flag.kind == FlagKind::Int && !parseInt(value)) {
+                const auto err = makeError(clipp::Error::Code::InvalidValue, valIdx, name);
+                if (!spec_.defer) {
+                    error_ = err;
+                    return false;
+                }
+                if (!conversionError_) {
+                    conversionError_ = err;
+                }
+            }
+            values.push_back(flag.kind == FlagKind::Int && parseInt(value)
+                    ? std::to_string(*parseInt(value))
+                    : value);
+        }
+        if (!inlineValue) {
+            i_ += numValues;
+        }
+        if (flag.kind == FlagKind::Halt) {
+            halt(i_ + 1);
+        }
+        return true;
+    }
+
+    static std::optional<int64_t> parseInt(const std::string& str)
+    {
+        const bool negative = !str.empty() && str[0] == '-';
+        if (str.size() == negative) {
+            return std::nullopt;
+        }
+        // Accumulated negatively, so INT64_MIN fits
+        int64_t value = 0;
+        for (size_t c = negative; c < str.size(); ++c) {
+            if (str[c] < '0' || str[c] > '9') {
+                return std::nullopt;
+            }
+            const auto digit = str[c] - '0';
+            if (value < (std::numeric_limits<int64_t>::min() + digit) / 10) {
+                return std::nullopt;
+            }
+            value = value * 10 - digit;
+        }
+        if (!negative) {
+            if (value == std::numeric_limits<int64_t>::min()) {
+                return std::nullopt;
+            }
+            value = -value;
+        }
+        return value;
+    }
+
+    void halt(size_t from)
+    {
+        remaining_.assign(argv_.begin() + static_cast<std::ptrdiff_t>(from), argv_.end());
+        halted_ = true;
+    }
+
+    static Outcome makeError(clipp::Error::Code code, size_t argIndex, std::string name)
+    {
+        Outcome out;
+        out.code = code;
+        out.argIndex = argIndex;
+        out.name = std::move(name);
+        return out;
+    }
+
+    Outcome fail(clipp::Error::Code code, size_t argIndex, std::string name)
+    {
+        error_ = makeError(code, argIndex, std::move(name));
+        return error_;
+    }
+
+    Outcome result() const
+    {
+        Outcome out;
+        out.ok = true;
+        for (size_t f = 0; f < spec_.flags.size(); ++f) {
+            const auto kind = spec_.flags[f].kind;
+            if (kind == FlagKind::Bool || kind == FlagKind::Halt) {
+                out.flags.push_back({ counts_[f] > 0 ? "1" : "0" });
+            } else if (kind == FlagKind::Count) {
+                out.flags.push_back({ std::to_string(counts_[f]) });
+            } else if (kind == FlagKind::List || flagValues_[f].empty()) {
+                out.flags.push_back(flagValues_[f]);
+            } else {
+                out.flags.push_back({ flagValues_[f].back() });
+            }
+        }
+        for (size_t p = 0; p < spec_.positionals.size(); ++p) {
+            const auto kind = spec_.positionals[p].kind;
+            const auto& values = positionalValues_[p];
+            if ((kind == PosKind::Single || kind == PosKind::Halt) && values.empty()) {
+                out.positionals.push_back({ "" });
+            } else {
+                out.positionals.push_back(values);
+            }
+        }
+        out.remaining = remaining_;
+        return out;
+    }
+
+    const Spec& spec_;
+    const std::vector<std::string>& argv_;
+    bool hasDigitShortOpt_ = false;
+    std::vector<Kind> kinds_;
+    size_t i_ = 0;
+    std::vector<std::vector<std::string>> flagValues_;
+    std::vector<size_t> counts_;
+    std::vector<std::vector<std::string>> positionalValues_;
+    std::vector<std::string> remaining_;
+    bool halted_ = false;
+    Outcome error_;
+    std::optional<Outcome> conversionError_;
+};
+
+struct NullOutput : clipp::OutputBase {
+    void out(std::string_view) override { }
+    void err(std::string_view) override { }
+};
+
+clipp::Parser makeParser(const Spec& spec)
+{
+    auto parser = clipp::Parser("fuzz");
+    parser.addHelp(false);
+    parser.exitOnError(false);
+    parser.errorOnExtraArgs(spec.errorOnExtraArgs);
+    parser.deferConversion(spec.defer);
+    parser.output(std::make_shared<NullOutput>());
+    return parser;
+}
+
+void print(const Outcome& out)
+{
+    if (!out.ok) {
+        std::fprintf(stderr, "  error %d at %zu, name '%s'\n", static_cast<int>(out.code),
+            out.argIndex, out.name.c_str());
+        return;
+    }
+    auto printValues = [](const char* what, size_t i, const std::vector<std::string>& values) {
+        std::fprintf(stderr, "  %s %zu:", what, i);
+        for (const auto& value : values) {
+            std::fprintf(stderr, " '%s'", value.c_str());
+        }
+        std::fprintf(stderr, "\n");
+    };
+    for (size_t i = 0; i < out.flags.size(); ++i) {
+        printValues("flag", i, out.flags[i]);
+    }
+    for (size_t i = 0; i < out.positionals.size(); ++i) {
+        printValues("positional", i, out.positionals[i]);
+    }
+    printValues("remaining", 0, out.remaining);
+}
+
+[[noreturn]] void mismatch(const Spec& spec, const std::vector<std::string>& argv,
+    const Outcome& actual, const Outcome& expected)
+{
+    std::fprintf(stderr, "clipp and the reference disagree\nflags:");
+    for (const auto& flag : spec.flags) {
+        std::fprintf(stderr, " %s(kind %d, -%c, num %zu%s)", flag.name.c_str(),
+            static_cast<int>(flag.kind), flag.shortOpt ? flag.shortOpt : '_', flag.num,
+            flag.collect ? ", collect" : "");
+    }
+    std::fprintf(stderr, "\npositionals:");
+    for (const auto& pos : spec.positionals) {
+        std::fprintf(stderr, " %s(kind %d)", pos.name.c_str(), static_cast<int>(pos.kind));
+    }
+    std::fprintf(stderr, "\nerrorOnExtraArgs: %d, defer: %d\nargv:", spec.errorOnExtraArgs,
+        spec.defer);
+    for (const auto& arg : argv) {
+        std::fprintf(stderr, " '%s'", arg.c_str());
+    }
+    std::fprintf(stderr, "\nclipp:\n");
+    print(actual);
+    std::fprintf(stderr, "reference:\n");
+    print(expected);
+    std::abort();
+}
+
+void check(const Spec& spec, const std::vector<std::string>& argv)
+{
+    currentSpec = &spec;
+    auto parser = makeParser(spec);
+    const auto res = parser.tryParse<FuzzArgs>(argv);
+    const auto actual = fromClipp(spec, res);
+    const auto expected = Reference(spec, argv).run();
+    if (!(actual == expected)) {
+        mismatch(spec, argv, actual, expected);
+    }
+    // parse reports the error instead, but has to agree (the schema is cached by now)
+    if (parser.parse<FuzzArgs>(argv).has_value() != actual.ok) {
+        mismatch(spec, argv, actual, expected);
+    }
+}
+
+void fuzzOne(const uint8_t* data, size_t size)
+{
+    Input in(data, size);
+    const auto spec = readSpec(in);
+    std::vector<std::string> argv;
+    while (!in.empty() && argv.size() < maxArgs) {
+        argv.push_back(readArg(in));
+    }
+    check(spec, argv);
+}
+
+#ifdef CLIPP_LIBFUZZER
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    fuzzOne(data, size);
+    return 0;
+}
+#else
+using Clock = std::chrono::steady_clock;
+
+long peakMemoryKiB()
+{
+#ifdef HAS_RUSAGE
+    struct rusage usage;
+    if (::getrusage(RUSAGE_SELF, &usage) == 0) {
+        return usage.ru_maxrss; // KiB on Linux, bytes on macOS
+    }
+#endif
+    return -1;
+}
+
+void runRandom(size_t runs)
+{
+    std::mt19937 rng(30);
+    std::vector<uint8_t> data;
+    const auto start = Clock::now();
+    for (size_t i = 0; i < runs; ++i) {
+        data.resize(rng() % 256);
+        for (auto& b : data) {
+            b = static_cast<uint8_t>(rng());
+        }
+        fuzzOne(data.data(), data.size());
+    }
+    const auto seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::printf("%-24s %8zu execs %12.0f exec/s\n", "random inputs", runs, runs / seconds);
+}
+
+struct Pathological {
+    const char* name;
+    Spec spec;
+    std::vector<std::string> (*argv)(size_t n);
+};
+
+FlagSpec flagSpec(FlagKind kind, char shortOpt, size_t num = 0, bool collect = false)
+{
+    return { kind, std::string("f") + shortOpt, shortOpt, num, collect };
+}
+
+std::vector<Pathological> pathological()
+{
+    Spec optionalPositionals;
+    optionalPositionals.positionals
+        = { { PosKind::ManyOptional, "p0" }, { PosKind::Optional, "p1" } };
+
+    Spec manyPositionals;
+    manyPositionals.positionals = { { PosKind::Many, "p0" }, { PosKind::ManyOptional, "p1" },
+        { PosKind::Single, "p2" } };
+
+    Spec shorts;
+    shorts.flags = { flagSpec(FlagKind::Count, 'a'), flagSpec(FlagKind::Bool, 'b'),
+        flagSpec(FlagKind::Count, 'c') };
+
+    Spec lists;
+    lists.flags = { flagSpec(FlagKind::List, 'a', 3, true), flagSpec(FlagKind::List, 'b', 2),
+        flagSpec(FlagKind::Value, 'c', 1) };
+    lists.positionals = { { PosKind::ManyOptional, "p0" } };
+
+    Spec halting;
+    halting.flags = { flagSpec(FlagKind::Halt, 'a') };
+    halting.positionals = { { PosKind::ManyOptional, "p0" } };
+
+    return {
+        { "separators", optionalPositionals,
+            [](size_t n) { return std::vector<std::string>(n, "--"); } },
+        { "positionals", manyPositionals,
+            [](size_t n) { return std::vector<std::string>(n, "w"); } },
+        { "stacked shorts", shorts,
+            [](size_t n) {
+                std::string arg = "-";
+                for (size_t i = 0; i < n; ++i) {
+                    arg.push_back("abc"[i % 3]);
+                }
+                return std::vector<std::string> { arg, "-bbbbbbbba" };
+            } },
+        { "list values", lists,
+            [](size_t n) {
+                std::vector<std::string> argv;
+                for (size_t i = 0; i + 6 < n; i += 7) {
+                    argv.insert(argv.end(), { "--fa", "1", "-2", "3", "-b", "4", "-5" });
+                }
+                return argv;
+            } },
+        { "equals values", lists,
+            [](size_t n) {
+                return std::vector<std::string>(n, "--fc=" + std::string(64, 'v'));
+            } },
+        { "negative numbers", lists,
+            [](size_t n) {
+                std::vector<std::string> argv;
+                for (size_t i = 0; i < n; ++i) {
+                    argv.push_back("-" + std::to_string(i) + ".5");
+                }
+                return argv;
+            } },
+        { "late halt", halting,
+            [](size_t n) {
+                std::vector<std::string> argv(n, "w");
+                argv.push_back("-a");
+                argv.insert(argv.end(), n, "r");
+                return argv;
+            } },
+    };
+}
+
+// Returns the time per argument (or character for a single huge argument)
+double timePerArg(
+    const Pathological& p, clipp::Parser& parser, const std::vector<std::string>& argv)
+{
+    size_t size = 0;
+    for (const auto& arg : argv) {
+        size += std::max<size_t>(arg.size() / 16, 1);
+    }
+    size_t iterations = 0;
+    const auto start = Clock::now();
+    auto now = start;
+    while (now - start < std::chrono::milliseconds(50)) {
+        if (!parser.tryParse<FuzzArgs>(argv)) {
+            std::fprintf(stderr, "%s: parsing failed\n", p.name);
+            std::exit(1);
+        }
+        iterations++;
+        now = Clock::now();
+    }
+    return std::chrono::duration<double, std::nano>(now - start).count() / iterations / size;
+}
+
+// The time per argument at 16 times the size may not be more than 4 times as high (to leave
+// room for cache effects), otherwise something is quadratic
+int runPerf()
+{
+    runRandom(20'000);
+
+    int status = 0;
+    constexpr size_t small = 1'000;
+    constexpr size_t large = small * 16;
+    for (const auto& p : pathological()) {
+        currentSpec = &p.spec;
+        const auto smallArgv = p.argv(small);
+        const auto largeArgv = p.argv(large);
+        check(p.spec, smallArgv);
+        auto parser = makeParser(p.spec);
+        const auto smallTime = timePerArg(p, parser, smallArgv);
+        const auto largeTime = timePerArg(p, parser, largeArgv);
+        const auto ratio = largeTime / smallTime;
+        std::printf("%-24s %8.1f ns/arg at %zu %8.1f ns/arg at %zu %6.2fx%s\n", p.name, smallTime,
+            small, largeTime, large, ratio, ratio > 4 ? " SUPERLINEAR" : "");
+        if (ratio > 4) {
+            status = 1;
+        }
+    }
+    std::printf("peak memory: %ld KiB\n", peakMemoryKiB());
+    return status;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && std::string_view(argv[1]) == "--perf") {
+        return runPerf();
+    }
+    if (argc > 2 && std::string_view(argv[1]) == "--runs") {
+        runRandom(std::strtoull(argv[2], nullptr, 10));
+        return 0;
+    }
+    for (int i = 1; i < argc; ++i) {
+        std::ifstream file(argv[i], std::ios::binary);
+        const std::vector<uint8_t> data(
+            (std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        fuzzOne(data.data(), data.size());
+    }
+    return 0;
+}
+#endif
@@ -4,6 +4,41 @@
 // #define CLIPP_DEBUG
 #include "clipp.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <random>
+#include <thread>
+
+// GCC doesn't understand that free is fine for memory from the replaced operator new
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+// Counts every allocation, so tests can check that something doesn't allocate
+std::atomic<size_t> allocations { 0 };
+
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (auto ptr = std::malloc(size > 0 ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
 struct StringOutput : clipp::OutputBase {
     void out(std::string_view str)
     {
@@ -225,6 +260,94 @@ TEST_CASE(R"({ "--fnum", "-42.542", "pos" } (Args))")
     CHECK(std::fabs(*args->fnum - -42.542) < 1e-8);
 }
 
+struct NumericArgs : public clipp::ArgsBase {
+    std::optional<uint32_t> workers;
+    std::optional<int8_t> nice;
+    std::optional<float> ratio;
+    std::optional<clipp::ByteSize> buffer;
+    std::optional<std::chrono::milliseconds> timeout;
+    std::vector<size_t> ports;
+
+    void args()
+    {
+        flag(workers, "workers");
+        flag(nice, "nice");
+        flag(ratio, "ratio");
+        flag(buffer, "buffer");
+        flag(timeout, "timeout");
+        positional(ports, "ports").optional();
+    }
+};
+
+TEST_CASE(R"({ "--workers", "8", "--nice", "-20", ... } (NumericArgs))")
+{
+    const auto args = parse<NumericArgs>({ "--workers", "8", "--nice", "-20", "--ratio", "0.5",
+        "--buffer", "64M", "--timeout", "1m30s", "80", "443" });
+    REQUIRE(args);
+    CHECK(args->workers.value() == 8);
+    CHECK(args->nice.value() == -20);
+    CHECK(args->ratio.value() == 0.5f);
+    CHECK(args->buffer.value().bytes == 64 * 1024 * 1024);
+    CHECK(args->timeout.value() == std::chrono::seconds(90));
+    CHECK(args->ports == std::vector<size_t> { 80, 443 });
+
+    CHECK(!parse<NumericArgs>({ "--workers", "-1" }));
+    CHECK(output->error.find("(non-negative integer)") != std::string::npos);
+    CHECK(!parse<NumericArgs>({ "--workers", "4294967296" }));
+    CHECK(parse<NumericArgs>({ "--workers", "4294967295" }).has_value());
+    CHECK(!parse<NumericArgs>({ "--nice", "128" }));
+    CHECK(!parse<NumericArgs>({ "--timeout", "250" }));
+    CHECK(output->error.find("(duration)") != std::string::npos);
+}
+
+TEST_CASE("Value<ByteSize>")
+{
+    using clipp::ByteSize;
+    const auto parse = [](std::string_view str) { return clipp::Value<ByteSize>::parse(str); };
+    CHECK(parse("0") == ByteSize { 0 });
+    CHECK(parse("4096") == ByteSize { 4096 });
+    CHECK(parse("12b") == ByteSize { 12 });
+    CHECK(parse("4k") == ByteSize { 4096 });
+    CHECK(parse("4KiB") == ByteSize { 4096 });
+    CHECK(parse("4KB") == ByteSize { 4000 });
+    CHECK(parse("1.5G") == ByteSize { 1536 * 1024 * 1024ull });
+    CHECK(parse("2T") == ByteSize { 2ull << 40 });
+    CHECK(parse("15E") == ByteSize { 15ull << 60 });
+    CHECK(parse("16E") == std::nullopt);
+    CHECK(parse("0.5B") == std::nullopt);
+    CHECK(parse("-1K") == std::nullopt);
+    CHECK(parse("1X") == std::nullopt);
+    CHECK(parse("1KiBs") == std::nullopt);
+    CHECK(parse("K") == std::nullopt);
+    CHECK(parse("") == std::nullopt);
+}
+
+TEST_CASE("Value<std::chrono::duration>")
+{
+    using namespace std::chrono;
+    using Ms = clipp::Value<milliseconds>;
+    CHECK(Ms::parse("250ms") == milliseconds(250));
+    CHECK(Ms::parse("1.5s") == milliseconds(1500));
+    CHECK(Ms::parse("1h30m") == minutes(90));
+    CHECK(Ms::parse("2min") == minutes(2));
+    CHECK(Ms::parse("1d") == hours(24));
+    CHECK(Ms::parse("0.1s") == milliseconds(100));
+    CHECK(Ms::parse("-3s") == seconds(-3));
+    CHECK(Ms::parse("1500us") == std::nullopt);
+    CHECK(Ms::parse("1500") == std::nullopt);
+    CHECK(Ms::parse("1.5") == std::nullopt);
+    CHECK(Ms::parse("1y") == std::nullopt);
+    CHECK(Ms::parse("s") == std::nullopt);
+    CHECK(Ms::parse("-") == std::nullopt);
+    CHECK(clipp::Value<seconds>::parse("1500ms") == std::nullopt);
+    CHECK(clipp::Value<nanoseconds>::parse("3us") == nanoseconds(3000));
+    CHECK(clipp::Value<duration<uint32_t>>::parse("-1s") == std::nullopt);
+    CHECK(clipp::Value<duration<uint8_t>>::parse("256s") == std::nullopt);
+    const auto fractional = clipp::Value<duration<double>>::parse("1500us");
+    REQUIRE(fractional);
+    CHECK(std::fabs(fractional->count() - 0.0015) < 1e-12);
+}
+
 TEST_CASE(R"({ "--number=5", "pos" } (Args))")
 {
     const auto args = parse<Args>({ "--number=5", "pos" });
@@ -274,6 +397,104 @@ TEST_CASE(R"({ "-obaz", "pos" } (Args))")
     CHECK(args->opt.value() == "baz");
 }
 
+TEST_CASE(R"({ "-fvvv", "--opt", "optval", "pos" } (Args, string_view))")
+{
+    auto parser = getParser();
+    const auto argv = std::vector<std::string_view> { "-fvvv", "--opt", "optval", "pos" };
+    const auto args = parser.parse<Args>(argv);
+    REQUIRE(args);
+    CHECK(args->foo);
+    CHECK(args->opt.value() == "optval");
+    CHECK(args->verbose == 3);
+    CHECK(args->pos == "pos");
+}
+
+TEST_CASE(R"({ "test", "--number=5", "pos" } (Args, argc/argv))")
+{
+    auto parser = getParser();
+    char arg0[] = "test", arg1[] = "--number=5", arg2[] = "pos";
+    char* argv[] = { arg0, arg1, arg2, nullptr };
+    const auto args = parser.parse<Args>(3, argv);
+    REQUIRE(args);
+    CHECK(args->number.value() == 5);
+    CHECK(args->pos == "pos");
+}
+
+TEST_CASE(R"({ "--number", "x", "pos" } (Args, tryParse))")
+{
+    auto parser = getParser();
+    const auto argv = std::vector<std::string> { "--number", "x", "pos" };
+    const auto res = parser.tryParse<Args>(argv);
+    REQUIRE(!res);
+    CHECK(res.error().code == clipp::Error::Code::InvalidValue);
+    CHECK(res.error().argIndex == 1);
+    REQUIRE(res.error().arg);
+    CHECK(res.error().arg->name() == "number");
+    CHECK(res.error().message() == "Invalid value 'x' for option '--number' (integer)");
+    // Nothing is reported
+    CHECK(output->error.empty());
+    CHECK(exitStatus == 0);
+}
+
+TEST_CASE(R"({ "-fvvv" } (Args, tryParse))")
+{
+    auto parser = getParser();
+    const auto res = parser.tryParse<Args>(std::vector<std::string> { "-fvvv" });
+    REQUIRE(!res);
+    CHECK(res.error().code == clipp::Error::Code::MissingArgument);
+    CHECK(res.error().argIndex == clipp::Error::npos);
+    CHECK(res.error().message() == "Missing argument 'pos'");
+    CHECK(contains(res->usage("test"), "pos"));
+
+    const auto ok = parser.tryParse<Args>(std::vector<std::string> { "-fvvv", "pos" });
+    REQUIRE(ok);
+    CHECK(ok->verbose == 3);
+}
+
+void writeFile(const char* path, std::string_view contents)
+{
+    auto f = std::fopen(path, "wb");
+    REQUIRE(f);
+    std::fwrite(contents.data(), 1, contents.size(), f);
+    std::fclose(f);
+}
+
+TEST_CASE(R"({ "-f", "@test_outer.rsp" } (Args, response files))")
+{
+    writeFile("test_outer.rsp", "--opt 'opt val'\n@test_inner.rsp\n");
+    writeFile("test_inner.rsp", "  -vv\t\"pos arg\"  ");
+    auto parser = getParser();
+    parser.responseFiles(true);
+    const auto args = parser.parse<Args>(std::vector<std::string> { "-f", "@test_outer.rsp" });
+    REQUIRE(args);
+    CHECK(args->foo);
+    CHECK(args->opt.value() == "opt val");
+    CHECK(args->verbose == 2);
+    CHECK(args->pos == "pos arg");
+    std::remove("test_outer.rsp");
+    std::remove("test_inner.rsp");
+}
+
+TEST_CASE(R"({ "@test_recursive.rsp" } (Args, response files))")
+{
+    writeFile("test_recursive.rsp", "-v @test_recursive.rsp");
+    auto parser = getParser();
+    parser.responseFiles(true);
+    CHECK(!parser.parse<Args>(std::vector<std::string> { "@test_recursive.rsp" }).has_value());
+    CHECK(contains(output->error, "Response file 'test_recursive.rsp' is nested too deeply"));
+    std::remove("test_recursive.rsp");
+
+    CHECK(!parser.parse<Args>(std::vector<std::string> { "@test_missing.rsp" }).has_value());
+    CHECK(contains(output->error, "Could not read response file 'test_missing.rsp'"));
+}
+
+TEST_CASE(R"({ "@test.rsp" } (Args, response files disabled))")
+{
+    const auto args = parse<Args>({ "@test.rsp" });
+    REQUIRE(args);
+    CHECK(args->pos == "@test.rsp");
+}
+
 TEST_CASE(R"({ "--version" } (Args))")
 {
     const auto args = parse<Args>({ "--version" });
@@ -368,6 +589,59 @@ TEST_CASE(R"({ "c" } (CustomType))")
     CHECK(args->val == MyEnum::C);
 }
 
+struct MappedChoices : public clipp::ArgsBase {
+    std::optional<MyEnum> flagVal;
+    std::vector<MyEnum> posVals;
+
+    void args()
+    {
+        // "x" can only be parsed through the mapping
+        flag(flagVal, "val", 'v').choices({ { "x", MyEnum::B }, { "c", MyEnum::C } });
+        positional(posVals, "pos")
+            .choices({ { "a", MyEnum::A }, { "b", MyEnum::B }, { "x", MyEnum::C } })
+            .optional();
+    }
+};
+
+TEST_CASE(R"({ "-v", "x", "b", "x", "a" } (MappedChoices))")
+{
+    const auto args = parse<MappedChoices>({ "-v", "x", "b", "x", "a" });
+    REQUIRE(args);
+    CHECK(args->flagVal == MyEnum::B);
+    CHECK(args->posVals == std::vector<MyEnum> { MyEnum::B, MyEnum::C, MyEnum::A });
+}
+
+TEST_CASE(R"({ "--val", "a" } (MappedChoices))")
+{
+    const auto args = parse<MappedChoices>({ "--val", "a" });
+    CHECK(!args);
+    CHECK(contains(output->error, "Invalid value 'a' for option '--val'. Possible values: x, c"));
+}
+
+struct ManyChoices : public clipp::ArgsBase {
+    std::vector<std::string> vals;
+
+    void args()
+    {
+        std::vector<std::string> choices;
+        for (size_t i = 0; i < 300; ++i) {
+            choices.push_back("choice" + std::to_string(i));
+        }
+        positional(vals, "vals").choices(choices);
+    }
+};
+
+TEST_CASE(R"({ "choice0", "choice299", "choice300" } (ManyChoices))")
+{
+    auto args = parse<ManyChoices>({ "choice0", "choice299" });
+    REQUIRE(args);
+    CHECK(args->vals == std::vector<std::string> { "choice0", "choice299" });
+
+    args = parse<ManyChoices>({ "choice0", "choice300" });
+    CHECK(!args);
+    CHECK(contains(output->error, "Invalid value 'choice300' for argument 'vals'"));
+}
+
 struct StdOptParam : public clipp::ArgsBase {
     int64_t x = 1000;
     std::optional<int64_t> y;
@@ -645,12 +919,60 @@ TEST_CASE(R"({ "1", "2", "3", "4", "5" } (NonGreedyPositionalsArgs))")
     CHECK(args->c[0] == "5");
 }
 
+// Optional positionals only get what the required ones don't need
+struct MixedPositionalsArgs : public clipp::ArgsBase {
+    std::optional<std::string> a;
+    std::vector<std::string> b;
+    std::vector<std::string> c;
+    std::string d;
+
+    void args()
+    {
+        positional(a, "a");
+        positional(b, "b");
+        positional(c, "c").optional();
+        positional(d, "d");
+    }
+};
+
+TEST_CASE(R"({ "1", "2" } (MixedPositionalsArgs))")
+{
+    const auto args = parse<MixedPositionalsArgs>({ "1", "2" });
+    REQUIRE(args);
+    CHECK(!args->a);
+    CHECK(args->b == std::vector<std::string> { "1" });
+    CHECK(args->c.empty());
+    CHECK(args->d == "2");
+}
+
+TEST_CASE(R"({ "1", "2", "3", "4" } (MixedPositionalsArgs))")
+{
+    const auto args = parse<MixedPositionalsArgs>({ "1", "2", "3", "4" });
+    REQUIRE(args);
+    CHECK(args->a.value() == "1");
+    CHECK(args->b == std::vector<std::string> { "2", "3" });
+    CHECK(args->c.empty());
+    CHECK(args->d == "4");
+}
+
+TEST_CASE(R"({ "1", "--", "2", "--", "3", "4" } (MixedPositionalsArgs))")
+{
+    const auto args = parse<MixedPositionalsArgs>({ "1", "--", "2", "--", "3", "4" });
+    REQUIRE(args);
+    CHECK(args->a.value() == "1");
+    CHECK(args->b == std::vector<std::string> { "2" });
+    CHECK(args->c == std::vector<std::string> { "3" });
+    CHECK(args->d == "4");
+}
+
 struct CpStyleArgs : public clipp::ArgsBase {
     std::vector<std::string> sources;
     std::string destination;
+    std::optional<std::string> suffix;
 
     void args()
     {
+        flag(suffix, "suffix", 'S');
         positional(sources, "source");
         positional(destination, "destination");
     }
@@ -666,6 +988,60 @@ TEST_CASE(R"({ "src1", "src2", "dst" } (CpStyleArgs))")
     CHECK(args->destination == "dst");
 }
 
+TEST_CASE(R"({ "--suffix", "~", "src1", "src2", "dst" } (CpStyleArgs))")
+{
+    // Flag values must not be counted as positionals
+    const auto args = parse<CpStyleArgs>({ "--suffix", "~", "src1", "src2", "dst" });
+    REQUIRE(args);
+    REQUIRE(args->suffix.has_value());
+    CHECK(*args->suffix == "~");
+    REQUIRE(args->sources.size() == 2);
+    CHECK(args->sources[0] == "src1");
+    CHECK(args->sources[1] == "src2");
+    CHECK(args->destination == "dst");
+}
+
+TEST_CASE(R"({ "src1", "-S", "--", "dst" } (CpStyleArgs))")
+{
+    const auto args = parse<CpStyleArgs>({ "src1", "-S", "--", "dst" });
+    REQUIRE(args);
+    REQUIRE(args->suffix.has_value());
+    CHECK(*args->suffix == "--");
+    REQUIRE(args->sources.size() == 1);
+    CHECK(args->sources[0] == "src1");
+    CHECK(args->destination == "dst");
+}
+
+struct StreamingArgs : public clipp::ArgsBase {
+    std::vector<int64_t> seen;
+    std::function<void(int64_t)> numbers = [this](int64_t num) { seen.push_back(num); };
+    std::string destination;
+
+    void args()
+    {
+        positional(numbers, "numbers");
+        positional(destination, "destination");
+    }
+};
+
+TEST_CASE(R"({ "1", "2", "3", "dst" } (StreamingArgs))")
+{
+    const auto args = parse<StreamingArgs>({ "1", "2", "3", "dst" });
+    REQUIRE(args);
+    REQUIRE(args->seen.size() == 3);
+    CHECK(args->seen[0] == 1);
+    CHECK(args->seen[1] == 2);
+    CHECK(args->seen[2] == 3);
+    CHECK(args->destination == "dst");
+}
+
+TEST_CASE(R"({ "1", "x", "dst" } (StreamingArgs))")
+{
+    const auto args = parse<StreamingArgs>({ "1", "x", "dst" });
+    CHECK(!args.has_value());
+    CHECK(contains(output->error, "Invalid value 'x' for argument 'numbers' (integer)"));
+}
+
 struct SshArgs : public clipp::ArgsBase {
     std::optional<int64_t> port;
     std::string host;
@@ -699,3 +1075,1445 @@ TEST_CASE(R"({ "-p", "21", "myserver", "rm", "-rf", "/" } (SshArgs))")
     CHECK(!args);
     CHECK(contains(output->error, "Superfluous"));
 }
+
+TEST_CASE(R"({ "myserver", "ls", "-l" } (SshArgs, remainingView))")
+{
+    auto parser = getParser();
+    parser.errorOnExtraArgs(false);
+    const char* argv[] = { "myserver", "ls", "-l" };
+    const auto args = parser.parse<SshArgs>(clipp::ArgvView(argv, 3));
+    REQUIRE(args);
+    CHECK(args->host == "myserver");
+    REQUIRE(args->remainingView().size() == 2);
+    // Not copied
+    CHECK(args->remainingView()[0].data() == argv[1]);
+    CHECK(args->remainingView()[1] == "-l");
+    REQUIRE(args->remaining().size() == 2);
+    CHECK(args->remaining()[1] == "-l");
+}
+
+TEST_CASE(R"({ "myserver", "ls", "-l" } (SshArgs, remaining after parseInto))")
+{
+    auto parser = getParser();
+    parser.errorOnExtraArgs(false);
+    SshArgs args;
+    const char* first[] = { "myserver", "ls", "-l" };
+    REQUIRE(parser.parseInto(args, clipp::ArgvView(first, 3)));
+    REQUIRE(args.remaining().size() == 2);
+    // Copied on the first call
+    CHECK(args.remaining()[0].data() != first[1]);
+
+    // The copy is made again for the new arguments
+    const char* second[] = { "otherserver", "df" };
+    REQUIRE(parser.parseInto(args, clipp::ArgvView(second, 2)));
+    REQUIRE(args.remaining().size() == 1);
+    CHECK(args.remaining()[0] == "df");
+}
+
+struct RemoteAddArgs : public clipp::ArgsBase {
+    bool fetch;
+    std::string name;
+    std::string url;
+
+    void args()
+    {
+        flag(fetch, "fetch", 'f');
+        positional(name, "name");
+        positional(url, "url");
+    }
+};
+
+struct RemoteArgs : public clipp::ArgsBase {
+    bool verbose;
+    std::optional<RemoteAddArgs> add;
+
+    void args()
+    {
+        flag(verbose, "verbose", 'v');
+        subcommand(add, "add").help("Add a remote");
+    }
+};
+
+struct StatusArgs : public clipp::ArgsBase {
+    bool shortFormat;
+
+    void args()
+    {
+        flag(shortFormat, "short", 's');
+    }
+};
+
+struct GitArgs : public clipp::ArgsBase {
+    std::optional<std::string> dir;
+    std::optional<RemoteArgs> remote;
+    std::optional<StatusArgs> status;
+
+    void args()
+    {
+        flag(dir, "dir", 'C');
+        subcommand(remote, "remote").help("Manage remotes");
+        subcommand(status, "status").help("Show the working tree status");
+    }
+};
+
+TEST_CASE(R"({ "-C", "repo", "remote", "-v", "add", "-f", "origin", "url" } (GitArgs))")
+{
+    const auto args
+        = parse<GitArgs>({ "-C", "repo", "remote", "-v", "add", "-f", "origin", "url" });
+    CAPTURE(output->error);
+    REQUIRE(args);
+    CHECK(args->dir.value() == "repo");
+    CHECK(!args->status.has_value());
+    REQUIRE(args->remote.has_value());
+    CHECK(args->remote->verbose);
+    REQUIRE(args->remote->add.has_value());
+    CHECK(args->remote->add->fetch);
+    CHECK(args->remote->add->name == "origin");
+    CHECK(args->remote->add->url == "url");
+}
+
+TEST_CASE(R"({ "status", "-s" } (GitArgs))")
+{
+    const auto args = parse<GitArgs>({ "status", "-s" });
+    REQUIRE(args);
+    CHECK(!args->dir.has_value());
+    CHECK(!args->remote.has_value());
+    REQUIRE(args->status.has_value());
+    CHECK(args->status->shortFormat);
+}
+
+struct WrapperArgs : public clipp::ArgsBase {
+    bool raw = false;
+    std::optional<StatusArgs> status;
+
+    void args()
+    {
+        flag(raw, "raw").halt();
+        subcommand(status, "status");
+    }
+};
+
+TEST_CASE(R"({ "--raw", "status", "-s" } (WrapperArgs))")
+{
+    // Only the arguments up to the subcommand are tokenized, but the remaining ones still
+    // include everything after the halting flag
+    const auto args = parse<WrapperArgs>({ "--raw", "status", "-s" });
+    REQUIRE(args);
+    CHECK(args->raw);
+    CHECK(!args->status.has_value());
+    REQUIRE(args->remaining().size() == 2);
+    CHECK(args->remaining()[0] == "status");
+    CHECK(args->remaining()[1] == "-s");
+}
+
+TEST_CASE("errors (GitArgs)")
+{
+    CHECK(!parse<GitArgs>({ "push" }));
+    CHECK(contains(output->error, "Invalid command 'push'. Possible values: remote, status"));
+    CHECK(contains(
+        output->error, "Usage: test [--help] [--version] [--dir DIR] {remote,status} ..."));
+
+    CHECK(!parse<GitArgs>({ "-C", "repo" }));
+    CHECK(contains(output->error, "Missing command. Possible values: remote, status"));
+
+    auto parser = getParser();
+    const auto res = parser.tryParse<GitArgs>({ "remote", "add", "--fetch", "origin", "--bad" });
+    REQUIRE(!res);
+    CHECK(res.error().code == clipp::Error::Code::InvalidOption);
+    CHECK(res.error().argIndex == 4);
+
+    CHECK(!parse<GitArgs>({ "remote", "add", "origin" }));
+    CHECK(contains(output->error, "Missing argument 'url'"));
+    CHECK(contains(
+        output->error, "Usage: test remote add [--help] [--version] [--fetch] name url"));
+}
+
+TEST_CASE(R"({ "remote", "--help" } (GitArgs))")
+{
+    const auto args = parse<GitArgs>({ "remote", "--help" });
+    CHECK(args);
+    CHECK(exitStatus == 0);
+    CHECK(contains(
+        output->output, "Usage: test remote [--help] [--version] [--verbose] {add} ..."));
+    CHECK(contains(output->output, "Commands:\n  add"));
+    CHECK(contains(output->output, "Add a remote"));
+}
+
+struct ManyFlagsArgs : public clipp::ArgsBase {
+    std::array<bool, 200> flags;
+    std::optional<int64_t> last;
+
+    void args()
+    {
+        for (size_t i = 0; i < flags.size(); ++i) {
+            // Only the first 26 get short options (upper case, because 'h' is taken by --help)
+            const char shortOpt = i < 26 ? static_cast<char>('A' + i) : 0;
+            flag(flags[i], "flag" + std::to_string(i), shortOpt)
+                .help("help text of flag " + std::to_string(i));
+        }
+        flag(last, "last", '0');
+    }
+};
+
+TEST_CASE(R"({ "--flag199", "-AYZ", "--last=7", "--flag100" } (ManyFlagsArgs))")
+{
+    const auto args = parse<ManyFlagsArgs>({ "--flag199", "-AYZ", "--last=7", "--flag100" });
+    CAPTURE(output->error);
+    REQUIRE(args);
+    for (size_t i = 0; i < args->flags.size(); ++i) {
+        const bool expected = i == 0 || i == 24 || i == 25 || i == 100 || i == 199;
+        CHECK(args->flags[i] == expected);
+    }
+    REQUIRE(args->last);
+    CHECK(args->last.value() == 7);
+}
+
+TEST_CASE(R"({ "--help" } (ManyFlagsArgs))")
+{
+    const auto args = parse<ManyFlagsArgs>({ "--help" });
+    REQUIRE(args);
+    CHECK(contains(output->output, "-A, --flag0"));
+    CHECK(contains(output->output, "help text of flag 0\n"));
+    CHECK(contains(output->output, "--flag199                      help text of flag 199\n"));
+    CHECK(contains(output->output, "[--last LAST]"));
+}
+
+TEST_CASE(R"({ "--flag200" } (ManyFlagsArgs))")
+{
+    const auto args = parse<ManyFlagsArgs>({ "--flag200" });
+    CHECK(!args);
+    CHECK(contains(output->error, "Invalid option '--flag200'"));
+}
+
+struct CountedArgs : public clipp::ArgsBase {
+    static inline size_t argsCalls = 0;
+
+    bool foo;
+    size_t verbose;
+    std::optional<std::string> opt;
+    std::string pos = "def";
+
+    void args()
+    {
+        argsCalls++;
+        flag(foo, "foo", 'f');
+        flag(verbose, "verbose", 'v');
+        flag(opt, "opt", 'o');
+        positional(pos, "pos").optional();
+    }
+};
+
+TEST_CASE("schema is built once per parser (CountedArgs)")
+{
+    CountedArgs::argsCalls = 0;
+    auto parser = getParser();
+
+    const auto first = parser.parse<CountedArgs>({ "-fvv", "-obar", "first" });
+    REQUIRE(first);
+    CHECK(first->foo);
+    CHECK(first->verbose == 2);
+    CHECK(first->opt.value() == "bar");
+    CHECK(first->pos == "first");
+
+    const auto second = parser.parse<CountedArgs>({ "-v" });
+    REQUIRE(second);
+    CHECK(!second->foo);
+    CHECK(second->verbose == 1);
+    CHECK(!second->opt);
+    CHECK(second->pos == "def");
+    CHECK(CountedArgs::argsCalls == 1);
+
+    // The first result is not affected by the second parse
+    CHECK(first->verbose == 2);
+    CHECK(first->pos == "first");
+
+    CHECK(parser.parse<CountedArgs>({ "--help" }).has_value());
+    CHECK(contains(output->output, "-v, --verbose"));
+    CHECK(CountedArgs::argsCalls == 1);
+
+    // Changing the automatically added flags rebuilds the schema
+    parser.addHelp(false);
+    CHECK(!parser.parse<CountedArgs>({ "--help" }).has_value());
+    CHECK(CountedArgs::argsCalls == 2);
+}
+
+std::optional<std::string> globalOpt;
+
+struct GlobalArgs : public clipp::ArgsBase {
+    static inline size_t argsCalls = 0;
+
+    void args()
+    {
+        argsCalls++;
+        flag(globalOpt, "opt");
+    }
+};
+
+TEST_CASE("schema with non-member variables is not cached (GlobalArgs)")
+{
+    GlobalArgs::argsCalls = 0;
+    auto parser = getParser();
+    REQUIRE(parser.parse<GlobalArgs>({ "--opt", "a" }).has_value());
+    CHECK(globalOpt.value() == "a");
+    REQUIRE(parser.parse<GlobalArgs>({ "--opt", "b" }).has_value());
+    CHECK(globalOpt.value() == "b");
+    CHECK(GlobalArgs::argsCalls == 2);
+}
+
+struct StaticArgs {
+    bool foo;
+    size_t verbose;
+    std::optional<std::string> opt;
+    std::optional<int64_t> number;
+    std::vector<int64_t> vec;
+    std::vector<std::string> sources;
+    std::string destination;
+};
+
+constexpr auto staticSchema = clipp::schema(clipp::flag<&StaticArgs::foo>("foo", 'f'),
+    clipp::flag<&StaticArgs::verbose>("verbose", 'v'), clipp::flag<&StaticArgs::opt>("opt", 'o'),
+    clipp::flag<&StaticArgs::number>("number", 'n'),
+    clipp::flag<&StaticArgs::vec>("vec").num(2).collect(),
+    clipp::positional<&StaticArgs::sources>("source"),
+    clipp::positional<&StaticArgs::destination>("destination"));
+
+template <typename... StaticArgsTypes>
+auto parse(const clipp::StaticSchema<StaticArgsTypes...>& schema, std::vector<std::string> args)
+{
+    auto parser = getParser();
+    return parser.parse(schema, args);
+}
+
+TEST_CASE(R"({ "-fvvv", "-ooptval", "src1", "--number=-4", "src2", "dst" } (StaticArgs))")
+{
+    const auto args
+        = parse(staticSchema, { "-fvvv", "-ooptval", "src1", "--number=-4", "src2", "dst" });
+    CAPTURE(output->error);
+    REQUIRE(args);
+    CHECK(args->foo);
+    CHECK(args->verbose == 3);
+    CHECK(args->opt.value() == "optval");
+    CHECK(args->number.value() == -4);
+    CHECK(args->vec.empty());
+    REQUIRE(args->sources.size() == 2);
+    CHECK(args->sources[0] == "src1");
+    CHECK(args->sources[1] == "src2");
+    CHECK(args->destination == "dst");
+}
+
+constexpr auto staticSchemaNoSources = clipp::schema(clipp::flag<&StaticArgs::opt>("opt", 'o'),
+    clipp::flag<&StaticArgs::vec>("vec").num(2).collect(),
+    clipp::positional<&StaticArgs::destination>("destination"));
+
+TEST_CASE(R"({ "-o", "baz", "--vec", "1", "2", "dst", "--vec", "3", "4" } (StaticArgs))")
+{
+    const auto args = parse(
+        staticSchemaNoSources, { "-o", "baz", "--vec", "1", "2", "dst", "--vec", "3", "4" });
+    CAPTURE(output->error);
+    REQUIRE(args);
+    CHECK(args->opt.value() == "baz");
+    CHECK(args->vec == std::vector<int64_t> { 1, 2, 3, 4 });
+    CHECK(args->destination == "dst");
+}
+
+TEST_CASE("errors (StaticArgs)")
+{
+    CHECK(!parse(staticSchema, { "src" }));
+    CHECK(contains(output->error, "Missing argument 'destination'"));
+    CHECK(contains(output->error, "Usage: test [--foo] [--verbose] [--opt OPT] [--number NUMBER]"
+                                  " [--vec VEC VEC]... source [source...] destination"));
+    CHECK(!parse(staticSchema, { "--bar", "src", "dst" }));
+    CHECK(contains(output->error, "Invalid option '--bar'"));
+    CHECK(!parse(staticSchema, { "-fx", "src", "dst" }));
+    CHECK(contains(output->error, "Invalid option 'x'"));
+    CHECK(!parse(staticSchema, { "-ofv" }));
+    CHECK(contains(output->error, "Missing argument 'source'"));
+    CHECK(!parse(staticSchema, { "-vof", "src", "dst" }));
+    CHECK(contains(output->error, "Option 'o' requires an argument"));
+    CHECK(!parse(staticSchema, { "--number", "x", "src", "dst" }));
+    CHECK(contains(output->error, "Invalid value 'x' for option '--number' (integer)"));
+    CHECK(!parse(staticSchema, { "--vec", "1", "src", "dst" }));
+    CHECK(contains(output->error, "Invalid value 'src' for option '--vec' (integer)"));
+    CHECK(!parse(staticSchema, { "--foo=1", "src", "dst" }));
+    CHECK(contains(output->error, "'='-syntax can not be used for '--foo'"));
+}
+
+TEST_CASE(R"({ "--vec", "1", "src", "dst" } (StaticArgs, tryParse))")
+{
+    auto parser = getParser();
+    const auto argv = std::vector<std::string> { "--vec", "1", "src", "dst" };
+    const auto res = parser.tryParse(staticSchema, argv);
+    REQUIRE(!res);
+    CHECK(res.error().code == clipp::Error::Code::InvalidValue);
+    CHECK(res.error().argIndex == 2);
+    CHECK(res.error().message() == "Invalid value 'src' for option '--vec' (integer)");
+    CHECK(output->error.empty());
+}
+
+struct StaticMixedPositionalsArgs {
+    std::optional<std::string> a;
+    std::vector<std::string> b;
+    std::vector<std::string> c;
+    std::string d;
+};
+
+constexpr auto staticMixedPositionalsSchema
+    = clipp::schema(clipp::positional<&StaticMixedPositionalsArgs::a>("a"),
+        clipp::positional<&StaticMixedPositionalsArgs::b>("b"),
+        clipp::positional<&StaticMixedPositionalsArgs::c>("c").optional(),
+        clipp::positional<&StaticMixedPositionalsArgs::d>("d"));
+
+TEST_CASE(R"({ "1", "2" } (StaticMixedPositionalsArgs))")
+{
+    const auto args = parse(staticMixedPositionalsSchema, { "1", "2" });
+    REQUIRE(args);
+    CHECK(!args->a);
+    CHECK(args->b == std::vector<std::string> { "1" });
+    CHECK(args->c.empty());
+    CHECK(args->d == "2");
+
+    const auto more = parse(staticMixedPositionalsSchema, { "1", "2", "3", "4" });
+    REQUIRE(more);
+    CHECK(more->a.value() == "1");
+    CHECK(more->b == std::vector<std::string> { "2", "3" });
+    CHECK(more->c.empty());
+    CHECK(more->d == "4");
+}
+
+TEST_CASE("compiled parser from multiple threads (Args, GitArgs)")
+{
+    const auto compiled = getParser().compile<GitArgs>();
+    const auto compiledArgs = getParser().compile<Args>();
+
+    std::vector<std::thread> threads;
+    std::atomic<size_t> failures { 0 };
+    for (size_t t = 0; t < 8; ++t) {
+        threads.emplace_back([&, t]() {
+            for (size_t i = 0; i < 200; ++i) {
+                const auto url = "url" + std::to_string(t * 1000 + i);
+                const auto argv = std::vector<std::string_view> { "remote", "add", "origin", url };
+                const auto args = compiled.parse(argv);
+                if (!args || args->remote->add->url != url) {
+                    failures++;
+                }
+
+                const auto number = std::to_string(i);
+                const auto res = compiledArgs.tryParse(
+                    std::vector<std::string_view> { "-fvv", "--number", number });
+                if (res || res.error().code != clipp::Error::Code::MissingArgument
+                    || res->number.value() != static_cast<int64_t>(i) || res->verbose != 2) {
+                    failures++;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    CHECK(failures == 0);
+}
+
+// Counts how often it is converted, like something expensive that checks the filesystem would
+struct Expensive {
+    int64_t value;
+    static inline std::atomic<size_t> conversions = 0;
+};
+
+template <>
+struct clipp::Value<Expensive> {
+    static constexpr std::string_view typeName = "expensive";
+
+    static std::optional<Expensive> parse(std::string_view str)
+    {
+        Expensive::conversions++;
+        const auto val = clipp::Value<int64_t>::parse(str);
+        if (!val) {
+            return std::nullopt;
+        }
+        return Expensive { *val };
+    }
+};
+
+struct DeferredArgs : public clipp::ArgsBase {
+    std::vector<Expensive> only;
+    std::vector<Expensive> inputs;
+
+    void args()
+    {
+        flag(only, "only", 'o').collect(false);
+        positional(inputs, "inputs");
+    }
+};
+
+clipp::Parser getDeferredParser()
+{
+    auto parser = getParser();
+    parser.deferConversion(true);
+    Expensive::conversions = 0;
+    return parser;
+}
+
+TEST_CASE(R"({ "--only", "1", "2", "--only", "3", "4" } (DeferredArgs))")
+{
+    auto parser = getDeferredParser();
+    const auto args = parser.parse<DeferredArgs>({ "--only", "1", "2", "--only", "3", "4" });
+    REQUIRE(args);
+    CHECK(Expensive::conversions == 4);
+    // The reset of the flag happens in the same order as without deferConversion
+    REQUIRE(args->only.size() == 1);
+    CHECK(args->only[0].value == 3);
+    REQUIRE(args->inputs.size() == 2);
+    CHECK(args->inputs[0].value == 2);
+    CHECK(args->inputs[1].value == 4);
+}
+
+TEST_CASE("nothing is converted on errors or --help (DeferredArgs)")
+{
+    auto parser = getDeferredParser();
+    auto res = parser.tryParse<DeferredArgs>(std::vector<std::string> { "1", "2", "--nope" });
+    REQUIRE(!res);
+    CHECK(res.error().code == clipp::Error::Code::InvalidOption);
+    CHECK(Expensive::conversions == 0);
+
+    const auto args = parser.parse<DeferredArgs>({ "1", "2", "--help" });
+    CHECK(args);
+    CHECK(exitStatus == 0);
+    CHECK(Expensive::conversions == 0);
+
+    const auto argv = std::vector<std::string> { "1", "x", "3", "y" };
+    res = parser.tryParse<DeferredArgs>(argv);
+    REQUIRE(!res);
+    CHECK(res.error().code == clipp::Error::Code::InvalidValue);
+    CHECK(res.error().argIndex == 1);
+    CHECK(res.error().message() == "Invalid value 'x' for argument 'inputs' (expensive)");
+    CHECK(Expensive::conversions == 2);
+}
+
+struct DeferredParentArgs : public clipp::ArgsBase {
+    std::optional<Expensive> level;
+    std::optional<DeferredArgs> run;
+
+    void args()
+    {
+        flag(level, "level", 'l');
+        subcommand(run, "run");
+    }
+};
+
+TEST_CASE(R"({ "-l", "1", "run", "--only", "x", "5" } (DeferredParentArgs))")
+{
+    auto parser = getDeferredParser();
+    const auto argv = std::vector<std::string> { "-l", "1", "run", "--only", "x", "5" };
+    const auto res = parser.tryParse<DeferredParentArgs>(argv);
+    REQUIRE(!res);
+    CHECK(res.error().argIndex == 4);
+    CHECK(res.error().message() == "Invalid value 'x' for option '--only' (expensive)");
+    CHECK(Expensive::conversions == 2);
+}
+
+TEST_CASE("parallel conversion (DeferredArgs)")
+{
+    auto parser = getDeferredParser();
+    parser.deferConversion(false);
+    parser.conversionThreads(4);
+
+    std::vector<std::string> argv;
+    for (size_t i = 0; i < 1000; ++i) {
+        argv.push_back(std::to_string(i));
+    }
+    auto res = parser.tryParse<DeferredArgs>(argv);
+    REQUIRE(res);
+    CHECK(Expensive::conversions == 1000);
+    REQUIRE(res->inputs.size() == 1000);
+    bool ordered = true;
+    for (size_t i = 0; i < res->inputs.size(); ++i) {
+        ordered = ordered && res->inputs[i].value == static_cast<int64_t>(i);
+    }
+    CHECK(ordered);
+
+    // Always the first error, no matter which thread finds one first
+    argv[900] = "y";
+    argv[500] = "x";
+    res = parser.tryParse<DeferredArgs>(argv);
+    REQUIRE(!res);
+    CHECK(res.error().argIndex == 500);
+    CHECK(res.error().value == "x");
+    CHECK(res->inputs.size() == 500);
+}
+
+// Valid if it doesn't start with "missing"
+struct Checked {
+    std::string path;
+    static inline std::atomic<size_t> validations = 0;
+};
+
+template <>
+struct clipp::Value<Checked> {
+    static constexpr std::string_view typeName = "checked path";
+
+    static std::optional<Checked> parse(std::string_view str)
+    {
+        if (str.empty()) {
+            return std::nullopt;
+        }
+        return Checked { std::string(str) };
+    }
+
+    static bool validate(std::string_view str)
+    {
+        Checked::validations++;
+        return str.substr(0, 7) != "missing";
+    }
+};
+
+struct CheckedArgs : public clipp::ArgsBase {
+    std::optional<Checked> config;
+    std::optional<int64_t> level;
+    std::vector<Checked> inputs;
+
+    void args()
+    {
+        flag(config, "config", 'c');
+        flag(level, "level", 'l');
+        positional(inputs, "inputs");
+    }
+};
+
+TEST_CASE("validation after conversion (CheckedArgs)")
+{
+    auto parser = getParser();
+    Checked::validations = 0;
+    auto res = parser.tryParse<CheckedArgs>(std::vector<std::string> { "-c", "cfg", "a", "b" });
+    REQUIRE(res);
+    CHECK(Checked::validations == 3);
+    CHECK(res->config.value().path == "cfg");
+
+    // The first value that failed is reported, whether it couldn't be converted or validated.
+    // Only the values before one that couldn't be converted are validated and nothing is for
+    // other errors. The errors point into the arguments.
+    Checked::validations = 0;
+    std::vector<std::string> argv { "-l", "x", "missing" };
+    res = parser.tryParse<CheckedArgs>(argv);
+    REQUIRE(!res);
+    CHECK(res.error().name == "l");
+    argv = { "a", "-c", "", "missing" };
+    res = parser.tryParse<CheckedArgs>(argv);
+    REQUIRE(!res);
+    CHECK(res.error().name == "c");
+    CHECK(Checked::validations == 1);
+    Checked::validations = 0;
+    res = parser.tryParse<CheckedArgs>(std::vector<std::string> { "missing", "--help" });
+    CHECK(res);
+    res = parser.tryParse<CheckedArgs>(std::vector<std::string> { "missing", "--bad" });
+    CHECK(res.error().code == clipp::Error::Code::InvalidOption);
+    CHECK(Checked::validations == 0);
+    argv = { "missing", "-l", "x" };
+    res = parser.tryParse<CheckedArgs>(argv);
+    REQUIRE(!res);
+    CHECK(res.error().argIndex == 0);
+    CHECK(res.error().value == "missing");
+    argv = { "a", "missing", "-c", "" };
+    res = parser.tryParse<CheckedArgs>(argv);
+    REQUIRE(!res);
+    CHECK(res.error().argIndex == 1);
+
+    argv = { "a", "missing1", "-c", "x" };
+    res = parser.tryParse<CheckedArgs>(argv);
+    REQUIRE(!res);
+    CHECK(res.error().argIndex == 1);
+    CHECK(res.error().message() == "Invalid value 'missing1' for argument 'inputs' (checked path)");
+}
+
+struct CheckedCopyArgs : public clipp::ArgsBase {
+    Checked source;
+    int64_t count;
+
+    void args()
+    {
+        positional(source, "source");
+        positional(count, "count");
+    }
+};
+
+TEST_CASE("validation and conversion errors in argument order (CheckedCopyArgs)")
+{
+    auto parser = getParser();
+    for (const auto defer : { false, true }) {
+        CAPTURE(defer);
+        parser.deferConversion(defer);
+        auto res = parser.tryParse<CheckedCopyArgs>(std::vector<std::string> { "missing", "x" });
+        REQUIRE(!res);
+        CHECK(res.error().argIndex == 0);
+        CHECK(res.error().value == "missing");
+        CHECK(res.error().typeName == "checked path");
+
+        res = parser.tryParse<CheckedCopyArgs>(std::vector<std::string> { "src", "x" });
+        REQUIRE(!res);
+        CHECK(res.error().argIndex == 1);
+        CHECK(res.error().value == "x");
+    }
+}
+
+TEST_CASE("parallel validation (CheckedArgs)")
+{
+    auto parser = getParser();
+    parser.validationThreads(4);
+
+    std::vector<std::string> argv;
+    for (size_t i = 0; i < 1000; ++i) {
+        argv.push_back("in" + std::to_string(i));
+    }
+    Checked::validations = 0;
+    auto res = parser.tryParse<CheckedArgs>(argv);
+    REQUIRE(res);
+    CHECK(Checked::validations == 1000);
+
+    // Always the first failure, no matter which thread finds one first
+    argv[900] = "missing900";
+    argv[500] = "missing500";
+    argv.insert(argv.begin(), { "--config", "missing" });
+    res = parser.tryParse<CheckedArgs>(argv);
+    REQUIRE(!res);
+    CHECK(res.error().argIndex == 1);
+    CHECK(res.error().option);
+    argv[1] = "cfg";
+    res = parser.tryParse<CheckedArgs>(argv);
+    REQUIRE(!res);
+    CHECK(res.error().argIndex == 502);
+    CHECK(res.error().value == "missing500");
+
+    // The same with deferred conversion
+    parser.deferConversion(true);
+    res = parser.tryParse<CheckedArgs>(argv);
+    REQUIRE(!res);
+    CHECK(res.error().argIndex == 502);
+}
+
+struct ViewArgs : public clipp::ArgsBase {
+    std::optional<std::string_view> output;
+    std::vector<std::string_view> inputs;
+
+    void args()
+    {
+        flag(output, "output", 'o');
+        positional(inputs, "inputs");
+    }
+};
+
+TEST_CASE(R"({ "-o", "out", "a", "b" } (ViewArgs))")
+{
+    auto parser = getParser();
+    const char* argv[] = { "-o", "out", "a", "b" };
+    const auto args = parser.parse<ViewArgs>(clipp::ArgvView(argv, 4));
+    REQUIRE(args);
+    REQUIRE(args->output);
+    CHECK(args->output->data() == argv[1]);
+    REQUIRE(args->inputs.size() == 2);
+    CHECK(args->inputs[0].data() == argv[2]);
+    CHECK(args->inputs[1] == "b");
+}
+
+TEST_CASE(R"({ "@test_views.rsp" } (ViewArgs, response files))")
+{
+    writeFile("test_views.rsp", "-o 'out file' in1 in2");
+    auto parser = getParser();
+    parser.responseFiles(true);
+    auto args = parser.parse<ViewArgs>(std::vector<std::string> { "@test_views.rsp" });
+    std::remove("test_views.rsp");
+    REQUIRE(args);
+    // The views point into the mapping of the file, which is owned by args
+    const auto moved = std::move(*args);
+    args.reset();
+    CHECK(moved.output.value() == "out file");
+    REQUIRE(moved.inputs.size() == 2);
+    CHECK(moved.inputs[0] == "in1");
+    CHECK(moved.inputs[1] == "in2");
+}
+
+TEST_CASE("vectorized whitespace search matches the scalar code")
+{
+    // Mostly arguments, with every kind of whitespace and some bytes above 127 mixed in
+    const char alphabet[] = "ab-=.0 \t\n\r\v\f\x08\x0e\x1f!\x80\xff\"'";
+    std::mt19937 rng(27);
+    std::uniform_int_distribution<size_t> pick(0, sizeof(alphabet) - 2);
+    for (size_t len = 0; len < 150; ++len) {
+        std::string data(len, ' ');
+        for (auto& c : data) {
+            c = alphabet[pick(rng)];
+        }
+        for (size_t i = 0; i <= len; ++i) {
+            REQUIRE(clipp::detail::findSpace(data, i) == clipp::detail::findSpaceScalar(data, i));
+        }
+    }
+
+    // A long argument, so a whole vector of it has no whitespace
+    std::string data(100, 'x');
+    data += "\f";
+    data += std::string(50, 'y');
+    std::vector<std::string_view> args;
+    REQUIRE(clipp::detail::splitResponseFile(data, args));
+    REQUIRE(args.size() == 2);
+    CHECK(args[0] == std::string(100, 'x'));
+    CHECK(args[1] == std::string(50, 'y'));
+}
+
+TEST_CASE("number check matches from_chars")
+{
+    for (const auto str : { "-1", "-.5", "1e5", "-inf", "-nan", "-Infinity", "-NaN", "-", "--",
+             "--1", "-v", "-e5", "-+1", "-1x", "", "5", "-0x10" }) {
+        double v;
+        const auto sv = std::string_view(str);
+        const auto res = std::from_chars(sv.data(), sv.data() + sv.size(), v);
+        const auto expected = res.ec == std::errc {} && res.ptr == sv.data() + sv.size();
+        CHECK_MESSAGE(clipp::detail::isNumber(sv) == expected, str);
+    }
+}
+
+struct DelimiterArgs : public clipp::ArgsBase {
+    std::vector<int64_t> ids;
+    std::vector<std::string> modes;
+    std::vector<double> coords;
+
+    void args()
+    {
+        flag(ids, "ids", 'i').delimiter(',');
+        flag(modes, "modes").delimiter(':').choices({ "fast", "safe" });
+        positional(coords, "coords").delimiter(',').optional();
+    }
+};
+
+TEST_CASE(R"({ "--ids=1,2,3", "-i", "4", "--modes", "fast:safe", "0.5,1", "2" } (DelimiterArgs))")
+{
+    const auto args
+        = parse<DelimiterArgs>({ "--ids=1,2,3", "-i", "4", "--modes", "fast:safe", "0.5,1", "2" });
+    REQUIRE(args);
+    CHECK(args->ids == std::vector<int64_t> { 1, 2, 3, 4 });
+    CHECK(args->modes == std::vector<std::string> { "fast", "safe" });
+    CHECK(args->coords == std::vector<double> { 0.5, 1.0, 2.0 });
+}
+
+TEST_CASE(R"({ "--ids=" } (DelimiterArgs))")
+{
+    const auto args = parse<DelimiterArgs>({ "--ids=" });
+    REQUIRE(args);
+    CHECK(args->ids.empty());
+}
+
+TEST_CASE("errors (DelimiterArgs)")
+{
+    auto parser = getParser();
+    const auto argv = std::vector<std::string> { "-i", "1,2,,4" };
+    auto res = parser.tryParse<DelimiterArgs>(argv);
+    REQUIRE(!res);
+    CHECK(res.error().code == clipp::Error::Code::InvalidValue);
+    CHECK(res.error().argIndex == 1);
+    CHECK(res.error().element == 2);
+    CHECK(res.error().message() == "Invalid value '' at index 2 for option 'i' (integer)");
+
+    const auto argvChoice = std::vector<std::string> { "--modes", "safe:slow" };
+    res = parser.tryParse<DelimiterArgs>(argvChoice);
+    REQUIRE(!res);
+    CHECK(res.error().code == clipp::Error::Code::InvalidChoice);
+    CHECK(res.error().element == 1);
+    CHECK(contains(res.error().message(), "Invalid value 'slow' at index 1 for option '--modes'"));
+
+    parser.deferConversion(true);
+    const auto argvDeferred = std::vector<std::string> { "1", "2,x" };
+    res = parser.tryParse<DelimiterArgs>(argvDeferred);
+    REQUIRE(!res);
+    CHECK(res.error().argIndex == 1);
+    CHECK(res.error().element == 1);
+    CHECK(res->coords == std::vector<double> { 1.0, 2.0 });
+}
+
+TEST_CASE("help (DelimiterArgs)")
+{
+    const auto args = parse<DelimiterArgs>({ "--help" });
+    CHECK(contains(output->output, "[--ids IDS[,IDS...]]..."));
+}
+
+struct ReserveArgs : public clipp::ArgsBase {
+    std::vector<int64_t> vals;
+    std::optional<int64_t> bar;
+
+    void args()
+    {
+        flag(vals, "vals").num(2).collect();
+        flag(bar, "bar");
+    }
+};
+
+TEST_CASE("vectors are reserved for all values (ReserveArgs, CpStyleArgs)")
+{
+    std::vector<std::string> argv;
+    for (size_t i = 0; i < 100; ++i) {
+        argv.insert(argv.end(), { "--vals", std::to_string(i), std::to_string(i), "--bar=1" });
+    }
+    const auto vecArgs = parse<ReserveArgs>(argv);
+    REQUIRE(vecArgs);
+    CHECK(vecArgs->vals.size() == 200);
+    CHECK(vecArgs->vals.capacity() == 200);
+
+    argv.clear();
+    for (size_t i = 0; i < 100; ++i) {
+        argv.push_back("src" + std::to_string(i));
+    }
+    argv.push_back("dst");
+    const auto cpArgs = parse<CpStyleArgs>(argv);
+    REQUIRE(cpArgs);
+    CHECK(cpArgs->sources.size() == 100);
+    CHECK(cpArgs->sources.capacity() == 100);
+}
+
+struct LayeredArgs : public clipp::ArgsBase {
+    bool verbose;
+    size_t debug;
+    std::optional<int64_t> level;
+    std::optional<std::string> name;
+    std::vector<int64_t> ports;
+    std::optional<RemoteAddArgs> add;
+
+    void args()
+    {
+        flag(verbose, "verbose", 'v').env("CLIPP_TEST_VERBOSE");
+        flag(debug, "debug", 'd');
+        flag(level, "level", 'l').env("CLIPP_TEST_LEVEL").help("The level");
+        flag(name, "name").choices({ "a", "b" });
+        flag(ports, "ports").delimiter(',');
+        subcommand(add, "add");
+    }
+};
+
+clipp::Parser getLayeredParser(std::string_view config)
+{
+    writeFile("test_config.ini", config);
+    auto parser = getParser();
+    parser.configFile("test_config.ini");
+    return parser;
+}
+
+TEST_CASE("environment and config file (LayeredArgs)")
+{
+    auto parser = getLayeredParser(R"(
+# the settings
+level = 2
+debug = 3
+name = "b"
+ports = 80,443
+ports = 8080
+  ; sections are for the subcommands
+[add]
+fetch = yes
+)");
+    ::setenv("CLIPP_TEST_LEVEL", "5", 1);
+    ::setenv("CLIPP_TEST_VERBOSE", "true", 1);
+
+    const auto argv = std::vector<std::string> { "--level", "7", "add", "origin", "url" };
+    auto res = parser.tryParse<LayeredArgs>(argv);
+    REQUIRE(res);
+    // The command line wins over the environment, which wins over the config file
+    CHECK(res->level.value() == 7);
+    CHECK(res->verbose);
+    CHECK(res->debug == 3);
+    CHECK(res->name.value() == "b");
+    CHECK(res->ports == std::vector<int64_t> { 80, 443, 8080 });
+    REQUIRE(res->add);
+    CHECK(res->add->fetch);
+
+    const auto argvShort = std::vector<std::string> { "--ports", "1", "add", "origin", "url" };
+    res = parser.tryParse<LayeredArgs>(argvShort);
+    REQUIRE(res);
+    CHECK(res->level.value() == 5);
+    CHECK(res->ports == std::vector<int64_t> { 1 });
+
+    ::unsetenv("CLIPP_TEST_LEVEL");
+    ::unsetenv("CLIPP_TEST_VERBOSE");
+    res = parser.tryParse<LayeredArgs>(argvShort);
+    REQUIRE(res);
+    CHECK(res->level.value() == 2);
+    CHECK(!res->verbose);
+    std::remove("test_config.ini");
+}
+
+TEST_CASE("errors in the environment and config file (LayeredArgs)")
+{
+    const auto argv = std::vector<std::string> { "add", "origin", "url" };
+    ::setenv("CLIPP_TEST_LEVEL", "high", 1);
+    auto parser = getLayeredParser("");
+    auto res = parser.tryParse<LayeredArgs>(argv);
+    REQUIRE(!res);
+    CHECK(res.error().code == clipp::Error::Code::InvalidValue);
+    CHECK(res.error().message()
+        == "Invalid value 'high' for option 'level' (integer) in environment variable "
+           "'CLIPP_TEST_LEVEL'");
+    ::unsetenv("CLIPP_TEST_LEVEL");
+
+    parser = getLayeredParser("name = a\nname = c\n");
+    res = parser.tryParse<LayeredArgs>(argv);
+    REQUIRE(!res);
+    CHECK(res.error().code == clipp::Error::Code::InvalidChoice);
+    CHECK(contains(res.error().message(), "for option 'name' in 'test_config.ini' line 2"));
+
+    parser = getLayeredParser("[add]\nfetch = yes\nurl = x\n");
+    res = parser.tryParse<LayeredArgs>(argv);
+    REQUIRE(!res);
+    CHECK(res.error().message() == "Unknown option 'url' in 'test_config.ini' line 3");
+
+    parser = getLayeredParser("level 3\n");
+    res = parser.tryParse<LayeredArgs>(argv);
+    REQUIRE(!res);
+    CHECK(res.error().message() == "Invalid line 'level 3' in 'test_config.ini' line 1");
+    std::remove("test_config.ini");
+
+    // Missing config files are only an error if they are required
+    CHECK(static_cast<bool>(parser.tryParse<LayeredArgs>(argv)));
+    parser.configFile("test_config.ini", true);
+    res = parser.tryParse<LayeredArgs>(argv);
+    REQUIRE(!res);
+    CHECK(res.error().message() == "Could not read config file 'test_config.ini'");
+}
+
+TEST_CASE("help and version without the config file (LayeredArgs)")
+{
+    // The config file is only read once the command line was accepted
+    for (const auto& arg : { "--help", "--version" }) {
+        auto parser = getParser();
+        parser.configFile("/nonexistent/cfg.ini", true);
+        parser.tryParse<LayeredArgs>(std::vector<std::string> { arg });
+        CHECK(exitStatus == 0);
+        CHECK(output->error.empty());
+        CHECK(!output->output.empty());
+
+        auto malformed = getLayeredParser("level 3\n");
+        malformed.tryParse<LayeredArgs>(std::vector<std::string> { arg });
+        CHECK(exitStatus == 0);
+        CHECK(output->error.empty());
+    }
+    std::remove("test_config.ini");
+}
+
+TEST_CASE("compiled config file (LayeredArgs)")
+{
+    // The file is read by compile, not for every parse
+    const auto compiled = getLayeredParser("level = 2\n").compile<LayeredArgs>();
+    std::remove("test_config.ini");
+    const auto argv = std::vector<std::string> { "add", "origin", "url" };
+    for (size_t i = 0; i < 2; ++i) {
+        const auto res = compiled.tryParse(argv);
+        REQUIRE(res);
+        CHECK(res->level.value() == 2);
+    }
+}
+
+TEST_CASE("help (LayeredArgs)")
+{
+    const auto args = parse<LayeredArgs>({ "--help" });
+    CHECK(contains(output->output, "The level [env: CLIPP_TEST_LEVEL]"));
+}
+
+TEST_CASE("parse lines (GitArgs)")
+{
+    const auto compiled = getParser().compile<GitArgs>();
+    std::string text = "remote add origin 'the url'\n\nstatus -s\r\nstatus --nope\nremote 'add\n";
+    for (size_t i = 0; i < 100; ++i) {
+        text.append("-C dir" + std::to_string(i) + " status\n");
+    }
+
+    for (const size_t numThreads : { 1, 4 }) {
+        std::mutex mutex;
+        std::vector<std::pair<size_t, std::string>> errors;
+        std::vector<size_t> dirs;
+        compiled.parseLines(
+            text,
+            [&](size_t line, clipp::Result<GitArgs>&& res) {
+                std::lock_guard lock(mutex);
+                if (!res) {
+                    errors.emplace_back(line, res.error().message());
+                } else if (line == 1) {
+                    CHECK(res->remote->add->url == "the url");
+                } else if (line == 3) {
+                    CHECK(res->status->shortFormat);
+                } else {
+                    dirs.push_back(std::stoul(res->dir.value().substr(3)));
+                }
+            },
+            numThreads);
+
+        std::sort(errors.begin(), errors.end());
+        REQUIRE(errors.size() == 2);
+        CHECK(errors[0] == std::pair<size_t, std::string>(4, "Invalid option '--nope'"));
+        CHECK(errors[1] == std::pair<size_t, std::string>(5, "Unterminated quote in line 5"));
+        std::sort(dirs.begin(), dirs.end());
+        REQUIRE(dirs.size() == 100);
+        CHECK(dirs.front() == 0);
+        CHECK(dirs.back() == 99);
+    }
+
+    writeFile("test_lines.txt", "status\nstatus -x\n");
+    size_t numErrors = 0;
+    CHECK(compiled.parseFile("test_lines.txt", [&](size_t, auto&& res) { numErrors += !res; }));
+    CHECK(numErrors == 1);
+    std::remove("test_lines.txt");
+    CHECK(!compiled.parseFile("test_lines.txt", [](size_t, auto&&) { }));
+}
+
+// Parsing the value would fail, so the tests make sure completion never converts anything
+struct CompleteArgs : public clipp::ArgsBase {
+    std::optional<int64_t> level;
+    std::optional<std::string> mode;
+    std::string action;
+    std::vector<std::string> files;
+
+    void args()
+    {
+        flag(level, "level", 'l');
+        flag(mode, "mode", 'm').choices({ "fast", "safe" }).help("How it's done");
+        positional(action, "action").choices({ "build", "bump", "clean" });
+        positional(files, "files");
+    }
+};
+
+template <typename Args>
+std::string complete(std::vector<std::string> words)
+{
+    auto parser = getParser();
+    parser.completion(true);
+    words.insert(words.begin(), "--__complete");
+    parser.parse<Args>(words);
+    CHECK(exitStatus == 0);
+    return output->output;
+}
+
+TEST_CASE("completion protocol (CompleteArgs)")
+{
+    CHECK(complete<CompleteArgs>({ "b" }) == "build\nbump\n");
+    CHECK(complete<CompleteArgs>({ "" }) == "build\nbump\nclean\n");
+    CHECK(complete<CompleteArgs>({ "--m" }) == "--mode\n");
+    CHECK(complete<CompleteArgs>({ "-", }).find("--level\n-l\n--mode\n-m\n") != std::string::npos);
+    CHECK(complete<CompleteArgs>({ "--mode", "" }) == "fast\nsafe\n");
+    CHECK(complete<CompleteArgs>({ "-lx", "-m", "s" }) == "safe\n");
+    CHECK(complete<CompleteArgs>({ "--level", "x", "clean", "" }).empty());
+    CHECK(complete<CompleteArgs>({ "--", "-" }).empty());
+
+    CHECK(complete<GitArgs>({ "" }) == "remote\nstatus\n");
+    CHECK(complete<GitArgs>({ "-C", "remote", "" }) == "remote\nstatus\n");
+    CHECK(complete<GitArgs>({ "remote", "" }) == "add\n");
+    CHECK(complete<GitArgs>({ "remote", "-v", "add", "--f" }) == "--fetch\n");
+
+    // Without completion() it is just an invalid option
+    auto parser = getParser();
+    CHECK(!parser.parse<CompleteArgs>(std::vector<std::string> { "--__complete", "" }).has_value());
+    CHECK(exitStatus == 1);
+}
+
+TEST_CASE("completion without exiting (CompleteArgs)")
+{
+    auto parser = getParser();
+    parser.completion(true);
+    exitStatus = -1;
+    const auto words = std::vector<std::string> { "--__complete", "--mode", "f" };
+    const auto res = parser.tryParse<CompleteArgs>(words);
+    REQUIRE(!res);
+    CHECK(res.error().code == clipp::Error::Code::Completion);
+    CHECK(output->output == "fast\n");
+    CHECK(exitStatus == -1);
+
+    // The object passed in is not touched
+    CompleteArgs args;
+    args.action = "kept";
+    const auto err = parser.tryParseInto(args, clipp::ArgvView(words));
+    REQUIRE(err);
+    CHECK(err->code == clipp::Error::Code::Completion);
+    CHECK(args.action == "kept");
+
+    const auto compiled = parser.compile<CompleteArgs>();
+    output->clear();
+    CHECK(compiled.tryParse(words).error().code == clipp::Error::Code::Completion);
+    CHECK(output->output == "fast\n");
+    CHECK(exitStatus == -1);
+
+    CHECK(!compiled.parse(words));
+    CHECK(exitStatus == 0);
+}
+
+TEST_CASE("completion scripts (GitArgs)")
+{
+    auto parser = clipp::Parser("git");
+    const auto bash = parser.completionScript<GitArgs>(clipp::Shell::Bash);
+    CHECK(bash.find("'/--dir' | '/-C') skip=1 value='/--dir' ;;") != std::string::npos);
+    CHECK(bash.find("'/remote/add') path='/remote/add' ;;") != std::string::npos);
+    CHECK(bash.find("COMPREPLY=($(compgen -W 'remote status' -- \"$cur\"))") != std::string::npos);
+    CHECK(bash.find("complete -F _clipp_complete_git git\n") != std::string::npos);
+
+    const auto zsh = parser.completionScript<GitArgs>(clipp::Shell::Zsh);
+    CHECK(zsh.find("bashcompinit\n" + bash) != std::string::npos);
+
+    const auto fish = parser.completionScript<GitArgs>(clipp::Shell::Fish);
+    CHECK(fish.find("complete -c 'git' -n 'not __fish_seen_subcommand_from remote status' -l "
+                    "'dir' -s 'C' -r\n")
+        != std::string::npos);
+    CHECK(fish.find("complete -c 'git' -n '__fish_seen_subcommand_from remote; and not "
+                    "__fish_seen_subcommand_from add' -f -a 'add' -d 'Add a remote'\n")
+        != std::string::npos);
+
+    auto completeParser = clipp::Parser("complete");
+    const auto choices = completeParser.completionScript<CompleteArgs>(clipp::Shell::Fish);
+    CHECK(choices.find("-l 'mode' -s 'm' -x -a 'fast safe' -d 'How it'\\''s done'\n")
+        != std::string::npos);
+    CHECK(choices.find("complete -c 'complete' -a 'build bump clean'\n") != std::string::npos);
+}
+
+struct ReplArgs : public clipp::ArgsBase {
+    bool force;
+    std::optional<int64_t> level;
+    std::vector<std::string_view> tags;
+    std::string_view command;
+    std::optional<std::string_view> target = "all";
+    std::vector<std::string_view> files { "default" };
+
+    void args()
+    {
+        flag(force, "force", 'f');
+        flag(level, "level", 'l');
+        flag(tags, "tag", 't');
+        positional(command, "command");
+        positional(target, "target");
+        positional(files, "files").optional();
+    }
+};
+
+TEST_CASE("parse into an existing object (ReplArgs)")
+{
+    auto parser = getParser();
+    ReplArgs args;
+    const char* first[] = { "-f", "-l", "3", "-t", "a", "-t", "b", "build", "lib", "x.c", "y.c" };
+    REQUIRE(parser.parseInto(args, clipp::ArgvView(first, std::size(first))));
+    CHECK(args.force);
+    CHECK(args.level.value() == 3);
+    CHECK(args.tags.size() == 2);
+    CHECK(args.target.value() == "lib");
+    REQUIRE(args.files.size() == 3);
+    CHECK(args.files[2] == "y.c");
+
+    // Everything is reset to the defaults
+    const char* second[] = { "clean" };
+    REQUIRE(parser.parseInto(args, clipp::ArgvView(second, std::size(second))));
+    CHECK(!args.force);
+    CHECK(!args.level);
+    CHECK(args.tags.empty());
+    CHECK(args.command == "clean");
+    CHECK(args.target.value() == "all");
+    REQUIRE(args.files.size() == 1);
+    CHECK(args.files[0] == "default");
+
+    // Reparsing the same kind of command line doesn't allocate
+    REQUIRE(parser.parseInto(args, clipp::ArgvView(first, std::size(first))));
+    const auto before = allocations.load();
+    for (size_t i = 0; i < 10; ++i) {
+        parser.parseInto(args, clipp::ArgvView(first, std::size(first)));
+    }
+    const auto allocs = allocations.load() - before;
+    CHECK(allocs == 0);
+    CHECK(args.tags.size() == 2);
+
+    const char* invalid[] = { "-l", "x", "build" };
+    const auto err = parser.tryParseInto(args, clipp::ArgvView(invalid, std::size(invalid)));
+    REQUIRE(err);
+    CHECK(err->code == clipp::Error::Code::InvalidValue);
+    CHECK(output->error.empty());
+
+    const auto compiled = getParser().compile<ReplArgs>();
+    ReplArgs compiledArgs;
+    CHECK(compiled.parseInto(compiledArgs, clipp::ArgvView(second, std::size(second))));
+    CHECK(!compiled.tryParseInto(compiledArgs, clipp::ArgvView(first, std::size(first))));
+    CHECK(compiledArgs.command == "build");
+}
+
+TEST_CASE("parse lines reuses the args (ReplArgs)")
+{
+    const auto compiled = getParser().compile<ReplArgs>();
+    const auto allocsForLines = [&compiled](size_t numLines, size_t numThreads) {
+        std::string text;
+        for (size_t i = 0; i < numLines; ++i) {
+            text.append("-f -l 3 -t a -t b build lib x.c y.c\n");
+        }
+        std::atomic<size_t> parsed { 0 };
+        const auto before = allocations.load();
+        compiled.parseLines(
+            text,
+            [&parsed](size_t, clipp::Result<ReplArgs>&& res) {
+                parsed += res && res->tags.size() == 2;
+            },
+            numThreads);
+        const auto allocs = allocations.load() - before;
+        CHECK(parsed == numLines);
+        return allocs;
+    };
+
+    // Only the first line allocates. With threads, the first line of every thread does, but it
+    // is not fixed how many of them get lines.
+    CHECK(allocsForLines(1000, 1) == allocsForLines(10, 1));
+    CHECK(allocsForLines(2000, 4) < allocsForLines(1000, 4) + 100);
+
+    // Moving the value out doesn't break the next line
+    std::vector<ReplArgs> moved;
+    compiled.parseLines("build\n-l 2 clean\n", [&moved](size_t, clipp::Result<ReplArgs>&& res) {
+        REQUIRE(res);
+        moved.push_back(std::move(*res));
+    });
+    REQUIRE(moved.size() == 2);
+    CHECK(moved[0].command == "build");
+    CHECK(!moved[0].level);
+    CHECK(moved[1].command == "clean");
+    CHECK(moved[1].level.value() == 2);
+}
+
+TEST_CASE("usage and help are rendered once per schema (ReplArgs)")
+{
+    auto parser = getParser();
+    ReplArgs args;
+    const char* argv[] = { "build" };
+    REQUIRE(parser.parseInto(args, clipp::ArgvView(argv, std::size(argv))));
+    const auto usage = args.usage("test");
+    const auto help = args.help("test");
+    CHECK(usage == "test [--help] [--version] [--force] [--level LEVEL] [--tag TAG]... command "
+                   "[target] [files...] ");
+    CHECK(help.find("Usage: " + usage + "\n\n") == 0);
+
+    // Only the returned strings are allocated
+    const auto before = allocations.load();
+    CHECK(args.usage("test").size() == usage.size());
+    CHECK(args.help("test").size() == help.size());
+    const auto allocs = allocations.load() - before;
+    CHECK(allocs == 3);
+
+    // The schema of a compiled parser is shared by all threads
+    const auto compiled = getParser().compile<ReplArgs>();
+    std::vector<ReplArgs> threadArgs(4);
+    std::vector<std::string> helps(threadArgs.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < threadArgs.size(); ++i) {
+        threads.emplace_back([&, i]() {
+            compiled.parseInto(threadArgs[i], clipp::ArgvView(argv, std::size(argv)));
+            helps[i] = threadArgs[i].help("test");
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (const auto& threadHelp : helps) {
+        CHECK(threadHelp == help);
+    }
+}
+
+struct EmbeddedArgs : public clipp::ArgsBase {
+    bool verbose;
+    clipp::InplaceVector<std::string_view, 2> tags;
+    clipp::InplaceVector<int64_t, 4> ids;
+
+    void args()
+    {
+        flag(verbose, "verbose", 'v');
+        flag(tags, "tag", 't');
+        positional(ids, "ids").delimiter(',');
+    }
+};
+
+TEST_CASE("parse without allocating (EmbeddedArgs)")
+{
+    auto parser = getParser();
+    EmbeddedArgs args;
+    const char* full[] = { "-v", "-t", "a", "-t", "b", "1,2", "3", "4" };
+    REQUIRE(parser.parseInto(args, clipp::ArgvView(full, std::size(full))));
+    CHECK(args.verbose);
+    CHECK(args.tags == clipp::InplaceVector<std::string_view, 2> { "a", "b" });
+    CHECK(args.ids == clipp::InplaceVector<int64_t, 4> { 1, 2, 3, 4 });
+
+    const char* shorter[] = { "-t", "c", "5" };
+    const char* tooManyTags[] = { "-t", "a", "-t", "b", "-t", "c", "1" };
+    const char* tooManyIds[] = { "1,2,3", "4,5" };
+    char message[128];
+    size_t messageSize = 0;
+    std::optional<clipp::Error> tagsErr, idsErr;
+    const auto before = allocations.load();
+    REQUIRE(parser.parseInto(args, clipp::ArgvView(shorter, std::size(shorter))));
+    tagsErr = parser.tryParseInto(args, clipp::ArgvView(tooManyTags, std::size(tooManyTags)));
+    idsErr = parser.tryParseInto(args, clipp::ArgvView(tooManyIds, std::size(tooManyIds)));
+    if (idsErr) {
+        messageSize = idsErr->format(message, sizeof(message));
+    }
+    const auto allocs = allocations.load() - before;
+    CHECK(allocs == 0);
+
+    REQUIRE(tagsErr);
+    CHECK(tagsErr->code == clipp::Error::Code::TooManyValues);
+    CHECK(tagsErr->value == "c");
+    CHECK(tagsErr->num == 2);
+    CHECK(tagsErr->message() == "Too many values for option 't' (at most 2)");
+    REQUIRE(idsErr);
+    CHECK(idsErr->code == clipp::Error::Code::TooManyValues);
+    CHECK(idsErr->element == 1);
+    CHECK(std::string_view(message, messageSize) == idsErr->message());
+    CHECK(idsErr->message() == "Too many values at index 1 for argument 'ids' (at most 4)");
+
+    // Messages that don't fit are cut off
+    char small[8];
+    CHECK(idsErr->format(small, sizeof(small)) == idsErr->message().size());
+    CHECK(std::string_view(small) == "Too man");
+
+    // The same errors with deferred conversion
+    parser.deferConversion(true);
+    CHECK(parser.tryParseInto(args, clipp::ArgvView(tooManyTags, std::size(tooManyTags)))->code
+        == clipp::Error::Code::TooManyValues);
+    const auto deferredErr
+        = parser.tryParseInto(args, clipp::ArgvView(tooManyIds, std::size(tooManyIds)));
+    REQUIRE(deferredErr);
+    CHECK(deferredErr->code == clipp::Error::Code::TooManyValues);
+    CHECK(deferredErr->value == "5");
+    REQUIRE(parser.parseInto(args, clipp::ArgvView(full, std::size(full))));
+    CHECK(args.ids.size() == 4);
+}
+
+struct EmbeddedExecArgs : public clipp::ArgsBase {
+    std::optional<int64_t> level;
+    std::string_view command;
+
+    void args()
+    {
+        flag(level, "level", 'l').env("CLIPP_TEST_EXEC_LEVEL");
+        positional(command, "command").halt();
+    }
+};
+
+TEST_CASE("halt and environment without allocating (EmbeddedExecArgs)")
+{
+    ::setenv("CLIPP_TEST_EXEC_LEVEL", "3", 1);
+    auto parser = getParser();
+    EmbeddedExecArgs args;
+    const char* full[] = { "ls", "-l", "/tmp", "/var" };
+    REQUIRE(parser.parseInto(args, clipp::ArgvView(full, std::size(full))));
+
+    const char* withLevel[] = { "-l", "1", "cat", "a" };
+    const char* fromEnv[] = { "df", "-h" };
+    bool withLevelOk = false, fromEnvOk = false;
+    const auto before = allocations.load();
+    withLevelOk = parser.parseInto(args, clipp::ArgvView(withLevel, std::size(withLevel)));
+    const auto withLevelRemaining = args.remainingView().size();
+    const auto withLevelValue = args.level;
+    fromEnvOk = parser.parseInto(args, clipp::ArgvView(fromEnv, std::size(fromEnv)));
+    const auto allocs = allocations.load() - before;
+    CHECK(allocs == 0);
+
+    REQUIRE(withLevelOk);
+    CHECK(withLevelRemaining == 1);
+    CHECK(withLevelValue == 1);
+    REQUIRE(fromEnvOk);
+    CHECK(args.command == "df");
+    CHECK(args.level == 3);
+    REQUIRE(args.remainingView().size() == 1);
+    CHECK(args.remainingView()[0] == "-h");
+    // Only remaining() copies
+    REQUIRE(args.remaining().size() == 1);
+    CHECK(args.remaining()[0] == "-h");
+    ::unsetenv("CLIPP_TEST_EXEC_LEVEL");
+}
@@ -0,0 +1,152 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+// Only these tests are built with the observer hooks, the other ones test the shipped
+// configuration
+#define CLIPP_INSTRUMENT
+#include "clipp.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// GCC doesn't understand that free is fine for memory from the replaced operator new
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+// Counts every allocation, so ParseStats can report them
+std::atomic<size_t> allocations { 0 };
+
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (auto ptr = std::malloc(size > 0 ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+struct NullOutput : clipp::OutputBase {
+    void out(std::string_view)
+    {
+    }
+
+    void err(std::string_view)
+    {
+    }
+};
+
+clipp::Parser getParser()
+{
+    auto parser = clipp::Parser("test");
+    parser.output(std::make_shared<NullOutput>());
+    parser.exit([](int) {});
+    return parser;
+}
+
+struct InstrumentedArgs : public clipp::ArgsBase {
+    std::optional<int64_t> level;
+    std::vector<std::string_view> files;
+
+    void args()
+    {
+        flag(level, "level", 'l');
+        positional(files, "files");
+    }
+};
+
+struct AddArgs : public clipp::ArgsBase {
+    bool fetch;
+    std::string name;
+
+    void args()
+    {
+        flag(fetch, "fetch", 'f');
+        positional(name, "name");
+    }
+};
+
+struct RemoteArgs : public clipp::ArgsBase {
+    bool verbose;
+    std::optional<AddArgs> add;
+
+    void args()
+    {
+        flag(verbose, "verbose", 'v');
+        subcommand(add, "add");
+    }
+};
+
+struct GitArgs : public clipp::ArgsBase {
+    std::optional<std::string> dir;
+    std::optional<RemoteArgs> remote;
+
+    void args()
+    {
+        flag(dir, "dir", 'C');
+        subcommand(remote, "remote");
+    }
+};
+
+TEST_CASE("instrumentation (InstrumentedArgs)")
+{
+    using clipp::Phase;
+    auto stats = std::make_shared<clipp::ParseStats>([]() { return allocations.load(); });
+    auto parser = getParser();
+    parser.observer(stats);
+
+    std::vector<std::string> argv { "-l", "3", "a", "b" };
+    REQUIRE(parser.parse<InstrumentedArgs>(argv).has_value());
+    REQUIRE(parser.parse<InstrumentedArgs>(argv).has_value());
+    CHECK(stats->phase(Phase::Schema).count == 1);
+    CHECK(stats->phase(Phase::Schema).allocations > 0);
+    CHECK(stats->phase(Phase::Tokenize).count == 2);
+    CHECK(stats->phase(Phase::Match).count == 2);
+    CHECK(stats->phase(Phase::Validate).count == 2);
+    CHECK(stats->phase(Phase::Convert).count == 0);
+    CHECK(stats->phase(Phase::Layers).count == 0);
+    CHECK(stats->phase(Phase::Format).count == 0);
+
+    // Views are converted too, but only the int64_t fails
+    std::vector<std::string> invalid { "-l", "x", "a" };
+    CHECK(!parser.parse<InstrumentedArgs>(invalid).has_value());
+    CHECK(stats->phase(Phase::Format).count == 1);
+    const auto types = stats->types();
+    REQUIRE(types.size() == 2);
+    size_t calls = 0, failures = 0;
+    for (const auto& type : types) {
+        calls += type.calls;
+        failures += type.failures;
+    }
+    CHECK(calls == 3 + 3 + 1);
+    CHECK(failures == 1);
+
+    parser.deferConversion(true);
+    REQUIRE(parser.parse<InstrumentedArgs>(argv).has_value());
+    CHECK(stats->phase(Phase::Convert).count == 1);
+}
+
+TEST_CASE("instrumentation of subcommands (GitArgs)")
+{
+    using clipp::Phase;
+    // Every subcommand is tokenized on its own, but during the Match phase of its parent
+    const auto stats = std::make_shared<clipp::ParseStats>();
+    auto parser = getParser();
+    parser.observer(stats);
+    std::vector<std::string> argv { "-C", "repo", "remote", "-v", "add", "-f", "origin" };
+    REQUIRE(parser.parse<GitArgs>(argv).has_value());
+    CHECK(stats->phase(Phase::Tokenize).count == 3);
+    CHECK(stats->phase(Phase::Match).count == 1);
+    CHECK(stats->summary().find("match: 1x ") != std::string::npos);
+}